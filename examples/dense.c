@@ -86,7 +86,9 @@ int main(void)
     VECTOR(weights)[i] = from == to ? 0 : ABS(VECTOR(weights)[i]);
   }
 
-  se2_igraph_to_neighbor_list(&graph, &weights, &neigh_list);
+  /* Weights are ordered by source then target so they form a column-major
+     adjacency matrix that can be clustered without copying. */
+  se2_neighs_from_dense(VECTOR(weights), n_nodes, &neigh_list);
 
   // Running SpeakEasy2
   se2_options opts = {
@@ -0,0 +1,94 @@
+#include <igraph_interface.h>
+#include <igraph_random.h>
+#include <speak_easy_2.h>
+
+/* Points on a small grid so most columns have many equally distant
+neighbors. With few rows the exact search uses a KD-tree, padding the same
+points with rows of zeros does not change any distance but makes it fall back
+to brute force. The sparse search skips the zeros. All three have to pick the
+same neighbors. */
+
+static igraph_bool_t same_graph(char const* name, igraph_t const* expected,
+  igraph_vector_t const* expected_weights, igraph_t const* graph,
+  igraph_vector_t const* weights)
+{
+  igraph_integer_t n_diff = 0;
+  for (igraph_integer_t eid = 0; eid < igraph_ecount(expected); eid++) {
+    if ((IGRAPH_FROM(graph, eid) != IGRAPH_FROM(expected, eid)) ||
+        (IGRAPH_TO(graph, eid) != IGRAPH_TO(expected, eid)) ||
+        (VECTOR(*weights)[eid] != VECTOR(*expected_weights)[eid])) {
+      n_diff++;
+    }
+  }
+
+  printf("%s: %" IGRAPH_PRId " edges differ\n", name, n_diff);
+  return n_diff == 0;
+}
+
+int main(void)
+{
+  igraph_integer_t const n_rows = 3, n_padded = 20, n_cols = 2000, k = 10;
+  igraph_integer_t const grid_size = 3;
+  igraph_matrix_t mat, padded;
+  igraph_t kdtree_graph, brute_graph, sparse_graph;
+  igraph_vector_t kdtree_weights, brute_weights, sparse_weights;
+  igraph_bool_t ok = true;
+
+  igraph_rng_seed(igraph_rng_default(), 1234);
+  igraph_matrix_init(&mat, n_rows, n_cols);
+  igraph_matrix_init(&padded, n_padded, n_cols);
+  for (igraph_integer_t j = 0; j < n_cols; j++) {
+    for (igraph_integer_t i = 0; i < n_rows; i++) {
+      MATRIX(mat, i, j) =
+        igraph_rng_get_integer(igraph_rng_default(), 0, grid_size - 1);
+      MATRIX(padded, i, j) = MATRIX(mat, i, j);
+    }
+  }
+
+  se2_knn_options opts = { .max_threads = 4 };
+  se2_knn_graph_opts(&mat, k, &opts, &kdtree_graph, &kdtree_weights);
+  se2_knn_graph_opts(&padded, k, &opts, &brute_graph, &brute_weights);
+
+  igraph_vector_int_t col_ptr, row_idx;
+  igraph_vector_t values;
+  igraph_vector_int_init(&col_ptr, n_cols + 1);
+  igraph_vector_int_init(&row_idx, 0);
+  igraph_vector_init(&values, 0);
+  for (igraph_integer_t j = 0; j < n_cols; j++) {
+    for (igraph_integer_t i = 0; i < n_rows; i++) {
+      if (MATRIX(mat, i, j) != 0) {
+        igraph_vector_int_push_back(&row_idx, i);
+        igraph_vector_push_back(&values, MATRIX(mat, i, j));
+      }
+    }
+    VECTOR(col_ptr)[j + 1] = igraph_vector_int_size(&row_idx);
+  }
+
+  se2_csc_matrix sparse = {
+    .n_rows = n_rows,
+    .n_cols = n_cols,
+    .col_ptr = VECTOR(col_ptr),
+    .row_idx = VECTOR(row_idx),
+    .values = VECTOR(values),
+  };
+  se2_knn_graph_csc(&sparse, k, &opts, &sparse_graph, &sparse_weights);
+
+  ok &= same_graph(
+    "KD-tree", &brute_graph, &brute_weights, &kdtree_graph, &kdtree_weights);
+  ok &= same_graph(
+    "Sparse", &brute_graph, &brute_weights, &sparse_graph, &sparse_weights);
+
+  igraph_destroy(&kdtree_graph);
+  igraph_destroy(&brute_graph);
+  igraph_destroy(&sparse_graph);
+  igraph_vector_destroy(&kdtree_weights);
+  igraph_vector_destroy(&brute_weights);
+  igraph_vector_destroy(&sparse_weights);
+  igraph_vector_int_destroy(&col_ptr);
+  igraph_vector_int_destroy(&row_idx);
+  igraph_vector_destroy(&values);
+  igraph_matrix_destroy(&mat);
+  igraph_matrix_destroy(&padded);
+
+  return ok ? IGRAPH_SUCCESS : IGRAPH_FAILURE;
+}
@@ -0,0 +1,556 @@
+#include <igraph_interface.h>
+#include <igraph_random.h>
+#include <math.h>
+#include <speak_easy_2.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Every way of building a graph has to reweigh it the same way the original
+reweighing did, which rescaled the weights in place after making sure each
+node has exactly one self-loop. That algorithm is kept below as the reference.
+Each graph is clustered and its in-degrees compared to the reference's, then
+its memberships and a subclustering compared to those of the first graph built
+from the same edges. Compressed graphs sort each node's edges, so their sums
+may round differently and their memberships are only compared to each other.
+Weights are multiples of 1/8 so single precision storage holds them exactly. */
+
+#define N_NODES 120
+#define N_BLOCKS 6
+
+/* Row i holds node i's edges. */
+typedef struct {
+  igraph_integer_t n_nodes;
+  igraph_integer_t* offsets;
+  igraph_integer_t* neighbors;
+  igraph_real_t* weights;
+} rows;
+
+/* Node i's edges as the original reweighing left them before setting the
+self-loop: divided by scale, with only the first self-loop kept (set to 0),
+or one with weight 0 appended if there was none. Dense rows keep their
+self-loop weight. Returns the position of the self-loop. */
+static igraph_integer_t old_row(rows const* g, igraph_bool_t const dense,
+  igraph_integer_t const i, igraph_real_t const scale,
+  igraph_integer_t* neighs, igraph_real_t* weights, igraph_integer_t* n_row)
+{
+  igraph_integer_t loop = -1;
+  *n_row = 0;
+  for (igraph_integer_t k = g->offsets[i]; k < g->offsets[i + 1]; k++) {
+    igraph_integer_t const neigh = g->neighbors[k];
+    if ((neigh == i) && !dense) {
+      if (loop != -1) {
+        continue;
+      }
+      loop = *n_row;
+      neighs[*n_row] = i;
+      weights[(*n_row)++] = 0;
+      continue;
+    }
+
+    if (neigh == i) {
+      loop = *n_row;
+    }
+    neighs[*n_row] = neigh;
+    weights[(*n_row)++] = g->weights[k] / scale;
+  }
+
+  if (loop == -1) {
+    loop = *n_row;
+    neighs[*n_row] = i;
+    weights[(*n_row)++] = 0;
+  }
+
+  return loop;
+}
+
+/* The in-degrees of g after the original reweighing. */
+static void old_reweigh(rows const* g, igraph_bool_t const dense,
+  igraph_real_t* kin)
+{
+  igraph_integer_t const n_nodes = g->n_nodes;
+  igraph_integer_t const n_edges = g->offsets[n_nodes];
+  igraph_integer_t* neighs = calloc(n_nodes + 1, sizeof(*neighs));
+  igraph_real_t* weights = calloc(n_nodes + 1, sizeof(*weights));
+  igraph_real_t* diagonal = calloc(n_nodes, sizeof(*diagonal));
+
+  igraph_real_t avg = 0;
+  for (igraph_integer_t k = 0; k < n_edges; k++) {
+    avg += g->weights[k];
+  }
+  avg /= n_edges;
+
+  igraph_real_t numerator = 0, denominator = 0, scale = 0;
+  for (igraph_integer_t i = 0; i < n_nodes; i++) {
+    for (igraph_integer_t k = g->offsets[i]; k < g->offsets[i + 1]; k++) {
+      igraph_real_t const value = g->weights[k] - avg;
+      denominator += value * value;
+      numerator += value * value * value;
+      if ((g->neighbors[k] != i) && (fabs(g->weights[k]) > scale)) {
+        scale = fabs(g->weights[k]);
+      }
+    }
+  }
+  numerator /= n_edges;
+  denominator /= n_edges;
+  igraph_bool_t const is_skewed =
+    numerator / sqrt(denominator * denominator * denominator) >= 2;
+
+  igraph_bool_t has_negatives = false;
+  for (igraph_integer_t i = 0; i < n_nodes; i++) {
+    igraph_integer_t n_row;
+    igraph_integer_t const loop =
+      old_row(g, dense, i, scale, neighs, weights, &n_row);
+    diagonal[i] = 1;
+    if (is_skewed) {
+      igraph_integer_t signs = 0;
+      diagonal[i] = 0;
+      for (igraph_integer_t j = 0; j < n_row; j++) {
+        diagonal[i] += weights[j];
+        if (weights[j]) {
+          signs += weights[j] < 0 ? -1 : 1;
+        }
+      }
+      diagonal[i] /= (signs == 0 ? 1 : signs);
+    }
+
+    for (igraph_integer_t j = 0; j < n_row; j++) {
+      has_negatives =
+        has_negatives || ((j == loop ? diagonal[i] : weights[j]) < 0);
+    }
+  }
+
+  igraph_real_t offset = 0;
+  if (is_skewed && !has_negatives) {
+    for (igraph_integer_t i = 0; i < n_nodes; i++) {
+      offset += diagonal[i];
+    }
+    offset /= n_nodes;
+  }
+
+  for (igraph_integer_t i = 0; i < n_nodes; i++) {
+    kin[i] = 0;
+  }
+
+  for (igraph_integer_t i = 0; i < n_nodes; i++) {
+    igraph_integer_t n_row;
+    igraph_integer_t const loop =
+      old_row(g, dense, i, scale, neighs, weights, &n_row);
+    weights[loop] = diagonal[i];
+    for (igraph_integer_t j = 0; j < n_row; j++) {
+      kin[neighs[j]] += weights[j] + offset;
+    }
+  }
+
+  free(neighs);
+  free(weights);
+  free(diagonal);
+}
+
+/* Clustering of the first graph built from the same edges. */
+typedef struct {
+  igraph_real_t kin[N_NODES];
+  igraph_matrix_int_t memb;
+  igraph_vector_int_t sub;
+  igraph_bool_t set;
+} expected;
+
+static se2_options cluster_opts(void)
+{
+  se2_options opts = { .random_seed = 1234, .subcluster = 2,
+    .max_threads = 2 };
+  return opts;
+}
+
+/* Cluster graph and compare it to the reference. The first graph checked
+against exp sets the expected memberships. */
+static igraph_bool_t check(char const* name, se2_neighs* graph, expected* exp)
+{
+  se2_options opts = cluster_opts();
+  igraph_matrix_int_t memb;
+  igraph_vector_int_t level, comms, sub;
+  igraph_bool_t ok = true;
+
+  speak_easy_2(graph, &opts, &memb);
+
+  for (igraph_integer_t i = 0; i < N_NODES; i++) {
+    igraph_real_t const diff = fabs(VECTOR(*graph->kin)[i] - exp->kin[i]);
+    ok = ok && (diff <= 1e-9 * (1 + fabs(exp->kin[i])));
+  }
+  if (!ok) {
+    printf("%s: in-degrees differ from the original reweighing\n", name);
+  }
+
+  igraph_vector_int_init(&level, N_NODES);
+  igraph_matrix_int_get_row(&memb, &level, 0);
+  igraph_vector_int_init(&comms, 2);
+  VECTOR(comms)[1] = 1;
+  igraph_vector_int_init(&sub, 0);
+  opts = cluster_opts();
+  se2_subcluster(graph, &opts, &level, &comms, &sub);
+
+  if (!exp->set) {
+    exp->memb = memb;
+    exp->sub = sub;
+    exp->set = true;
+  } else {
+    igraph_bool_t same = igraph_matrix_int_nrow(&memb) ==
+                         igraph_matrix_int_nrow(&exp->memb);
+    for (igraph_integer_t l = 0; same && (l < igraph_matrix_int_nrow(&memb));
+         l++) {
+      for (igraph_integer_t i = 0; i < N_NODES; i++) {
+        same = same && (MATRIX(memb, l, i) == MATRIX(exp->memb, l, i));
+      }
+    }
+    if (!same) {
+      printf("%s: memberships differ\n", name);
+    }
+
+    igraph_bool_t same_sub = true;
+    for (igraph_integer_t i = 0; i < N_NODES; i++) {
+      same_sub = same_sub && (VECTOR(sub)[i] == VECTOR(exp->sub)[i]);
+    }
+    if (!same_sub) {
+      printf("%s: subclusters differ\n", name);
+    }
+    ok = ok && same && same_sub;
+
+    igraph_matrix_int_destroy(&memb);
+    igraph_vector_int_destroy(&sub);
+  }
+
+  printf("%s: %s\n", name, ok ? "ok" : "FAILED");
+
+  igraph_vector_int_destroy(&level);
+  igraph_vector_int_destroy(&comms);
+
+  return ok;
+}
+
+static void expected_destroy(expected* exp)
+{
+  igraph_matrix_int_destroy(&exp->memb);
+  igraph_vector_int_destroy(&exp->sub);
+}
+
+/* A weight between nodes in the same block or not. Skewed graphs have a few
+much heavier edges. */
+static igraph_real_t draw_weight(igraph_bool_t const skewed)
+{
+  igraph_real_t const r = igraph_rng_get_unif01(igraph_rng_default());
+  if (skewed && (r < 0.05)) {
+    return 64;
+  }
+
+  return 1 + (igraph_integer_t)(8 * r) / 8.0;
+}
+
+static igraph_bool_t linked(igraph_integer_t const i, igraph_integer_t const j)
+{
+  igraph_real_t const p =
+    (i * N_BLOCKS / N_NODES) == (j * N_BLOCKS / N_NODES) ? 0.4 : 0.02;
+  return igraph_rng_get_unif01(igraph_rng_default()) < p;
+}
+
+/* A symmetric sparse graph with sorted rows. Every third node has no
+self-loop, with repeated_loops every fifth has two. */
+static void sparse_rows(
+  igraph_bool_t const skewed, igraph_bool_t const repeated_loops, rows* g)
+{
+  igraph_real_t* adj = calloc(N_NODES * N_NODES, sizeof(*adj));
+  for (igraph_integer_t i = 0; i < N_NODES; i++) {
+    for (igraph_integer_t j = i + 1; j < N_NODES; j++) {
+      if (linked(i, j)) {
+        adj[(i * N_NODES) + j] = adj[(j * N_NODES) + i] = draw_weight(skewed);
+      }
+    }
+  }
+
+  g->n_nodes = N_NODES;
+  g->offsets = calloc(N_NODES + 1, sizeof(*g->offsets));
+  g->neighbors = calloc((N_NODES + 1) * N_NODES, sizeof(*g->neighbors));
+  g->weights = calloc((N_NODES + 1) * N_NODES, sizeof(*g->weights));
+  igraph_integer_t pos = 0;
+  for (igraph_integer_t i = 0; i < N_NODES; i++) {
+    for (igraph_integer_t j = 0; j < N_NODES; j++) {
+      igraph_integer_t const n_loops =
+        i % 3 == 0 ? 0 : (repeated_loops && (i % 5 == 0) ? 2 : 1);
+      for (igraph_integer_t l = 0; (j == i) && (l < n_loops); l++) {
+        g->neighbors[pos] = i;
+        g->weights[pos++] = 2 + l;
+      }
+
+      if (adj[(i * N_NODES) + j] != 0) {
+        g->neighbors[pos] = j;
+        g->weights[pos++] = adj[(i * N_NODES) + j];
+      }
+    }
+    g->offsets[i + 1] = pos;
+  }
+
+  free(adj);
+}
+
+/* A ring without self-loops where 15% of the edges have weight 8 and the
+rest 1. Its skewness is just under the threshold of 2, so counting the
+self-loops reweighing adds as edges would wrongly make it skewed. */
+static void ring_rows(rows* g)
+{
+  g->n_nodes = N_NODES;
+  g->offsets = calloc(N_NODES + 1, sizeof(*g->offsets));
+  g->neighbors = calloc(2 * N_NODES, sizeof(*g->neighbors));
+  g->weights = calloc(2 * N_NODES, sizeof(*g->weights));
+  for (igraph_integer_t i = 0; i < N_NODES; i++) {
+    igraph_integer_t const prev = (i + N_NODES - 1) % N_NODES;
+    igraph_integer_t const next = (i + 1) % N_NODES;
+    igraph_integer_t const first = prev < next ? prev : next;
+    igraph_integer_t const last = prev < next ? next : prev;
+    g->offsets[i + 1] = 2 * (i + 1);
+    g->neighbors[2 * i] = first;
+    g->neighbors[(2 * i) + 1] = last;
+    g->weights[2 * i] = (first == prev ? prev : i) % 20 < 3 ? 8 : 1;
+    g->weights[(2 * i) + 1] = (last == prev ? prev : i) % 20 < 3 ? 8 : 1;
+  }
+}
+
+/* A complete symmetric graph whose non-edges have weight 0. */
+static void dense_rows(igraph_real_t const diagonal, rows* g)
+{
+  g->n_nodes = N_NODES;
+  g->offsets = calloc(N_NODES + 1, sizeof(*g->offsets));
+  g->neighbors = calloc(N_NODES * N_NODES, sizeof(*g->neighbors));
+  g->weights = calloc(N_NODES * N_NODES, sizeof(*g->weights));
+  for (igraph_integer_t i = 0; i < N_NODES; i++) {
+    g->offsets[i + 1] = (i + 1) * N_NODES;
+    for (igraph_integer_t j = 0; j <= i; j++) {
+      igraph_real_t const weight =
+        i == j ? diagonal : (linked(i, j) ? draw_weight(true) : 0);
+      g->neighbors[(i * N_NODES) + j] = j;
+      g->neighbors[(j * N_NODES) + i] = i;
+      g->weights[(i * N_NODES) + j] = g->weights[(j * N_NODES) + i] = weight;
+    }
+  }
+}
+
+static void rows_destroy(rows* g)
+{
+  free(g->offsets);
+  free(g->neighbors);
+  free(g->weights);
+}
+
+static void write_rows(rows const* g, char const* path, igraph_bool_t mm)
+{
+  FILE* f = fopen(path, "w");
+  if (mm) {
+    fprintf(f, "%%%%MatrixMarket matrix coordinate real general\n");
+    fprintf(f, "%" IGRAPH_PRId " %" IGRAPH_PRId " %" IGRAPH_PRId "\n",
+      g->n_nodes, g->n_nodes, g->offsets[g->n_nodes]);
+  }
+
+  for (igraph_integer_t i = 0; i < g->n_nodes; i++) {
+    for (igraph_integer_t k = g->offsets[i]; k < g->offsets[i + 1]; k++) {
+      fprintf(f, "%" IGRAPH_PRId " %" IGRAPH_PRId " %g\n", i + mm,
+        g->neighbors[k] + mm, g->weights[k]);
+    }
+  }
+  fclose(f);
+}
+
+/* Build g as a CSR matrix with the given index and value widths, checking
+the graph or, if compressed is set, a compressed copy of it. */
+static igraph_bool_t check_csr(char const* name, rows const* g,
+  se2_csr_index_type const index_type, se2_csr_value_type const value_type,
+  igraph_bool_t const compress, expected* exp)
+{
+  igraph_integer_t const n_edges = g->offsets[g->n_nodes];
+  size_t const index_size = index_type == SE2_CSR_INT32 ? 4 : 8;
+  size_t const value_size = value_type == SE2_CSR_FLOAT ? 4 : 8;
+  char* row_ptr = calloc(g->n_nodes + 1, index_size);
+  char* col_idx = calloc(n_edges, index_size);
+  char* values = calloc(n_edges, value_size);
+
+  for (igraph_integer_t i = 0; i <= g->n_nodes; i++) {
+    if (index_type == SE2_CSR_INT32) {
+      ((int32_t*)row_ptr)[i] = (int32_t)g->offsets[i];
+    } else {
+      ((int64_t*)row_ptr)[i] = g->offsets[i];
+    }
+  }
+
+  for (igraph_integer_t k = 0; k < n_edges; k++) {
+    if (index_type == SE2_CSR_INT32) {
+      ((int32_t*)col_idx)[k] = (int32_t)g->neighbors[k];
+    } else {
+      ((int64_t*)col_idx)[k] = g->neighbors[k];
+    }
+
+    if (value_type == SE2_CSR_FLOAT) {
+      ((float*)values)[k] = (float)g->weights[k];
+    } else {
+      ((double*)values)[k] = g->weights[k];
+    }
+  }
+
+  se2_csr_matrix mat = {
+    .n_nodes = g->n_nodes,
+    .row_ptr = row_ptr,
+    .col_idx = col_idx,
+    .values = values,
+    .index_type = index_type,
+    .value_type = value_type,
+  };
+  se2_neighs graph;
+  se2_neighs_from_csr(&mat, &graph);
+  if (compress) {
+    se2_neighs compressed;
+    se2_neighs_compress(&graph, &compressed);
+    se2_neighs_destroy(&graph);
+    graph = compressed;
+  }
+  igraph_bool_t ok = check(name, &graph, exp);
+
+  se2_neighs_destroy(&graph);
+  free(row_ptr);
+  free(col_idx);
+  free(values);
+
+  return ok;
+}
+
+/* Check every way of building the sparse graph g, then destroy it. */
+static igraph_bool_t check_sparse(char const* name, rows* g)
+{
+  expected exp = { .set = false };
+  se2_neighs graph, compressed, opened;
+  igraph_bool_t ok = true;
+  char label[64];
+
+  printf("%s\n", name);
+  old_reweigh(g, false, exp.kin);
+
+  write_rows(g, "reweigh_edges.txt", false);
+  se2_neighs_read("reweigh_edges.txt", SE2_EDGE_LIST, true, 2, &graph);
+
+  // Subclustering needs the graph to be reweighed first.
+  se2_options opts = cluster_opts();
+  igraph_vector_int_t memb, comms, sub;
+  igraph_vector_int_init(&memb, N_NODES);
+  igraph_vector_int_init(&comms, 1);
+  igraph_vector_int_init(&sub, 0);
+  if (se2_subcluster(&graph, &opts, &memb, &comms, &sub) != IGRAPH_EINVAL) {
+    printf("  subcluster accepted a graph that was not reweighed\n");
+    ok = false;
+  }
+  igraph_vector_int_destroy(&memb);
+  igraph_vector_int_destroy(&comms);
+  igraph_vector_int_destroy(&sub);
+
+  ok &= check("  edge list", &graph, &exp);
+  se2_neighs_save(&graph, "reweigh_graph.se2");
+  se2_neighs_destroy(&graph);
+
+  se2_neighs_open("reweigh_graph.se2", true, &opened);
+  ok &= check("  saved", &opened, &exp);
+  se2_neighs_destroy(&opened);
+
+  write_rows(g, "reweigh_edges.mtx", true);
+  se2_neighs_read("reweigh_edges.mtx", SE2_MATRIX_MARKET, true, 2, &graph);
+  ok &= check("  matrix market", &graph, &exp);
+  se2_neighs_destroy(&graph);
+
+  se2_csr_index_type const index_types[] = { SE2_CSR_INT64, SE2_CSR_INT32 };
+  se2_csr_value_type const value_types[] = { SE2_CSR_DOUBLE, SE2_CSR_FLOAT };
+  for (int it = 0; it < 2; it++) {
+    for (int vt = 0; vt < 2; vt++) {
+      snprintf(label, sizeof(label), "  CSR %d-bit %s", it ? 32 : 64,
+        vt ? "float" : "double");
+      ok &=
+        check_csr(label, g, index_types[it], value_types[vt], false, &exp);
+    }
+  }
+
+  expected exp_compressed = { .set = false };
+  memcpy(exp_compressed.kin, exp.kin, sizeof(exp.kin));
+  se2_neighs_read("reweigh_edges.txt", SE2_EDGE_LIST, true, 2, &graph);
+  se2_neighs_compress(&graph, &compressed);
+  se2_neighs_destroy(&graph);
+  ok &= check("  compressed edge list", &compressed, &exp_compressed);
+  se2_neighs_destroy(&compressed);
+  ok &= check_csr("  compressed CSR 32-bit float", g, SE2_CSR_INT32,
+    SE2_CSR_FLOAT, true, &exp_compressed);
+  expected_destroy(&exp_compressed);
+
+  remove("reweigh_edges.txt");
+  remove("reweigh_edges.mtx");
+  remove("reweigh_graph.se2");
+  expected_destroy(&exp);
+  rows_destroy(g);
+
+  return ok;
+}
+
+static igraph_bool_t check_dense(char const* name, igraph_real_t diagonal)
+{
+  expected exp = { .set = false };
+  rows g;
+  se2_neighs graph;
+  igraph_matrix_t mat;
+  igraph_bool_t ok = true;
+
+  printf("%s\n", name);
+  dense_rows(diagonal, &g);
+  old_reweigh(&g, true, exp.kin);
+
+  // The weights are symmetric so rows can be read as columns.
+  se2_neighs_from_dense(g.weights, N_NODES, &graph);
+  ok &= check("  dense", &graph, &exp);
+  se2_neighs_destroy(&graph);
+
+  igraph_matrix_init(&mat, N_NODES, N_NODES);
+  for (igraph_integer_t i = 0; i < N_NODES; i++) {
+    for (igraph_integer_t j = 0; j < N_NODES; j++) {
+      MATRIX(mat, i, j) = g.weights[(i * N_NODES) + j];
+    }
+  }
+  se2_neighs_from_matrix(&mat, &graph);
+  ok &= check("  matrix", &graph, &exp);
+  se2_neighs_destroy(&graph);
+  igraph_matrix_destroy(&mat);
+
+  float* packed = calloc(N_NODES * (N_NODES + 1) / 2, sizeof(*packed));
+  igraph_integer_t pos = 0;
+  for (igraph_integer_t i = 0; i < N_NODES; i++) {
+    for (igraph_integer_t j = i; j < N_NODES; j++) {
+      packed[pos++] = (float)g.weights[(i * N_NODES) + j];
+    }
+  }
+  se2_neighs_from_packed(packed, N_NODES, &graph);
+  ok &= check("  packed", &graph, &exp);
+  se2_neighs_destroy(&graph);
+  free(packed);
+
+  expected_destroy(&exp);
+  rows_destroy(&g);
+
+  return ok;
+}
+
+int main(void)
+{
+  igraph_bool_t ok = true;
+  rows g;
+
+  igraph_set_error_handler(igraph_error_handler_ignore);
+  igraph_rng_seed(igraph_rng_default(), 1234);
+
+  sparse_rows(true, false, &g);
+  ok &= check_sparse("Sparse, skewed", &g);
+  sparse_rows(false, true, &g);
+  ok &= check_sparse("Sparse, repeated self-loops", &g);
+  ring_rows(&g);
+  ok &= check_sparse("Ring, nearly skewed", &g);
+  ok &= check_dense("Dense", 1);
+  ok &= check_dense("Dense, negative diagonal", -20);
+
+  return ok ? IGRAPH_SUCCESS : IGRAPH_FAILURE;
+}
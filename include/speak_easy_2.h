@@ -13,6 +13,14 @@
 # define SE2PAR
 #endif
 
+/* Called by speak_easy_2 as soon as a level of the hierarchy is complete.
+level_memb is the membership of the given (0-based) level and is only valid
+for the duration of the call. Return IGRAPH_STOP to skip the remaining levels,
+any other error aborts speak_easy_2. */
+typedef igraph_error_t se2_level_callback(
+  igraph_vector_int_t const* level_memb, igraph_integer_t const level,
+  void* extra);
+
 typedef struct {
   igraph_integer_t independent_runs; // Number of independent runs to perform.
   igraph_integer_t subcluster;       // Depth of clustering.
@@ -28,8 +36,90 @@ typedef struct {
   igraph_integer_t max_threads; // Number of threads to use.
   igraph_bool_t node_confidence;
   igraph_bool_t verbose; // Print information to stdout
+  se2_level_callback* level_callback; // Optional, called as levels finish.
+  void* level_callback_extra;         // Passed to level_callback.
 } se2_options;
 
+struct se2_view;
+struct se2_borrowed;
+
+typedef enum {
+  SE2_KNN_EXACT = 0,   // Exact neighbors (default).
+  SE2_KNN_APPROXIMATE // Approximate neighbors using NN-descent.
+} se2_knn_method;
+
+typedef enum {
+  SE2_KNN_EUCLIDEAN = 0, // Inverse euclidean distance (default).
+  SE2_KNN_COSINE,        // Cosine similarity.
+  SE2_KNN_PEARSON        // Pearson correlation.
+} se2_knn_metric;
+
+typedef enum {
+  SE2_KNN_DIRECTED = 0, // Keep each node's own k neighbors (default).
+  SE2_KNN_UNION,        // Neighbors in either direction.
+  SE2_KNN_MUTUAL        // Only neighbors in both directions.
+} se2_knn_symmetrize;
+
+typedef struct {
+  igraph_integer_t max_threads;  // Number of threads to use (default 1).
+  se2_knn_method method;         // How to search for neighbors.
+  se2_knn_metric metric;         // How to compare columns.
+  se2_knn_symmetrize symmetrize; // se2_knn_neighs only.
+  /* Approximate search only. Stop after max_iterations rounds (default 10) or
+     once fewer than tolerance * k * ncols neighbors changed in a round
+     (default 0.001). More rounds and lower tolerance improve recall at the
+     cost of time. */
+  igraph_integer_t max_iterations;
+  igraph_real_t tolerance;
+  igraph_integer_t random_seed; // Approximate search and projection.
+  /* Dense input only. If greater than 0 and less than the number of rows,
+     search for neighbors after randomly projecting the columns down to this
+     many rows (default 0, no projection). */
+  igraph_integer_t target_dim;
+  // File input only. Bytes of the matrix to map at a time (default 1 GiB).
+  igraph_integer_t max_memory;
+} se2_knn_options;
+
+typedef enum {
+  SE2_EDGE_LIST = 0, // Lines of "from to [weight]" with 0-based node ids.
+  SE2_MATRIX_MARKET  // Coordinate Matrix Market, entry (i, j) is edge i -> j.
+} se2_edges_format;
+
+/* Compressed sparse column matrix borrowed from the caller. The stored values
+of column j are values[col_ptr[j]] to values[col_ptr[j + 1] - 1], in rows
+row_idx[col_ptr[j]] to row_idx[col_ptr[j + 1] - 1] which must be strictly
+increasing. col_ptr has n_cols + 1 elements and col_ptr[0] is 0. */
+typedef struct {
+  igraph_integer_t n_rows;
+  igraph_integer_t n_cols;
+  igraph_integer_t const* col_ptr;
+  igraph_integer_t const* row_idx;
+  igraph_real_t const* values;
+} se2_csc_matrix;
+
+typedef enum {
+  SE2_CSR_INT64 = 0, // int64_t row pointers and column indices (default).
+  SE2_CSR_INT32      // int32_t row pointers and column indices.
+} se2_csr_index_type;
+
+typedef enum {
+  SE2_CSR_DOUBLE = 0, // double values (default).
+  SE2_CSR_FLOAT       // float values.
+} se2_csr_value_type;
+
+/* Compressed sparse row adjacency matrix borrowed from the caller. Node i's
+neighbors are col_idx[row_ptr[i]] to col_idx[row_ptr[i + 1] - 1] and the
+weights of those edges are at the same positions of values, which is NULL for
+unweighted graphs. row_ptr has n_nodes + 1 elements and row_ptr[0] is 0. */
+typedef struct {
+  igraph_integer_t n_nodes;
+  void const* row_ptr;
+  void const* col_idx;
+  void const* values;
+  se2_csr_index_type index_type;
+  se2_csr_value_type value_type;
+} se2_csr_matrix;
+
 typedef struct {
   igraph_vector_int_list_t* neigh_list;
   igraph_vector_list_t* weights;
@@ -37,16 +127,61 @@ typedef struct {
   igraph_integer_t n_nodes;
   igraph_vector_t* kin;
   igraph_real_t total_weight;
+  igraph_bool_t reweighed; // Weights are already normalized for clustering.
+  struct se2_view* view; // Set only for induced subgraph views (internal).
+  struct se2_borrowed* borrowed; // Set if the edges are not owned (internal).
 } se2_neighs;
 
 igraph_error_t se2_igraph_to_neighbor_list(igraph_t const* graph,
   igraph_vector_t const* weights, se2_neighs* neigh_list);
+igraph_error_t se2_neighs_from_igraph(igraph_t const* graph,
+  igraph_vector_t const* weights, igraph_integer_t max_threads,
+  igraph_bool_t const merge_duplicates, se2_neighs* res);
 void se2_neighs_destroy(se2_neighs* graph);
+igraph_error_t se2_neighs_save(se2_neighs const* graph, char const* path);
+igraph_error_t se2_neighs_open(
+  char const* path, igraph_bool_t const check, se2_neighs* res);
+igraph_error_t se2_neighs_from_csr(
+  se2_csr_matrix const* mat, se2_neighs* res);
+igraph_error_t se2_neighs_from_dense(
+  igraph_real_t const* data, igraph_integer_t const n_nodes, se2_neighs* res);
+igraph_error_t se2_neighs_from_matrix(
+  igraph_matrix_t const* mat, se2_neighs* res);
+igraph_error_t se2_neighs_from_packed(
+  float const* data, igraph_integer_t const n_nodes, se2_neighs* res);
+igraph_error_t se2_neighs_compress(
+  se2_neighs const* graph, se2_neighs* res);
+igraph_error_t se2_neighs_read(char const* path,
+  se2_edges_format const format, igraph_bool_t const directed,
+  igraph_integer_t max_threads, se2_neighs* res);
 
 igraph_error_t speak_easy_2(
   se2_neighs* graph, se2_options* opts, igraph_matrix_int_t* res);
+igraph_error_t se2_subcluster(se2_neighs const* graph, se2_options* opts,
+  igraph_vector_int_t const* memb, igraph_vector_int_t const* comms,
+  igraph_vector_int_t* res);
 igraph_error_t se2_order_nodes(se2_neighs const* graph,
   igraph_matrix_int_t const* memb, igraph_matrix_int_t* ordering);
 igraph_error_t se2_knn_graph(igraph_matrix_t* mat, igraph_integer_t const k,
   igraph_t* res, igraph_vector_t* weights);
+igraph_error_t se2_knn_graph_opts(igraph_matrix_t* mat,
+  igraph_integer_t const k, se2_knn_options* opts, igraph_t* res,
+  igraph_vector_t* weights);
+igraph_error_t se2_knn_graph_append(igraph_matrix_t* mat,
+  igraph_integer_t const n_old, igraph_integer_t const k,
+  se2_knn_options* opts, igraph_t* graph, igraph_vector_t* weights);
+igraph_error_t se2_knn_neighs(igraph_matrix_t* mat, igraph_integer_t const k,
+  se2_knn_options* opts, se2_neighs* res);
+igraph_error_t se2_knn_graph_csc(se2_csc_matrix const* mat,
+  igraph_integer_t const k, se2_knn_options* opts, igraph_t* res,
+  igraph_vector_t* weights);
+igraph_error_t se2_knn_neighs_csc(se2_csc_matrix const* mat,
+  igraph_integer_t const k, se2_knn_options* opts, se2_neighs* res);
+igraph_error_t se2_knn_graph_file(char const* path,
+  igraph_integer_t const n_rows, igraph_integer_t const n_cols,
+  igraph_integer_t const k, se2_knn_options* opts, igraph_t* res,
+  igraph_vector_t* weights);
+igraph_error_t se2_knn_neighs_file(char const* path,
+  igraph_integer_t const n_rows, igraph_integer_t const n_cols,
+  igraph_integer_t const k, se2_knn_options* opts, se2_neighs* res);
 #endif
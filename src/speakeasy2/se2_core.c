@@ -530,166 +530,192 @@ static void se2_set_defaults(se2_neighs const* graph, se2_options* opts)
     opts, max_threads, default_max_threads(opts->independent_runs));
   SE2_SET_OPTION(opts, node_confidence, false);
   SE2_SET_OPTION(opts, verbose, false);
-}
 
-static igraph_error_t se2_collect_community_members(
-  igraph_vector_int_t const* memb, igraph_vector_int_t* idx,
-  igraph_integer_t const comm)
-{
-  igraph_integer_t n_memb = 0;
-  for (igraph_integer_t i = 0; i < igraph_vector_int_size(memb); i++) {
-    n_memb += VECTOR(*memb)[i] == comm;
-  }
-
-  IGRAPH_CHECK(igraph_vector_int_init(idx, n_memb));
-  IGRAPH_FINALLY(igraph_vector_int_destroy, idx);
-  igraph_integer_t count = 0;
-  for (igraph_integer_t i = 0; i < igraph_vector_int_size(memb); i++) {
-    if (VECTOR(*memb)[i] == comm) {
-      VECTOR(*idx)[count] = i;
-      count++;
-    }
+#ifndef SE2PAR
+  if (opts->max_threads > 1) {
+    IGRAPH_WARNING(
+      "SpeakEasy 2 was not compiled with thread support. "
+      "Ignoring `max_threads`.\n\n"
+      "To suppress this warning do not set `max_threads`\n.");
   }
-
-  IGRAPH_FINALLY_CLEAN(1);
-  return IGRAPH_SUCCESS;
+  opts->max_threads = 1;
+#endif
 }
 
-static igraph_error_t se2_subgraph_from_community(se2_neighs const* origin,
-  se2_neighs* subgraph, igraph_vector_int_t const* members)
+/* Members of every community collected with a single counting sort. The
+members of community c are ids[offsets[c]] up to ids[offsets[c + 1]] in
+ascending order. local_ids maps each node to its position within its
+community. Labels must be non-negative, there is a community for every label
+up to the largest, those without members are empty. */
+struct se2_community_members {
+  igraph_vector_int_t offsets;
+  igraph_vector_int_t ids;
+  igraph_vector_int_t local_ids;
+  igraph_integer_t n_comms;
+};
+
+static void se2_community_members_destroy(
+  struct se2_community_members* members)
 {
-  igraph_integer_t const n_membs = igraph_vector_int_size(members);
-  subgraph->n_nodes = n_membs;
-
-  subgraph->neigh_list = igraph_malloc(sizeof(*subgraph->neigh_list));
-  IGRAPH_CHECK_OOM(subgraph->neigh_list, "");
-  IGRAPH_FINALLY(igraph_free, subgraph->neigh_list);
-  IGRAPH_CHECK(igraph_vector_int_list_init(subgraph->neigh_list, n_membs));
-  IGRAPH_FINALLY(igraph_vector_int_list_destroy, subgraph->neigh_list);
-
-  subgraph->sizes = igraph_malloc(sizeof(*subgraph->sizes));
-  IGRAPH_CHECK_OOM(subgraph->sizes, "");
-  IGRAPH_FINALLY(igraph_free, subgraph->sizes);
-  IGRAPH_CHECK(igraph_vector_int_init(subgraph->sizes, n_membs));
-  IGRAPH_FINALLY(igraph_vector_int_destroy, subgraph->sizes);
-
-  subgraph->kin = igraph_malloc(sizeof(*subgraph->kin));
-  IGRAPH_CHECK_OOM(subgraph->kin, "");
-  IGRAPH_FINALLY(igraph_free, subgraph->kin);
-  IGRAPH_CHECK(igraph_vector_init(subgraph->kin, n_membs));
-  IGRAPH_FINALLY(igraph_vector_destroy, subgraph->kin);
-
-  if (HASWEIGHTS(*origin)) {
-    subgraph->weights = igraph_malloc(sizeof(*subgraph->weights));
-    IGRAPH_CHECK_OOM(subgraph->weights, "");
-    IGRAPH_FINALLY(igraph_free, subgraph->weights);
-    IGRAPH_CHECK(igraph_vector_list_init(subgraph->weights, n_membs));
-    IGRAPH_FINALLY(igraph_vector_list_destroy, subgraph->weights);
-  } else {
-    subgraph->weights = NULL;
-  }
-
-  igraph_vector_int_t neighs;
-  if (!ISSPARSE(*origin)) {
-    IGRAPH_CHECK(igraph_vector_int_init(&neighs, se2_vcount(origin)));
-    IGRAPH_FINALLY(igraph_vector_int_destroy, &neighs);
-
-    for (igraph_integer_t i = 0; i < se2_vcount(origin); i++) {
-      VECTOR(neighs)[i] = i;
-    }
-  }
+  igraph_vector_int_destroy(&members->offsets);
+  igraph_vector_int_destroy(&members->ids);
+  igraph_vector_int_destroy(&members->local_ids);
+}
 
-  for (igraph_integer_t i = 0; i < n_membs; i++) {
-    igraph_integer_t node_id = VECTOR(*members)[i];
-    igraph_vector_int_t* new_neighs = &NEIGHBORS(*subgraph, i);
-    igraph_integer_t const n_neighs = N_NEIGHBORS(*origin, node_id);
-    igraph_vector_t* w =
-      HASWEIGHTS(*subgraph) ? &WEIGHTS_IN(*subgraph, i) : NULL;
+static igraph_error_t se2_community_members_init(
+  igraph_vector_int_t const* memb, struct se2_community_members* members)
+{
+  igraph_integer_t const n_nodes = igraph_vector_int_size(memb);
+  igraph_integer_t const n_comms =
+    n_nodes > 0 ? igraph_vector_int_max(memb) + 1 : 0;
 
-    IGRAPH_CHECK(igraph_vector_int_resize(new_neighs, n_neighs));
-    if (HASWEIGHTS(*subgraph)) {
-      IGRAPH_CHECK(igraph_vector_resize(w, n_neighs));
-    }
+  IGRAPH_CHECK(igraph_vector_int_init(&members->offsets, n_comms + 1));
+  IGRAPH_FINALLY(igraph_vector_int_destroy, &members->offsets);
+  IGRAPH_CHECK(igraph_vector_int_init(&members->ids, n_nodes));
+  IGRAPH_FINALLY(igraph_vector_int_destroy, &members->ids);
+  IGRAPH_CHECK(igraph_vector_int_init(&members->local_ids, n_nodes));
+  IGRAPH_FINALLY(igraph_vector_int_destroy, &members->local_ids);
+  members->n_comms = n_comms;
 
-    if (ISSPARSE(*origin)) {
-      neighs = NEIGHBORS(*origin, node_id);
-    }
+  igraph_integer_t* offsets = VECTOR(members->offsets);
+  for (igraph_integer_t i = 0; i < n_nodes; i++) {
+    offsets[VECTOR(*memb)[i] + 1]++;
+  }
 
-    igraph_integer_t count = 0;
-    igraph_integer_t pos;
-    for (igraph_integer_t j = 0; j < n_neighs; j++) {
-      if (igraph_vector_int_search(members, 0, VECTOR(neighs)[j], &pos)) {
-        VECTOR(*new_neighs)[count] = pos;
-        if (HASWEIGHTS(*subgraph)) {
-          VECTOR(*w)[count] = WEIGHT(*origin, node_id, j);
-        }
-        count++;
-      }
-    }
+  for (igraph_integer_t comm = 0; comm < n_comms; comm++) {
+    offsets[comm + 1] += offsets[comm];
+  }
 
-    VECTOR(*subgraph->sizes)[i] = count;
-    IGRAPH_CHECK(igraph_vector_int_resize(new_neighs, count));
-    if (HASWEIGHTS(*subgraph)) {
-      IGRAPH_CHECK(igraph_vector_resize(w, count));
-    }
+  // Use the start of each community as a fill cursor then shift the offsets
+  // back into place.
+  for (igraph_integer_t i = 0; i < n_nodes; i++) {
+    VECTOR(members->ids)[offsets[VECTOR(*memb)[i]]++] = i;
   }
 
-  if (!ISSPARSE(*origin)) {
-    igraph_vector_int_destroy(&neighs);
-    IGRAPH_FINALLY_CLEAN(1);
+  for (igraph_integer_t comm = n_comms; comm > 0; comm--) {
+    offsets[comm] = offsets[comm - 1];
   }
+  offsets[0] = 0;
 
-  for (igraph_integer_t i = 0; i < n_membs; i++) {
-    for (igraph_integer_t j = 0; j < N_NEIGHBORS(*subgraph, i); j++) {
-      VECTOR(*subgraph->kin)
-      [NEIGHBOR(*subgraph, i, j)] +=
-        HASWEIGHTS(*subgraph) ? WEIGHT(*subgraph, i, j) : 1;
+  for (igraph_integer_t comm = 0; comm < n_comms; comm++) {
+    for (igraph_integer_t i = offsets[comm]; i < offsets[comm + 1]; i++) {
+      VECTOR(members->local_ids)[VECTOR(members->ids)[i]] = i - offsets[comm];
     }
   }
-  subgraph->total_weight = igraph_vector_sum(subgraph->kin);
 
-  if (HASWEIGHTS(*subgraph)) {
-    IGRAPH_FINALLY_CLEAN(2);
-  }
-  IGRAPH_FINALLY_CLEAN(6);
+  IGRAPH_FINALLY_CLEAN(3);
 
   return IGRAPH_SUCCESS;
 }
 
+static inline igraph_integer_t se2_community_size(
+  struct se2_community_members const* members, igraph_integer_t const comm)
+{
+  return VECTOR(members->offsets)[comm + 1] - VECTOR(members->offsets)[comm];
+}
+
+static inline igraph_integer_t const* se2_community_ids(
+  struct se2_community_members const* members, igraph_integer_t const comm)
+{
+  return VECTOR(members->ids) + VECTOR(members->offsets)[comm];
+}
+
 /* For hierarchical clustering, each community from the previous level gets
 clustered. Each of these clusters gets a "private scope" set of labels starting
 at 0. These must be relabeled to a global scope. */
-static igraph_error_t se2_relabel_hierarchical_communities(
-  igraph_vector_int_t const* prev_membs, igraph_vector_int_t* level_membs)
+static void se2_relabel_hierarchical_communities(
+  struct se2_community_members const* prev_members,
+  igraph_vector_int_t* level_membs)
 {
-  igraph_integer_t const n_comms =
-    igraph_vector_int_max(prev_membs) - igraph_vector_int_min(prev_membs) + 1;
-
   igraph_integer_t prev_max = 0;
   igraph_integer_t curr_max = 0;
-  for (igraph_integer_t i = 0; i < n_comms; i++) {
-    igraph_vector_int_t member_ids;
-    IGRAPH_CHECK(se2_collect_community_members(prev_membs, &member_ids, i));
-    IGRAPH_FINALLY(igraph_vector_int_destroy, &member_ids);
+  for (igraph_integer_t i = 0; i < prev_members->n_comms; i++) {
+    if (se2_community_size(prev_members, i) == 0) {
+      continue;
+    }
 
-    for (igraph_integer_t j = 0; j < igraph_vector_int_size(&member_ids);
+    igraph_integer_t const* member_ids = se2_community_ids(prev_members, i);
+    for (igraph_integer_t j = 0; j < se2_community_size(prev_members, i);
          j++) {
-      igraph_integer_t local_label =
-        VECTOR(*level_membs)[VECTOR(member_ids)[j]];
+      igraph_integer_t local_label = VECTOR(*level_membs)[member_ids[j]];
 
-      VECTOR(*level_membs)[VECTOR(member_ids)[j]] += prev_max;
+      VECTOR(*level_membs)[member_ids[j]] += prev_max;
       if ((local_label + prev_max) > curr_max) {
         curr_max = local_label + prev_max;
       }
     }
     prev_max = curr_max + 1;
-    igraph_vector_int_destroy(&member_ids);
-    IGRAPH_FINALLY_CLEAN(1);
   }
+}
+
+/* Cluster each community of prev_memb with more than minclust members
+independently. If selected is not NULL, only communities with a true value in
+selected are clustered. All other communities are kept whole.
+
+The resulting labels are relabeled to a global scope. */
+static igraph_error_t se2_subcluster_level(se2_neighs const* graph,
+  igraph_integer_t const level, se2_options const* opts,
+  igraph_vector_int_t const* prev_memb, igraph_vector_bool_t const* selected,
+  igraph_vector_int_t* level_memb)
+{
+  struct se2_community_members prev_members;
+  IGRAPH_CHECK(se2_community_members_init(prev_memb, &prev_members));
+  IGRAPH_FINALLY(se2_community_members_destroy, &prev_members);
+
+  for (igraph_integer_t comm = 0; comm < prev_members.n_comms; comm++) {
+    igraph_integer_t const* member_ids =
+      se2_community_ids(&prev_members, comm);
+    igraph_integer_t const n_membs = se2_community_size(&prev_members, comm);
+
+    if ((n_membs <= opts->minclust) ||
+        ((selected) && (!VECTOR(*selected)[comm]))) {
+      for (igraph_integer_t i = 0; i < n_membs; i++) {
+        VECTOR(*level_memb)[member_ids[i]] = 0;
+      }
+
+      continue;
+    }
+
+    se2_neighs subgraph;
+    igraph_vector_int_t subgraph_memb;
+
+    IGRAPH_CHECK(se2_neighs_view_init(&subgraph, graph, VECTOR(*prev_memb),
+      VECTOR(prev_members.local_ids), comm, member_ids, n_membs));
+    IGRAPH_FINALLY(se2_neighs_destroy, &subgraph);
+    IGRAPH_CHECK(igraph_vector_int_init(&subgraph_memb, n_membs));
+    IGRAPH_FINALLY(igraph_vector_int_destroy, &subgraph_memb);
+
+    IGRAPH_CHECK(
+      se2_reweigh(&subgraph, opts->max_threads, /* verbose */ false));
+    IGRAPH_CHECK(se2_bootstrap(&subgraph, level, opts, &subgraph_memb));
+
+    for (igraph_integer_t i = 0; i < n_membs; i++) {
+      VECTOR(*level_memb)[member_ids[i]] = VECTOR(subgraph_memb)[i];
+    }
+
+    igraph_vector_int_destroy(&subgraph_memb);
+    se2_neighs_destroy(&subgraph);
+    IGRAPH_FINALLY_CLEAN(2);
+  }
+
+  se2_relabel_hierarchical_communities(&prev_members, level_memb);
+  se2_community_members_destroy(&prev_members);
+  IGRAPH_FINALLY_CLEAN(1);
 
   return IGRAPH_SUCCESS;
 }
 
+/* Hand a finished level to the caller's callback if one was provided. */
+static igraph_error_t se2_level_done(se2_options const* opts,
+  igraph_vector_int_t const* level_memb, igraph_integer_t const level)
+{
+  if (!opts->level_callback) {
+    return IGRAPH_SUCCESS;
+  }
+
+  return opts->level_callback(level_memb, level, opts->level_callback_extra);
+}
+
 /**
 \brief speakeasy 2 community detection.
 
@@ -699,6 +725,10 @@ static igraph_error_t se2_relabel_hierarchical_communities(
 \param opts a speakeasy options structure (see speak_easy_2.h).
 \param memb the resulting membership vector.
 
+If opts->level_callback is set, it is called with each row of memb as soon
+as that level is complete. If the callback returns IGRAPH_STOP, no deeper
+levels are computed and memb only contains the completed levels.
+
 \return Error code:
 */
 igraph_error_t speak_easy_2(
@@ -711,17 +741,10 @@ igraph_error_t speak_easy_2(
 
   se2_set_defaults(graph, opts);
 
-#ifndef SE2PAR
-  if (opts->max_threads > 1) {
-    IGRAPH_WARNING(
-      "SpeakEasy 2 was not compiled with thread support. "
-      "Ignoring `max_threads`.\n\n"
-      "To suppress this warning do not set `max_threads`\n.");
+  // Graphs opened from a file may have been reweighed before saving.
+  if (!graph->reweighed) {
+    IGRAPH_CHECK(se2_reweigh(graph, opts->max_threads, opts->verbose));
   }
-  opts->max_threads = 1;
-#endif
-
-  IGRAPH_CHECK(se2_reweigh(graph, opts->verbose));
 
   if (opts->verbose) {
     igraph_bool_t isweighted = false;
@@ -762,7 +785,11 @@ igraph_error_t speak_easy_2(
   IGRAPH_CHECK(se2_bootstrap(graph, 0, opts, &level_memb));
   IGRAPH_CHECK(igraph_matrix_int_set_row(memb, &level_memb, 0));
 
-  for (igraph_integer_t level = 1; level < opts->subcluster; level++) {
+  igraph_error_t level_status = se2_level_done(opts, &level_memb, 0);
+  igraph_integer_t n_levels = 1;
+  for (igraph_integer_t level = 1;
+       (level < opts->subcluster) && (level_status == IGRAPH_SUCCESS);
+       level++) {
     if (opts->verbose) {
       SE2_PRINTF("\nSubclustering at level %" IGRAPH_PRId ".\n", level + 1);
     }
@@ -773,54 +800,25 @@ igraph_error_t speak_easy_2(
     IGRAPH_FINALLY(igraph_vector_int_destroy, &prev_memb);
     IGRAPH_CHECK(igraph_matrix_int_get_row(memb, &prev_memb, level - 1));
 
-    igraph_integer_t const n_comms =
-      igraph_vector_int_max(&prev_memb) - igraph_vector_int_min(&prev_memb) +
-      1;
-    for (igraph_integer_t comm = 0; comm < n_comms; comm++) {
-      igraph_vector_int_t member_ids;
-      IGRAPH_CHECK(
-        se2_collect_community_members(&prev_memb, &member_ids, comm));
-      IGRAPH_FINALLY(igraph_vector_int_destroy, &member_ids);
-      igraph_integer_t const n_membs = igraph_vector_int_size(&member_ids);
-
-      if (n_membs <= opts->minclust) {
-        for (igraph_integer_t i = 0; i < n_membs; i++) {
-          VECTOR(level_memb)[VECTOR(member_ids)[i]] = 0;
-        }
-
-        igraph_vector_int_destroy(&member_ids);
-        IGRAPH_FINALLY_CLEAN(1);
-        continue;
-      }
-
-      se2_neighs subgraph;
-      igraph_vector_int_t subgraph_memb;
-
-      IGRAPH_CHECK(igraph_vector_int_init(&subgraph_memb, n_membs));
-      IGRAPH_FINALLY(igraph_vector_int_destroy, &subgraph_memb);
-      IGRAPH_CHECK(se2_subgraph_from_community(graph, &subgraph, &member_ids));
-      IGRAPH_FINALLY(se2_neighs_destroy, &subgraph);
+    IGRAPH_CHECK(se2_subcluster_level(
+      graph, level, opts, &prev_memb, NULL, &level_memb));
 
-      IGRAPH_CHECK(se2_reweigh(&subgraph, /* verbose */ false));
-      IGRAPH_CHECK(se2_bootstrap(&subgraph, level, opts, &subgraph_memb));
-
-      for (igraph_integer_t i = 0; i < igraph_vector_int_size(&subgraph_memb);
-           i++) {
-        VECTOR(level_memb)[VECTOR(member_ids)[i]] = VECTOR(subgraph_memb)[i];
-      }
-
-      se2_neighs_destroy(&subgraph);
-      igraph_vector_int_destroy(&subgraph_memb);
-      igraph_vector_int_destroy(&member_ids);
-      IGRAPH_FINALLY_CLEAN(3);
-    }
-
-    IGRAPH_CHECK(
-      se2_relabel_hierarchical_communities(&prev_memb, &level_memb));
     IGRAPH_CHECK(igraph_matrix_int_set_row(memb, &level_memb, level));
+    n_levels++;
 
     igraph_vector_int_destroy(&prev_memb);
     IGRAPH_FINALLY_CLEAN(1);
+
+    level_status = se2_level_done(opts, &level_memb, level);
+  }
+
+  if ((level_status != IGRAPH_SUCCESS) && (level_status != IGRAPH_STOP)) {
+    IGRAPH_ERROR("Level callback failed.", level_status);
+  }
+
+  // Drop rows of levels skipped by the callback.
+  while (igraph_matrix_int_nrow(memb) > n_levels) {
+    IGRAPH_CHECK(igraph_matrix_int_remove_row(memb, n_levels));
   }
 
   igraph_vector_int_destroy(&level_memb);
@@ -834,3 +832,88 @@ igraph_error_t speak_easy_2(
 
   return IGRAPH_SUCCESS;
 }
+
+/**
+\brief Subcluster only selected communities of a finished level.
+
+Lazy alternative to setting opts->subcluster in speak_easy_2. Only the
+communities listed in comms are clustered, the rest are kept whole. Labels
+are assigned exactly as speak_easy_2 assigns the labels of the next level so
+the result can be used as a row of the membership matrix.
+
+\param graph the graph previously passed to speak_easy_2. The graph is
+  reweighed by speak_easy_2 so it is reused as is and must not be modified
+  between calls.
+\param opts a speakeasy options structure (see speak_easy_2.h).
+  opts->subcluster is ignored.
+\param memb the membership of the level to refine (i.e. a row of the
+  membership matrix returned by speak_easy_2).
+\param comms the ids of the communities in memb to subcluster.
+\param res the resulting membership vector. Resized to the number of nodes.
+
+\return Error code:
+*/
+igraph_error_t se2_subcluster(se2_neighs const* graph, se2_options* opts,
+  igraph_vector_int_t const* memb, igraph_vector_int_t const* comms,
+  igraph_vector_int_t* res)
+{
+  igraph_integer_t const n_nodes = se2_vcount(graph);
+
+  if (!graph->reweighed) {
+    IGRAPH_ERROR("Graph must have been reweighed by speak_easy_2.",
+      IGRAPH_EINVAL);
+  }
+
+  if (igraph_vector_int_size(memb) != n_nodes) {
+    IGRAPH_ERROR("Membership vector length must match the number of nodes.",
+      IGRAPH_EINVAL);
+  }
+
+  if ((n_nodes > 0) && (igraph_vector_int_min(memb) < 0)) {
+    IGRAPH_ERROR("Membership vector must not contain negative labels.",
+      IGRAPH_EINVAL);
+  }
+
+  igraph_integer_t const n_comms =
+    n_nodes > 0 ? igraph_vector_int_max(memb) + 1 : 0;
+
+  // Marks the communities with members until the selected ones are marked.
+  igraph_vector_bool_t selected;
+  igraph_integer_t n_selected = 0;
+  IGRAPH_CHECK(igraph_vector_bool_init(&selected, n_comms));
+  IGRAPH_FINALLY(igraph_vector_bool_destroy, &selected);
+  for (igraph_integer_t i = 0; i < n_nodes; i++) {
+    VECTOR(selected)[VECTOR(*memb)[i]] = true;
+  }
+
+  for (igraph_integer_t i = 0; i < igraph_vector_int_size(comms); i++) {
+    if ((VECTOR(*comms)[i] < 0) || (VECTOR(*comms)[i] >= n_comms) ||
+        (!VECTOR(selected)[VECTOR(*comms)[i]])) {
+      IGRAPH_ERROR("Community id not found in membership.", IGRAPH_EINVAL);
+    }
+  }
+
+  se2_set_defaults(graph, opts);
+
+  igraph_vector_bool_null(&selected);
+  for (igraph_integer_t i = 0; i < igraph_vector_int_size(comms); i++) {
+    if (!VECTOR(selected)[VECTOR(*comms)[i]]) {
+      VECTOR(selected)[VECTOR(*comms)[i]] = true;
+      n_selected++;
+    }
+  }
+
+  if (opts->verbose) {
+    SE2_PRINTF("Subclustering %" IGRAPH_PRId " of %" IGRAPH_PRId
+               " communities.\n",
+      n_selected, n_comms);
+  }
+
+  IGRAPH_CHECK(igraph_vector_int_resize(res, n_nodes));
+  IGRAPH_CHECK(se2_subcluster_level(graph, 1, opts, memb, &selected, res));
+
+  igraph_vector_bool_destroy(&selected);
+  IGRAPH_FINALLY_CLEAN(1);
+
+  return IGRAPH_SUCCESS;
+}
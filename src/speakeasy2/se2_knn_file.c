@@ -0,0 +1,329 @@
+/* Copyright 2024 David R. Connell <david32@dcon.addy.io>.
+ *
+ * This file is part of SpeakEasy 2.
+ *
+ * SpeakEasy 2 is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * SpeakEasy 2 is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with SpeakEasy 2. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "se2_knn_file.h"
+
+#include "se2_knn_heap.h"
+#include "se2_mapped_file.h"
+
+#ifdef SE2PAR
+# include <pthread.h>
+#endif
+
+/* Exact kNN search over a matrix stored in a file that may not fit in
+memory. The file holds the n_rows x n_cols matrix as raw igraph_real_t values
+in column-major order (the layout of an igraph_matrix_t's data) without a
+header.
+
+Columns are mapped in chunks so only a query chunk and a reference chunk are
+mapped at a time. Every query chunk is compared against each reference chunk
+in turn, keeping each query's k closest columns in a heap across reference
+chunks. The whole file is read once per query chunk, so larger chunks mean
+fewer passes over the file. */
+
+// Tile sizes within a pair of chunks, as for the in-memory search.
+#define SE2_FILE_QUERY_BLOCK 32
+#define SE2_FILE_REF_BLOCK 256
+
+/* Map n_cols columns of n_rows values starting at column start. */
+static igraph_error_t se2_map_columns(se2_mapped_view* view,
+  se2_mapped_file const* file, igraph_integer_t const n_rows,
+  igraph_integer_t const start, igraph_integer_t const n_cols)
+{
+  igraph_integer_t const col_bytes = n_rows * sizeof(igraph_real_t);
+
+  // Chunks are read front to back once per pass.
+  return se2_mapped_view_init(
+    view, file, start * col_bytes, n_cols * col_bytes, /* sequential */ true);
+}
+
+/* Squared euclidean distances between every column in the query block and
+every column in the reference block. Computed from the differences rather
+than from norms and dot products so no exact distances need to be
+recomputed later, which would require mapping arbitrary columns. */
+static void se2_file_tile_sq_dists(igraph_real_t const* restrict queries,
+  igraph_integer_t const n_queries, igraph_real_t const* restrict refs,
+  igraph_integer_t const n_refs, igraph_integer_t const n_rows,
+  igraph_real_t* restrict dists)
+{
+  for (igraph_integer_t q = 0; q < n_queries; q++) {
+    igraph_real_t const* a = queries + (q * n_rows);
+    igraph_real_t* q_dists = dists + (q * n_refs);
+    igraph_integer_t r = 0;
+    for (; (r + 4) <= n_refs; r += 4) {
+      igraph_real_t const* b0 = refs + (r * n_rows);
+      igraph_real_t const* b1 = b0 + n_rows;
+      igraph_real_t const* b2 = b1 + n_rows;
+      igraph_real_t const* b3 = b2 + n_rows;
+      igraph_real_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+      for (igraph_integer_t i = 0; i < n_rows; i++) {
+        igraph_real_t const el = a[i];
+        igraph_real_t const d0 = el - b0[i];
+        igraph_real_t const d1 = el - b1[i];
+        igraph_real_t const d2 = el - b2[i];
+        igraph_real_t const d3 = el - b3[i];
+        s0 += d0 * d0;
+        s1 += d1 * d1;
+        s2 += d2 * d2;
+        s3 += d3 * d3;
+      }
+      q_dists[r] = s0;
+      q_dists[r + 1] = s1;
+      q_dists[r + 2] = s2;
+      q_dists[r + 3] = s3;
+    }
+
+    for (; r < n_refs; r++) {
+      igraph_real_t const* b = refs + (r * n_rows);
+      igraph_real_t s = 0;
+      for (igraph_integer_t i = 0; i < n_rows; i++) {
+        igraph_real_t const d = a[i] - b[i];
+        s += d * d;
+      }
+      q_dists[r] = s;
+    }
+  }
+}
+
+struct file_params {
+  igraph_integer_t tid;
+  igraph_integer_t n_threads;
+  igraph_integer_t n_rows;
+  igraph_real_t const* queries;
+  igraph_integer_t q_start;
+  igraph_integer_t n_queries;
+  igraph_real_t const* refs;
+  igraph_integer_t r_start;
+  igraph_integer_t n_refs;
+  se2_knn_heap* heaps; // One per query in the chunk.
+  igraph_real_t* dists; // SE2_FILE_QUERY_BLOCK * SE2_FILE_REF_BLOCK.
+};
+
+/* Compare this thread's share of the query chunk against the reference
+chunk. Threads own disjoint query blocks so their heaps are not shared. */
+static void* se2_thread_file(void* parameters)
+{
+  struct file_params const* p = (struct file_params*)parameters;
+  igraph_integer_t const n_rows = p->n_rows;
+
+  for (igraph_integer_t qb = p->tid * SE2_FILE_QUERY_BLOCK;
+       qb < p->n_queries; qb += p->n_threads * SE2_FILE_QUERY_BLOCK) {
+    igraph_integer_t const n_q = qb + SE2_FILE_QUERY_BLOCK < p->n_queries ?
+                                   SE2_FILE_QUERY_BLOCK :
+                                   p->n_queries - qb;
+
+    for (igraph_integer_t rb = 0; rb < p->n_refs; rb += SE2_FILE_REF_BLOCK) {
+      igraph_integer_t const n_r = rb + SE2_FILE_REF_BLOCK < p->n_refs ?
+                                     SE2_FILE_REF_BLOCK :
+                                     p->n_refs - rb;
+      se2_file_tile_sq_dists(p->queries + (qb * n_rows), n_q,
+        p->refs + (rb * n_rows), n_r, n_rows, p->dists);
+
+      for (igraph_integer_t q = 0; q < n_q; q++) {
+        igraph_integer_t const col = p->q_start + qb + q;
+        igraph_real_t const* q_dists = p->dists + (q * n_r);
+        se2_knn_heap* heap = &p->heaps[qb + q];
+        igraph_real_t bound = se2_knn_heap_bound(heap);
+
+        for (igraph_integer_t r = 0; r < n_r; r++) {
+          igraph_integer_t const other_col = p->r_start + rb + r;
+          if ((q_dists[r] > bound) || (other_col == col)) {
+            continue;
+          }
+
+          se2_knn_heap_push(heap, q_dists[r], other_col);
+          bound = se2_knn_heap_bound(heap);
+        }
+      }
+    }
+  }
+
+  return NULL;
+}
+
+/* Compare a mapped query chunk against a mapped reference chunk. */
+static igraph_error_t se2_file_compare_chunks(struct file_params* args,
+  igraph_integer_t const n_threads)
+{
+#ifdef SE2PAR
+  pthread_t* threads = malloc(sizeof(*threads) * n_threads);
+  IGRAPH_CHECK_OOM(threads, "Out of memory.");
+  IGRAPH_FINALLY(free, threads);
+
+  for (igraph_integer_t tid = 0; tid < n_threads; tid++) {
+    pthread_create(&threads[tid], NULL, se2_thread_file, (void*)&args[tid]);
+  }
+
+  for (igraph_integer_t tid = 0; tid < n_threads; tid++) {
+    pthread_join(threads[tid], NULL);
+  }
+
+  free(threads);
+  IGRAPH_FINALLY_CLEAN(1);
+#else
+  for (igraph_integer_t tid = 0; tid < n_threads; tid++) {
+    se2_thread_file((void*)&args[tid]);
+  }
+#endif
+
+  return IGRAPH_SUCCESS;
+}
+
+/* Find the exact k nearest columns (by euclidean distance) of every column
+of the matrix stored in the file at path, mapping at most max_memory bytes of
+it at a time. Writes the results in the same layout as the in-memory
+search. */
+igraph_error_t se2_knn_file(char const* path, igraph_integer_t const n_rows,
+  igraph_integer_t const n_cols, igraph_integer_t const k,
+  igraph_integer_t const max_memory, igraph_integer_t n_threads,
+  igraph_vector_int_t* edges, igraph_vector_t* weights)
+{
+  igraph_integer_t const col_bytes = n_rows * sizeof(igraph_real_t);
+  se2_mapped_file file;
+  igraph_vector_t keys;
+  igraph_vector_int_t ids;
+  igraph_vector_t dists;
+
+  if (n_rows < 1) {
+    IGRAPH_ERROR("The matrix must have at least one row.", IGRAPH_EINVAL);
+  }
+
+  // Half for the query chunk, half for the reference chunk.
+  igraph_integer_t chunk_cols = max_memory / (2 * col_bytes);
+
+  if (chunk_cols < SE2_FILE_QUERY_BLOCK) {
+    chunk_cols = SE2_FILE_QUERY_BLOCK;
+  }
+
+  if (chunk_cols > n_cols) {
+    chunk_cols = n_cols;
+  }
+
+#ifndef SE2PAR
+  n_threads = 1;
+#endif
+
+  if (n_threads < 1) {
+    n_threads = 1;
+  }
+
+  IGRAPH_CHECK(se2_mapped_file_open(&file, path));
+  IGRAPH_FINALLY(se2_mapped_file_close, &file);
+
+  if (file.size != (n_cols * col_bytes)) {
+    IGRAPH_ERRORF("File \"%s\" does not hold a %" IGRAPH_PRId
+                  " x %" IGRAPH_PRId " matrix.",
+      IGRAPH_EINVAL, path, n_rows, n_cols);
+  }
+
+  IGRAPH_CHECK(igraph_vector_init(&keys, chunk_cols * k));
+  IGRAPH_FINALLY(igraph_vector_destroy, &keys);
+  IGRAPH_CHECK(igraph_vector_int_init(&ids, chunk_cols * k));
+  IGRAPH_FINALLY(igraph_vector_int_destroy, &ids);
+  IGRAPH_CHECK(igraph_vector_init(
+    &dists, n_threads * SE2_FILE_QUERY_BLOCK * SE2_FILE_REF_BLOCK));
+  IGRAPH_FINALLY(igraph_vector_destroy, &dists);
+
+  se2_knn_heap* heaps = malloc(sizeof(*heaps) * chunk_cols);
+  IGRAPH_CHECK_OOM(heaps, "Out of memory.");
+  IGRAPH_FINALLY(free, heaps);
+
+  struct file_params* args = malloc(sizeof(*args) * n_threads);
+  IGRAPH_CHECK_OOM(args, "Out of memory.");
+  IGRAPH_FINALLY(free, args);
+
+  for (igraph_integer_t q_start = 0; q_start < n_cols; q_start += chunk_cols) {
+    igraph_integer_t const n_queries =
+      q_start + chunk_cols < n_cols ? chunk_cols : n_cols - q_start;
+    se2_mapped_view query_view;
+
+    IGRAPH_CHECK(
+      se2_map_columns(&query_view, &file, n_rows, q_start, n_queries));
+    IGRAPH_FINALLY(se2_mapped_view_destroy, &query_view);
+
+    for (igraph_integer_t q = 0; q < n_queries; q++) {
+      se2_knn_heap_init(
+        &heaps[q], VECTOR(keys) + (q * k), VECTOR(ids) + (q * k), NULL, k);
+    }
+
+    for (igraph_integer_t r_start = 0; r_start < n_cols;
+         r_start += chunk_cols) {
+      igraph_integer_t const n_refs =
+        r_start + chunk_cols < n_cols ? chunk_cols : n_cols - r_start;
+      igraph_bool_t const same_chunk = r_start == q_start;
+      se2_mapped_view ref_view;
+
+      if (same_chunk) {
+        ref_view = query_view;
+      } else {
+        IGRAPH_CHECK(
+          se2_map_columns(&ref_view, &file, n_rows, r_start, n_refs));
+        IGRAPH_FINALLY(se2_mapped_view_destroy, &ref_view);
+      }
+
+      for (igraph_integer_t tid = 0; tid < n_threads; tid++) {
+        args[tid].tid = tid;
+        args[tid].n_threads = n_threads;
+        args[tid].n_rows = n_rows;
+        args[tid].queries = query_view.data;
+        args[tid].q_start = q_start;
+        args[tid].n_queries = n_queries;
+        args[tid].refs = ref_view.data;
+        args[tid].r_start = r_start;
+        args[tid].n_refs = n_refs;
+        args[tid].heaps = heaps;
+        args[tid].dists =
+          VECTOR(dists) + (tid * SE2_FILE_QUERY_BLOCK * SE2_FILE_REF_BLOCK);
+      }
+
+      IGRAPH_CHECK(se2_file_compare_chunks(args, n_threads));
+
+      if (!same_chunk) {
+        se2_mapped_view_destroy(&ref_view);
+        IGRAPH_FINALLY_CLEAN(1);
+      }
+    }
+
+    for (igraph_integer_t q = 0; q < n_queries; q++) {
+      igraph_integer_t const col = q_start + q;
+      igraph_integer_t* col_edges = VECTOR(*edges) + (2 * col * k);
+
+      // Closest first after sorting, output is closest last.
+      se2_knn_heap_sort(&heaps[q]);
+      for (igraph_integer_t i = 0; i < k; i++) {
+        col_edges[(2 * i) + 1] = heaps[q].ids[k - 1 - i];
+        if (weights) {
+          VECTOR(*weights)[(col * k) + i] = 1 / sqrt(heaps[q].keys[k - 1 - i]);
+        }
+      }
+    }
+
+    se2_mapped_view_destroy(&query_view);
+    IGRAPH_FINALLY_CLEAN(1);
+  }
+
+  free(args);
+  free(heaps);
+  igraph_vector_destroy(&dists);
+  igraph_vector_int_destroy(&ids);
+  igraph_vector_destroy(&keys);
+  se2_mapped_file_close(&file);
+  IGRAPH_FINALLY_CLEAN(6);
+
+  return IGRAPH_SUCCESS;
+}
@@ -16,92 +16,462 @@
  * with SpeakEasy 2. If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include "se2_knn_file.h"
+#include "se2_knn_heap.h"
+#include "se2_knn_kdtree.h"
+#include "se2_knn_nndescent.h"
+#include "se2_knn_projection.h"
+#include "se2_knn_sparse.h"
+#include "se2_neighborlist.h"
+
 #include <speak_easy_2.h>
 
-static void se2_insert_sim(igraph_real_t const s,
-  igraph_vector_t* similarities, igraph_integer_t const col,
-  igraph_integer_t const other_col, igraph_integer_t* edges,
-  igraph_integer_t const k)
-{
-  /* Edges is a vector of edge pairs for the given column. The first edge of
-     each pair is col (constant) the second is other_col. As such only the
-     second member of each pair ever needs to be modified. */
-  if (k == 1) {
-    VECTOR(*similarities)[0] = s;
-    edges[1] = other_col;
-  }
+#include <float.h>
 
-  igraph_integer_t bounds[2] = { 0, k };
-  igraph_integer_t pos = (k - 1) / 2;
-  while (!(
-    (pos == (k - 1)) ||
-    ((s >= VECTOR(*similarities)[pos]) &&
-      (s < VECTOR(*similarities)[pos + 1])))) {
-    if (s < VECTOR(*similarities)[pos]) {
-      bounds[1] = pos;
-    } else {
-      bounds[0] = pos;
-    }
-    pos = (bounds[1] + bounds[0]) / 2;
-  }
+#ifdef SE2PAR
+# include <pthread.h>
+#endif
 
-  for (int i = 0; i < pos; i++) {
-    VECTOR(*similarities)[i] = VECTOR(*similarities)[i + 1];
-    edges[(2 * i) + 1] = edges[(2 * (i + 1)) + 1];
-  }
-  VECTOR(*similarities)[pos] = s;
-  edges[(2 * pos) + 1] = other_col;
-}
+/* Tile sizes for the all-pairs distance kernel. A reference block of
+SE2_KNN_REF_BLOCK columns is reused against SE2_KNN_QUERY_BLOCK query columns
+before moving on so, for typical numbers of rows, the reference block stays in
+cache. */
+#define SE2_KNN_QUERY_BLOCK 32
+#define SE2_KNN_REF_BLOCK 256
 
-static igraph_real_t se2_euclidean_dist(igraph_integer_t const i,
-  igraph_integer_t const j, igraph_matrix_t* const mat)
+// Default number of bytes of a matrix file to map at a time.
+#define SE2_KNN_DEFAULT_MAX_MEMORY ((igraph_integer_t)1 << 30)
+
+static igraph_real_t se2_sq_dist(igraph_integer_t const i,
+  igraph_integer_t const j, igraph_matrix_t const* mat)
 {
   igraph_integer_t const n_rows = igraph_matrix_nrow(mat);
-  igraph_real_t* col_i = igraph_matrix_get_ptr(mat, 0, i);
-  igraph_real_t* col_j = igraph_matrix_get_ptr(mat, 0, j);
+  igraph_real_t const* col_i = &MATRIX(*mat, 0, i);
+  igraph_real_t const* col_j = &MATRIX(*mat, 0, j);
   igraph_real_t out = 0;
   for (igraph_integer_t k = 0; k < n_rows; k++) {
     double el = col_i[k] - col_j[k];
     out += el * el;
   }
 
-  return sqrt(out);
+  return out;
 }
 
-static igraph_error_t se2_closest_k(igraph_integer_t const col,
-  igraph_integer_t const k, igraph_matrix_t* const mat,
-  igraph_vector_int_t* edges, igraph_vector_t* weights)
+static igraph_real_t se2_euclidean_dist(igraph_integer_t const i,
+  igraph_integer_t const j, igraph_matrix_t const* mat)
 {
-  igraph_vector_t similarities;
-  igraph_integer_t n_cols = igraph_matrix_ncol(mat);
+  return sqrt(se2_sq_dist(i, j, mat));
+}
 
-  IGRAPH_CHECK(igraph_vector_init(&similarities, k));
-  IGRAPH_FINALLY(igraph_vector_destroy, &similarities);
+static igraph_real_t se2_dot(igraph_real_t const* restrict a,
+  igraph_real_t const* restrict b, igraph_integer_t const len)
+{
+  igraph_real_t out = 0;
+  for (igraph_integer_t i = 0; i < len; i++) {
+    out += a[i] * b[i];
+  }
 
-  for (igraph_integer_t i = 0; i < n_cols; i++) {
-    if (i == col) {
-      continue;
+  return out;
+}
+
+/* Dot products between every column in the query block and every column in
+the reference block. Four reference columns are handled at a time so each
+query element is loaded once per four products and the compiler can vectorize
+along the rows. */
+static void se2_knn_tile_dots(igraph_real_t const* restrict queries,
+  igraph_integer_t const n_queries, igraph_real_t const* restrict refs,
+  igraph_integer_t const n_refs, igraph_integer_t const n_rows,
+  igraph_real_t* restrict dots)
+{
+  for (igraph_integer_t q = 0; q < n_queries; q++) {
+    igraph_real_t const* a = queries + (q * n_rows);
+    igraph_real_t* q_dots = dots + (q * n_refs);
+    igraph_integer_t r = 0;
+    for (; (r + 4) <= n_refs; r += 4) {
+      igraph_real_t const* b0 = refs + (r * n_rows);
+      igraph_real_t const* b1 = b0 + n_rows;
+      igraph_real_t const* b2 = b1 + n_rows;
+      igraph_real_t const* b3 = b2 + n_rows;
+      igraph_real_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+      for (igraph_integer_t i = 0; i < n_rows; i++) {
+        igraph_real_t const el = a[i];
+        s0 += el * b0[i];
+        s1 += el * b1[i];
+        s2 += el * b2[i];
+        s3 += el * b3[i];
+      }
+      q_dots[r] = s0;
+      q_dots[r + 1] = s1;
+      q_dots[r + 2] = s2;
+      q_dots[r + 3] = s3;
     }
 
-    igraph_real_t s = 1 / se2_euclidean_dist(col, i, mat);
-    if (s > VECTOR(similarities)[0]) {
-      igraph_integer_t* col_edges = VECTOR(*edges) + (2 * col * k);
-      se2_insert_sim(s, &similarities, col, i, col_edges, k);
+    for (; r < n_refs; r++) {
+      q_dots[r] = se2_dot(a, refs + (r * n_rows), n_rows);
     }
   }
+}
+
+struct knn_params {
+  igraph_integer_t tid;
+  igraph_integer_t n_threads;
+  igraph_integer_t k;
+  igraph_integer_t q_first; // Columns [q_first, q_end) are queried against
+  igraph_integer_t q_end;   // columns [r_first, ncol).
+  igraph_integer_t r_first;
+  igraph_bool_t seeded;     // Start from the current neighbors, see below.
+  igraph_bool_t dot_weights;
+  igraph_matrix_t const* mat;
+  igraph_real_t const* sq_norms;
+  igraph_real_t* dots;     // SE2_KNN_QUERY_BLOCK * SE2_KNN_REF_BLOCK.
+  igraph_real_t* keys;     // SE2_KNN_QUERY_BLOCK * k.
+  igraph_integer_t* ids;   // SE2_KNN_QUERY_BLOCK * k.
+  igraph_vector_int_t* edges;
+  igraph_vector_t* weights;
+};
+
+/* Sort a column's neighbors in ascending order of similarity. Meant for
+neighbors that are already nearly sorted. */
+static void se2_knn_sort_col(igraph_real_t* similarities,
+  igraph_integer_t* col_edges, igraph_integer_t const k)
+{
+  for (igraph_integer_t i = 1; i < k; i++) {
+    igraph_real_t const s = similarities[i];
+    igraph_integer_t const neigh = col_edges[(2 * i) + 1];
+    igraph_integer_t j = i;
+    while ((j > 0) && (similarities[j - 1] > s)) {
+      similarities[j] = similarities[j - 1];
+      col_edges[(2 * j) + 1] = col_edges[(2 * (j - 1)) + 1];
+      j--;
+    }
+    similarities[j] = s;
+    col_edges[(2 * j) + 1] = neigh;
+  }
+}
+
+/* Write the neighbors collected in heap to the column's edges in ascending
+order of similarity and store their similarities in the heap's keys.
+
+The heap's keys are squared distances calculated from the column differences
+so euclidean similarities follow from the keys directly. Dot products can
+disagree with the distances by rounding error so the neighbors are re-sorted
+by their similarities. */
+static void se2_knn_finalize_col(igraph_integer_t const col,
+  se2_knn_heap* heap, igraph_matrix_t const* mat, igraph_bool_t dot_weights,
+  igraph_integer_t* col_edges)
+{
+  igraph_integer_t const k = heap->k;
+  igraph_real_t* similarities = heap->keys;
+
+  se2_knn_heap_sort(heap);
+  for (igraph_integer_t i = 0; i < k; i++) {
+    col_edges[(2 * i) + 1] = heap->ids[k - 1 - i];
+  }
+
+  if (!dot_weights) {
+    for (igraph_integer_t i = 0; i < k / 2; i++) {
+      igraph_real_t const key = similarities[i];
+      similarities[i] = similarities[k - 1 - i];
+      similarities[k - 1 - i] = key;
+    }
 
-  if (weights) {
     for (igraph_integer_t i = 0; i < k; i++) {
-      VECTOR(*weights)[(col * k) + i] = VECTOR(similarities)[i];
+      similarities[i] = 1 / sqrt(similarities[i]);
+    }
+
+    return;
+  }
+
+  for (igraph_integer_t i = 0; i < k; i++) {
+    igraph_integer_t const neigh = col_edges[(2 * i) + 1];
+    similarities[i] = se2_dot(&MATRIX(*mat, 0, col), &MATRIX(*mat, 0, neigh),
+      igraph_matrix_nrow(mat));
+  }
+
+  se2_knn_sort_col(similarities, col_edges, k);
+}
+
+/* Candidates are screened with ||a||^2 + ||b||^2 - 2a.b from the tile dot
+products. That loses precision when the columns are far from the origin
+compared to the distances between them, so the screen is widened by a bound on
+its rounding error and candidates that pass it are ranked by their squared
+distance from the column differences. Neighbors are therefore the same as if
+every pair were compared directly.
+
+When p->seeded, each query's heap starts out with its current neighbors
+(taken from edges) and queries whose neighbors do not change are left
+untouched. */
+static void se2_knn_query_block(
+  struct knn_params const* p, igraph_integer_t const q_start)
+{
+  igraph_integer_t const n_rows = igraph_matrix_nrow(p->mat);
+  igraph_integer_t const n_cols = igraph_matrix_ncol(p->mat);
+  igraph_integer_t const k = p->k;
+  igraph_integer_t const q_end = q_start + SE2_KNN_QUERY_BLOCK < p->q_end ?
+                                   q_start + SE2_KNN_QUERY_BLOCK :
+                                   p->q_end;
+  igraph_integer_t const n_queries = q_end - q_start;
+  igraph_real_t const* queries = &MATRIX(*p->mat, 0, q_start);
+  // Relative error of the norms and dot products and the sums combining
+  // them, with some slack.
+  igraph_real_t const tol = 4 * (n_rows + 2) * DBL_EPSILON;
+  se2_knn_heap heaps[SE2_KNN_QUERY_BLOCK];
+  igraph_bool_t changed[SE2_KNN_QUERY_BLOCK];
+
+  for (igraph_integer_t q = 0; q < n_queries; q++) {
+    igraph_integer_t const col = q_start + q;
+    se2_knn_heap_init(
+      &heaps[q], p->keys + (q * k), p->ids + (q * k), NULL, k);
+    changed[q] = !p->seeded;
+
+    if (p->seeded) {
+      igraph_integer_t const* col_edges = VECTOR(*p->edges) + (2 * col * k);
+      for (igraph_integer_t i = 0; i < k; i++) {
+        igraph_integer_t const neigh = col_edges[(2 * i) + 1];
+        se2_knn_heap_push(&heaps[q], se2_sq_dist(col, neigh, p->mat), neigh);
+      }
+    }
+  }
+
+  for (igraph_integer_t r_start = p->r_first; r_start < n_cols;
+       r_start += SE2_KNN_REF_BLOCK) {
+    igraph_integer_t const n_refs = r_start + SE2_KNN_REF_BLOCK < n_cols ?
+                                      SE2_KNN_REF_BLOCK :
+                                      n_cols - r_start;
+    se2_knn_tile_dots(queries, n_queries, &MATRIX(*p->mat, 0, r_start),
+      n_refs, n_rows, p->dots);
+
+    for (igraph_integer_t q = 0; q < n_queries; q++) {
+      igraph_integer_t const col = q_start + q;
+      igraph_real_t const* q_dots = p->dots + (q * n_refs);
+      igraph_real_t const col_norm = p->sq_norms[col];
+      se2_knn_heap* heap = &heaps[q];
+      igraph_real_t bound = se2_knn_heap_bound(heap);
+
+      for (igraph_integer_t r = 0; r < n_refs; r++) {
+        igraph_integer_t const other_col = r_start + r;
+        igraph_real_t const norms = col_norm + p->sq_norms[other_col];
+        if ((norms - (2 * q_dots[r]) - (tol * norms) > bound) ||
+            (other_col == col)) {
+          continue;
+        }
+
+        igraph_real_t const d2 = se2_sq_dist(col, other_col, p->mat);
+        if (!se2_knn_heap_accepts(heap, d2, other_col)) {
+          continue;
+        }
+
+        se2_knn_heap_push(heap, d2, other_col);
+        bound = se2_knn_heap_bound(heap);
+        changed[q] = true;
+      }
+    }
+  }
+
+  for (igraph_integer_t q = 0; q < n_queries; q++) {
+    igraph_integer_t const col = q_start + q;
+    if (!changed[q]) {
+      continue;
+    }
+
+    se2_knn_finalize_col(col, &heaps[q], p->mat, p->dot_weights,
+      VECTOR(*p->edges) + (2 * col * k));
+
+    if (p->weights) {
+      for (igraph_integer_t i = 0; i < k; i++) {
+        VECTOR(*p->weights)[(col * k) + i] = heaps[q].keys[i];
+      }
     }
   }
+}
+
+static void* se2_thread_knn(void* parameters)
+{
+  struct knn_params const* p = (struct knn_params*)parameters;
+
+  for (igraph_integer_t q_start = p->q_first + (p->tid * SE2_KNN_QUERY_BLOCK);
+       q_start < p->q_end; q_start += p->n_threads * SE2_KNN_QUERY_BLOCK) {
+    se2_knn_query_block(p, q_start);
+  }
 
-  igraph_vector_destroy(&similarities);
+  return NULL;
+}
+
+/* Find the k most similar columns in [r_first, ncol) for the columns
+[q_first, q_end) of mat. Query columns are handled in blocks that are split
+between threads. Threads only write to the edges and weights of their own
+columns so no locking is needed.
+
+If seeded, the queries' current neighbors are kept unless closer columns are
+found. With dot_weights, the weights are the dot
+products of the (normalized) columns instead of inverse distances. */
+static igraph_error_t se2_closest_k_range(igraph_matrix_t const* mat,
+  igraph_integer_t const k, igraph_integer_t const q_first,
+  igraph_integer_t const q_end, igraph_integer_t const r_first,
+  igraph_bool_t const seeded, igraph_bool_t const dot_weights,
+  igraph_integer_t n_threads, igraph_vector_int_t* edges,
+  igraph_vector_t* weights)
+{
+  igraph_integer_t const n_cols = igraph_matrix_ncol(mat);
+  igraph_integer_t const n_blocks =
+    (q_end - q_first + SE2_KNN_QUERY_BLOCK - 1) / SE2_KNN_QUERY_BLOCK;
+  igraph_integer_t const buffer_size =
+    SE2_KNN_QUERY_BLOCK * (SE2_KNN_REF_BLOCK + k);
+  igraph_integer_t const ids_size = SE2_KNN_QUERY_BLOCK * k;
+  igraph_vector_t sq_norms;
+  igraph_vector_t buffers;
+  igraph_vector_int_t id_buffers;
+
+#ifndef SE2PAR
+  n_threads = 1;
+#endif
+
+  if (n_blocks == 0) {
+    return IGRAPH_SUCCESS;
+  }
+
+  if (n_threads > n_blocks) {
+    n_threads = n_blocks;
+  }
+
+  IGRAPH_CHECK(igraph_vector_init(&sq_norms, n_cols));
+  IGRAPH_FINALLY(igraph_vector_destroy, &sq_norms);
+  for (igraph_integer_t i = 0; i < n_cols; i++) {
+    igraph_real_t const* col = &MATRIX(*mat, 0, i);
+    VECTOR(sq_norms)[i] = se2_dot(col, col, igraph_matrix_nrow(mat));
+  }
+
+  IGRAPH_CHECK(igraph_vector_init(&buffers, n_threads * buffer_size));
+  IGRAPH_FINALLY(igraph_vector_destroy, &buffers);
+  IGRAPH_CHECK(igraph_vector_int_init(&id_buffers, n_threads * ids_size));
+  IGRAPH_FINALLY(igraph_vector_int_destroy, &id_buffers);
+
+  struct knn_params* args = malloc(sizeof(*args) * n_threads);
+  IGRAPH_CHECK_OOM(args, "Out of memory.");
+  IGRAPH_FINALLY(free, args);
+
+#ifdef SE2PAR
+  pthread_t* threads = malloc(sizeof(*threads) * n_threads);
+  IGRAPH_CHECK_OOM(threads, "Out of memory.");
+  IGRAPH_FINALLY(free, threads);
+#endif
+
+  for (igraph_integer_t tid = 0; tid < n_threads; tid++) {
+    igraph_real_t* buffer = VECTOR(buffers) + (tid * buffer_size);
+    args[tid].tid = tid;
+    args[tid].n_threads = n_threads;
+    args[tid].k = k;
+    args[tid].q_first = q_first;
+    args[tid].q_end = q_end;
+    args[tid].r_first = r_first;
+    args[tid].seeded = seeded;
+    args[tid].dot_weights = dot_weights;
+    args[tid].mat = mat;
+    args[tid].sq_norms = VECTOR(sq_norms);
+    args[tid].dots = buffer;
+    args[tid].keys = buffer + (SE2_KNN_QUERY_BLOCK * SE2_KNN_REF_BLOCK);
+    args[tid].ids = VECTOR(id_buffers) + (tid * ids_size);
+    args[tid].edges = edges;
+    args[tid].weights = weights;
+
+#ifdef SE2PAR
+    pthread_create(&threads[tid], NULL, se2_thread_knn, (void*)&args[tid]);
+#else
+    se2_thread_knn((void*)&args[tid]);
+#endif
+  }
+
+#ifdef SE2PAR
+  for (igraph_integer_t tid = 0; tid < n_threads; tid++) {
+    pthread_join(threads[tid], NULL);
+  }
+
+  free(threads);
   IGRAPH_FINALLY_CLEAN(1);
+#endif
+
+  free(args);
+  igraph_vector_int_destroy(&id_buffers);
+  igraph_vector_destroy(&buffers);
+  igraph_vector_destroy(&sq_norms);
+  IGRAPH_FINALLY_CLEAN(4);
+
+  return IGRAPH_SUCCESS;
+}
+
+/* Find the k most similar columns for every column of mat. */
+static igraph_error_t se2_closest_k(igraph_matrix_t const* mat,
+  igraph_integer_t const k, igraph_integer_t n_threads,
+  igraph_vector_int_t* edges, igraph_vector_t* weights)
+{
+  return se2_closest_k_range(mat, k, 0, igraph_matrix_ncol(mat), 0, false,
+    false, n_threads, edges, weights);
+}
+
+/* Copy mat with every column scaled to unit length, after centering for
+Pearson correlation. For unit columns, ||a - b||^2 = 2 - 2a.b so ranking
+columns by euclidean distance ranks them by similarity and any of the
+euclidean searches can be reused. Columns with no variation are left as 0. */
+static igraph_error_t se2_knn_normalize(igraph_matrix_t const* mat,
+  se2_knn_metric const metric, igraph_matrix_t* res)
+{
+  igraph_integer_t const n_rows = igraph_matrix_nrow(mat);
+  igraph_integer_t const n_cols = igraph_matrix_ncol(mat);
+
+  IGRAPH_CHECK(igraph_matrix_init_copy(res, mat));
+  for (igraph_integer_t i = 0; i < n_cols; i++) {
+    igraph_real_t* col = &MATRIX(*res, 0, i);
+
+    if (metric == SE2_KNN_PEARSON) {
+      igraph_real_t mean = 0;
+      for (igraph_integer_t j = 0; j < n_rows; j++) {
+        mean += col[j];
+      }
+      mean /= n_rows;
+
+      for (igraph_integer_t j = 0; j < n_rows; j++) {
+        col[j] -= mean;
+      }
+    }
+
+    igraph_real_t const norm = sqrt(se2_dot(col, col, n_rows));
+    if (norm > 0) {
+      for (igraph_integer_t j = 0; j < n_rows; j++) {
+        col[j] /= norm;
+      }
+    }
+  }
 
   return IGRAPH_SUCCESS;
 }
 
+/* Recompute the similarities of neighbors that were found by comparing a
+transformed copy of the columns and reorder them to match. compare_mat is the
+original matrix for euclidean distance and the normalized columns otherwise,
+for which the dot product is the cosine similarity or correlation. */
+static void se2_knn_exact_similarities(igraph_matrix_t const* compare_mat,
+  se2_knn_metric const metric, igraph_integer_t const k,
+  igraph_vector_int_t* edges, igraph_vector_t* similarities)
+{
+  igraph_integer_t const n_rows = igraph_matrix_nrow(compare_mat);
+  igraph_integer_t const n_cols = igraph_matrix_ncol(compare_mat);
+
+  for (igraph_integer_t i = 0; i < n_cols; i++) {
+    igraph_integer_t* col_edges = VECTOR(*edges) + (2 * i * k);
+    igraph_real_t* col_sims = VECTOR(*similarities) + (i * k);
+    for (igraph_integer_t j = 0; j < k; j++) {
+      igraph_integer_t const neigh = col_edges[(2 * j) + 1];
+      col_sims[j] =
+        metric == SE2_KNN_EUCLIDEAN ?
+          1 / se2_euclidean_dist(i, neigh, compare_mat) :
+          se2_dot(&MATRIX(*compare_mat, 0, i),
+            &MATRIX(*compare_mat, 0, neigh), n_rows);
+    }
+
+    se2_knn_sort_col(col_sims, col_edges, k);
+  }
+}
+
 static void se2_knn_fill_edges(igraph_vector_int_t* edges,
   igraph_integer_t const k, igraph_integer_t const n_cols)
 {
@@ -112,6 +482,340 @@ static void se2_knn_fill_edges(igraph_vector_int_t* edges,
   }
 }
 
+/* Validate opts for a search over n_cols columns, filling in defaults. */
+static igraph_error_t se2_knn_check_opts(igraph_integer_t const n_cols,
+  igraph_integer_t const k, se2_knn_options* opts)
+{
+  if (k < 0) {
+    IGRAPH_ERRORF("The k must be at least 0 but got %" IGRAPH_PRId ".\n",
+      IGRAPH_EINVAL, k);
+  }
+
+  if (k >= n_cols) {
+    IGRAPH_ERRORF(
+      "The k must be less than the number of columns, "
+      "got k = %" IGRAPH_PRId " with only %" IGRAPH_PRId " columns.\n",
+      IGRAPH_EINVAL, k, n_cols);
+  }
+
+  if ((opts->method != SE2_KNN_EXACT) &&
+      (opts->method != SE2_KNN_APPROXIMATE)) {
+    IGRAPH_ERROR("Unknown kNN method.", IGRAPH_EINVAL);
+  }
+
+  if ((opts->metric != SE2_KNN_EUCLIDEAN) &&
+      (opts->metric != SE2_KNN_COSINE) && (opts->metric != SE2_KNN_PEARSON)) {
+    IGRAPH_ERROR("Unknown kNN metric.", IGRAPH_EINVAL);
+  }
+
+  if ((opts->symmetrize != SE2_KNN_DIRECTED) &&
+      (opts->symmetrize != SE2_KNN_UNION) &&
+      (opts->symmetrize != SE2_KNN_MUTUAL)) {
+    IGRAPH_ERROR("Unknown kNN symmetrization.", IGRAPH_EINVAL);
+  }
+
+  if (opts->target_dim < 0) {
+    IGRAPH_ERRORF(
+      "The target dimension must be at least 0 but got %" IGRAPH_PRId ".\n",
+      IGRAPH_EINVAL, opts->target_dim);
+  }
+
+  if (opts->max_memory < 0) {
+    IGRAPH_ERRORF(
+      "The max memory must be at least 0 but got %" IGRAPH_PRId ".\n",
+      IGRAPH_EINVAL, opts->max_memory);
+  }
+
+  if (!opts->max_memory) {
+    opts->max_memory = SE2_KNN_DEFAULT_MAX_MEMORY;
+  }
+
+  if (opts->max_threads < 1) {
+    opts->max_threads = 1;
+  }
+
+  if (!opts->random_seed) {
+    opts->random_seed = RNG_INTEGER(1, 9999);
+  }
+
+  return IGRAPH_SUCCESS;
+}
+
+/* Validate opts, filling in defaults, and find the k nearest neighbors of
+each column of mat. edges and weights (if not NULL) are initialized here with
+the layout described in se2_knn_graph. */
+static igraph_error_t se2_knn_search(igraph_matrix_t const* mat,
+  igraph_integer_t const k, se2_knn_options* opts, igraph_vector_int_t* edges,
+  igraph_vector_t* weights)
+{
+  igraph_integer_t const n_cols = igraph_matrix_ncol(mat);
+  igraph_integer_t const n_edges = k * n_cols;
+
+  IGRAPH_CHECK(se2_knn_check_opts(n_cols, k, opts));
+
+  IGRAPH_CHECK(igraph_vector_int_init(edges, 2 * n_edges));
+  IGRAPH_FINALLY(igraph_vector_int_destroy, edges);
+
+  if (weights) {
+    IGRAPH_CHECK(igraph_vector_init(weights, n_edges));
+    IGRAPH_FINALLY(igraph_vector_destroy, weights);
+  }
+
+  if (k == 0) {
+    goto finish;
+  }
+
+  se2_knn_fill_edges(edges, k, n_cols);
+
+  igraph_matrix_t normalized;
+  igraph_matrix_t const* compare_mat = mat;
+  if (opts->metric != SE2_KNN_EUCLIDEAN) {
+    IGRAPH_CHECK(se2_knn_normalize(mat, opts->metric, &normalized));
+    IGRAPH_FINALLY(igraph_matrix_destroy, &normalized);
+    compare_mat = &normalized;
+  }
+
+  igraph_matrix_t projected;
+  igraph_matrix_t const* search_mat = compare_mat;
+  igraph_bool_t const project = (opts->target_dim > 0) &&
+                                (opts->target_dim < igraph_matrix_nrow(mat));
+  if (project) {
+    IGRAPH_CHECK(se2_knn_project(compare_mat, opts->target_dim,
+      opts->random_seed, opts->max_threads, &projected));
+    IGRAPH_FINALLY(igraph_matrix_destroy, &projected);
+    search_mat = &projected;
+  }
+
+  if (opts->method == SE2_KNN_APPROXIMATE) {
+    IGRAPH_CHECK(se2_knn_nndescent(search_mat, k, opts, edges, weights));
+  } else if (se2_knn_kdtree_is_suitable(search_mat)) {
+    IGRAPH_CHECK(
+      se2_knn_kdtree(search_mat, k, opts->max_threads, edges, weights));
+  } else {
+    IGRAPH_CHECK(
+      se2_closest_k(search_mat, k, opts->max_threads, edges, weights));
+  }
+
+  if (project) {
+    igraph_matrix_destroy(&projected);
+    IGRAPH_FINALLY_CLEAN(1);
+  }
+
+  if ((opts->metric != SE2_KNN_EUCLIDEAN) || project) {
+    // Needed to order the edges even when the caller doesn't want weights.
+    igraph_vector_t similarities;
+    igraph_vector_t* sims = weights;
+    if (!weights) {
+      IGRAPH_CHECK(igraph_vector_init(&similarities, n_edges));
+      IGRAPH_FINALLY(igraph_vector_destroy, &similarities);
+      sims = &similarities;
+    }
+
+    se2_knn_exact_similarities(compare_mat, opts->metric, k, edges, sims);
+
+    if (!weights) {
+      igraph_vector_destroy(&similarities);
+      IGRAPH_FINALLY_CLEAN(1);
+    }
+  }
+
+  if (opts->metric != SE2_KNN_EUCLIDEAN) {
+    igraph_matrix_destroy(&normalized);
+    IGRAPH_FINALLY_CLEAN(1);
+  }
+
+finish:
+  if (weights) {
+    IGRAPH_FINALLY_CLEAN(1);
+  }
+
+  IGRAPH_FINALLY_CLEAN(1);
+
+  return IGRAPH_SUCCESS;
+}
+
+/* Same as se2_knn_search for sparse input. The search is always exact. */
+static igraph_error_t se2_knn_search_csc(se2_csc_matrix const* mat,
+  igraph_integer_t const k, se2_knn_options* opts, igraph_vector_int_t* edges,
+  igraph_vector_t* weights)
+{
+  igraph_integer_t const n_cols = mat->n_cols;
+  igraph_integer_t const n_edges = k * n_cols;
+
+  IGRAPH_CHECK(se2_knn_check_opts(n_cols, k, opts));
+
+  IGRAPH_CHECK(igraph_vector_int_init(edges, 2 * n_edges));
+  IGRAPH_FINALLY(igraph_vector_int_destroy, edges);
+
+  // Needed to order the edges even when the caller doesn't want weights.
+  igraph_vector_t similarities;
+  igraph_vector_t* sims = weights ? weights : &similarities;
+  IGRAPH_CHECK(igraph_vector_init(sims, n_edges));
+  IGRAPH_FINALLY(igraph_vector_destroy, sims);
+
+  if (k > 0) {
+    se2_knn_fill_edges(edges, k, n_cols);
+    IGRAPH_CHECK(
+      se2_knn_sparse(mat, k, opts->metric, opts->max_threads, edges, sims));
+
+    for (igraph_integer_t i = 0; i < n_cols; i++) {
+      se2_knn_sort_col(
+        VECTOR(*sims) + (i * k), VECTOR(*edges) + (2 * i * k), k);
+    }
+  }
+
+  if (!weights) {
+    igraph_vector_destroy(&similarities);
+  }
+  IGRAPH_FINALLY_CLEAN(2);
+
+  return IGRAPH_SUCCESS;
+}
+
+/* Same as se2_knn_search for a matrix stored in a file. Only euclidean
+distance is supported and the search is always exact. */
+static igraph_error_t se2_knn_search_file(char const* path,
+  igraph_integer_t const n_rows, igraph_integer_t const n_cols,
+  igraph_integer_t const k, se2_knn_options* opts, igraph_vector_int_t* edges,
+  igraph_vector_t* weights)
+{
+  igraph_integer_t const n_edges = k * n_cols;
+
+  IGRAPH_CHECK(se2_knn_check_opts(n_cols, k, opts));
+
+  if (opts->metric != SE2_KNN_EUCLIDEAN) {
+    IGRAPH_ERROR("Only euclidean distance is supported for file input.",
+      IGRAPH_UNIMPLEMENTED);
+  }
+
+  IGRAPH_CHECK(igraph_vector_int_init(edges, 2 * n_edges));
+  IGRAPH_FINALLY(igraph_vector_int_destroy, edges);
+
+  if (weights) {
+    IGRAPH_CHECK(igraph_vector_init(weights, n_edges));
+    IGRAPH_FINALLY(igraph_vector_destroy, weights);
+  }
+
+  if (k > 0) {
+    se2_knn_fill_edges(edges, k, n_cols);
+    IGRAPH_CHECK(se2_knn_file(path, n_rows, n_cols, k, opts->max_memory,
+      opts->max_threads, edges, weights));
+  }
+
+  if (weights) {
+    IGRAPH_FINALLY_CLEAN(1);
+  }
+
+  IGRAPH_FINALLY_CLEAN(1);
+
+  return IGRAPH_SUCCESS;
+}
+
+/* Whether to is one of the k nearest neighbors of from. */
+static igraph_bool_t se2_knn_is_neighbor(igraph_vector_int_t const* edges,
+  igraph_integer_t const k, igraph_integer_t const from,
+  igraph_integer_t const to)
+{
+  igraph_integer_t const* col_edges = VECTOR(*edges) + (2 * from * k);
+  for (igraph_integer_t j = 0; j < k; j++) {
+    if (col_edges[(2 * j) + 1] == to) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/* Store the kNN edges as a neighbor list, symmetrizing them if requested.
+Each node's own neighbors come first in ascending order of similarity. With
+SE2_KNN_UNION, they are followed by the nodes that have it as a neighbor
+without being one of its own neighbors. */
+static igraph_error_t se2_knn_to_neighs(igraph_vector_int_t const* edges,
+  igraph_vector_t const* weights, igraph_integer_t const k,
+  igraph_integer_t const n_nodes, se2_knn_symmetrize const symmetrize,
+  se2_neighs* res)
+{
+  res->n_nodes = n_nodes;
+  res->total_weight = 0;
+  res->reweighed = false;
+  res->view = NULL;
+  res->borrowed = NULL;
+
+  res->neigh_list = igraph_malloc(sizeof(*res->neigh_list));
+  IGRAPH_CHECK_OOM(res->neigh_list, "");
+  IGRAPH_FINALLY(igraph_free, res->neigh_list);
+  IGRAPH_CHECK(igraph_vector_int_list_init(res->neigh_list, n_nodes));
+  IGRAPH_FINALLY(igraph_vector_int_list_destroy, res->neigh_list);
+
+  res->sizes = igraph_malloc(sizeof(*res->sizes));
+  IGRAPH_CHECK_OOM(res->sizes, "");
+  IGRAPH_FINALLY(igraph_free, res->sizes);
+  IGRAPH_CHECK(igraph_vector_int_init(res->sizes, n_nodes));
+  IGRAPH_FINALLY(igraph_vector_int_destroy, res->sizes);
+
+  res->kin = igraph_malloc(sizeof(*res->kin));
+  IGRAPH_CHECK_OOM(res->kin, "");
+  IGRAPH_FINALLY(igraph_free, res->kin);
+  IGRAPH_CHECK(igraph_vector_init(res->kin, n_nodes));
+  IGRAPH_FINALLY(igraph_vector_destroy, res->kin);
+
+  res->weights = igraph_malloc(sizeof(*res->weights));
+  IGRAPH_CHECK_OOM(res->weights, "");
+  IGRAPH_FINALLY(igraph_free, res->weights);
+  IGRAPH_CHECK(igraph_vector_list_init(res->weights, n_nodes));
+  IGRAPH_FINALLY(igraph_vector_list_destroy, res->weights);
+
+  igraph_integer_t* sizes = VECTOR(*res->sizes);
+  for (igraph_integer_t i = 0; i < n_nodes; i++) {
+    for (igraph_integer_t j = 0; j < k; j++) {
+      igraph_integer_t const neigh = VECTOR(*edges)[(2 * (i * k + j)) + 1];
+      igraph_bool_t const mutual = (symmetrize != SE2_KNN_DIRECTED) &&
+                                   se2_knn_is_neighbor(edges, k, neigh, i);
+
+      if ((symmetrize != SE2_KNN_MUTUAL) || mutual) {
+        sizes[i]++;
+      }
+
+      if ((symmetrize == SE2_KNN_UNION) && (!mutual)) {
+        sizes[neigh]++;
+      }
+    }
+  }
+
+  for (igraph_integer_t i = 0; i < n_nodes; i++) {
+    IGRAPH_CHECK(se2_neighs_resize_row(res, i, sizes[i]));
+  }
+
+  // Reuse sizes as the fill position of each node.
+  igraph_vector_int_null(res->sizes);
+  for (igraph_integer_t i = 0; i < n_nodes; i++) {
+    for (igraph_integer_t j = 0; j < k; j++) {
+      igraph_integer_t const neigh = VECTOR(*edges)[(2 * (i * k + j)) + 1];
+      igraph_real_t const w = VECTOR(*weights)[(i * k) + j];
+      igraph_bool_t const mutual = (symmetrize != SE2_KNN_DIRECTED) &&
+                                   se2_knn_is_neighbor(edges, k, neigh, i);
+
+      if ((symmetrize != SE2_KNN_MUTUAL) || mutual) {
+        VECTOR(NEIGHBORS(*res, i))[sizes[i]] = neigh;
+        VECTOR(WEIGHTS_IN(*res, i))[sizes[i]] = w;
+        res->total_weight += w;
+        sizes[i]++;
+      }
+
+      if ((symmetrize == SE2_KNN_UNION) && (!mutual)) {
+        VECTOR(NEIGHBORS(*res, neigh))[sizes[neigh]] = i;
+        VECTOR(WEIGHTS_IN(*res, neigh))[sizes[neigh]] = w;
+        res->total_weight += w;
+        sizes[neigh]++;
+      }
+    }
+  }
+
+  IGRAPH_FINALLY_CLEAN(8);
+
+  return IGRAPH_SUCCESS;
+}
+
 /**
 \brief Create a directed graph with edges between the k nearest columns of
   a matrix. Compares columns using the inverse of euclidean distance.
@@ -126,54 +830,351 @@ static void se2_knn_fill_edges(igraph_vector_int_t* edges,
  */
 igraph_error_t se2_knn_graph(igraph_matrix_t* const mat,
   igraph_integer_t const k, igraph_t* res, igraph_vector_t* weights)
+{
+  se2_knn_options opts = { 0 };
+  return se2_knn_graph_opts(mat, k, &opts, res, weights);
+}
+
+/**
+\brief Same as se2_knn_graph but with additional options.
+
+With the SE2_KNN_COSINE and SE2_KNN_PEARSON metrics, columns are normalized
+once up front and the weights are the cosine similarity or Pearson
+correlation of the columns, which can be negative.
+
+With opts->target_dim set below the number of rows, neighbors are searched for
+after a seeded Gaussian random projection of the (normalized) columns to
+target_dim rows. This is much faster for high-dimensional data, but neighbors
+are then only approximate. Their weights are still computed from the full
+columns.
+
+\param mat the matrix containing the columns to compare.
+\param k number of edges per column to make (must be >= 0 and < ncols - 1).
+\param opts a kNN options structure (see speak_easy_2.h). Unset (0) fields
+  are replaced with their defaults. With method SE2_KNN_APPROXIMATE,
+  neighbors are found with NN-descent. The output has the same layout as the
+  exact search but some neighbors may not be the true nearest ones. Compare
+  against SE2_KNN_EXACT on a subset to pick max_iterations and tolerance.
+\param res the resulting graph (uninitialized).
+\param weights, if not NULL the similarity (depending on opts->metric) will
+  be stored here for each edge.
+\return Error code:
+         \c IGRAPH_EINVAL: Invalid value for k.
+ */
+igraph_error_t se2_knn_graph_opts(igraph_matrix_t* const mat,
+  igraph_integer_t const k, se2_knn_options* opts, igraph_t* res,
+  igraph_vector_t* weights)
 {
   igraph_integer_t const n_cols = igraph_matrix_ncol(mat);
-  igraph_integer_t const n_edges = k * n_cols;
   igraph_vector_int_t edges;
 
+  IGRAPH_CHECK(se2_knn_search(mat, k, opts, &edges, weights));
+  IGRAPH_FINALLY(igraph_vector_int_destroy, &edges);
+  if (weights) {
+    IGRAPH_FINALLY(igraph_vector_destroy, weights);
+  }
+
   IGRAPH_CHECK(igraph_empty(res, n_cols, IGRAPH_DIRECTED));
   IGRAPH_FINALLY(igraph_destroy, res);
+  IGRAPH_CHECK(igraph_add_edges(res, &edges, NULL));
 
-  if (k < 0) {
-    IGRAPH_ERRORF("The k must be at least 0 but got %" IGRAPH_PRId ".\n",
-      IGRAPH_EINVAL, k);
+  igraph_vector_int_destroy(&edges);
+  IGRAPH_FINALLY_CLEAN(2);
+
+  if (weights) {
+    IGRAPH_FINALLY_CLEAN(1);
   }
 
-  if (k >= n_cols) {
-    IGRAPH_ERRORF(
-      "The k must be less than the number of columns, "
-      "got k = %" IGRAPH_PRId " with only %" IGRAPH_PRId " columns.\n",
-      IGRAPH_EINVAL, k, n_cols);
+  return IGRAPH_SUCCESS;
+}
+
+/**
+\brief Build a kNN graph directly as a neighbor list for speak_easy_2.
+
+Equivalent to calling se2_igraph_to_neighbor_list on the result of
+se2_knn_graph_opts (with opts->symmetrize set to SE2_KNN_DIRECTED) without
+building the intermediate igraph graph. With SE2_KNN_UNION, two nodes are
+neighbors if either is one of the other's k nearest neighbors. With
+SE2_KNN_MUTUAL, both must be, so nodes can have fewer than k neighbors.
+
+\param mat the matrix containing the columns to compare.
+\param k number of nearest neighbors to find per column.
+\param opts a kNN options structure (see se2_knn_graph_opts).
+\param res the resulting neighbor list (uninitialized). Weights are the
+  similarities selected by opts->metric.
+\return Error code:
+         \c IGRAPH_EINVAL: Invalid value for k.
+ */
+igraph_error_t se2_knn_neighs(igraph_matrix_t* const mat,
+  igraph_integer_t const k, se2_knn_options* opts, se2_neighs* res)
+{
+  igraph_integer_t const n_cols = igraph_matrix_ncol(mat);
+  igraph_vector_int_t edges;
+  igraph_vector_t weights;
+
+  IGRAPH_CHECK(se2_knn_search(mat, k, opts, &edges, &weights));
+  IGRAPH_FINALLY(igraph_vector_int_destroy, &edges);
+  IGRAPH_FINALLY(igraph_vector_destroy, &weights);
+
+  IGRAPH_CHECK(
+    se2_knn_to_neighs(&edges, &weights, k, n_cols, opts->symmetrize, res));
+
+  igraph_vector_destroy(&weights);
+  igraph_vector_int_destroy(&edges);
+  IGRAPH_FINALLY_CLEAN(2);
+
+  return IGRAPH_SUCCESS;
+}
+
+/**
+\brief Update a kNN graph after new columns have been appended to its matrix.
+
+Finds the neighbors of the new columns among all columns and replaces the
+neighbors of old columns with new columns that are closer. This costs time
+proportional to the number of new columns times the total number of columns
+instead of rebuilding the graph from scratch. The result is the graph
+se2_knn_graph_opts would build for the full matrix, up to ties. The search
+for the new columns is always exact, opts->method and opts->target_dim are
+ignored.
+
+\param mat the matrix with the n_old columns graph was built from followed by
+  the new columns.
+\param n_old the number of columns graph was built from.
+\param k the k graph was built with.
+\param opts a kNN options structure with the same metric graph was built
+  with (see se2_knn_graph_opts).
+\param graph a graph built by se2_knn_graph_opts (or a previous call to this
+  function) for the first n_old columns of mat. Replaced with the graph for
+  all columns.
+\param weights the weights returned with graph (required). Replaced with the
+  weights for the updated graph.
+\return Error code:
+         \c IGRAPH_EINVAL: Invalid value for k or n_old or graph and weights
+         do not match.
+ */
+igraph_error_t se2_knn_graph_append(igraph_matrix_t* const mat,
+  igraph_integer_t const n_old, igraph_integer_t const k,
+  se2_knn_options* opts, igraph_t* graph, igraph_vector_t* weights)
+{
+  igraph_integer_t const n_cols = igraph_matrix_ncol(mat);
+  igraph_integer_t const n_old_edges = k * n_old;
+  igraph_vector_int_t edges;
+  igraph_vector_t new_weights;
+  igraph_t new_graph;
+
+  IGRAPH_CHECK(se2_knn_check_opts(n_cols, k, opts));
+
+  if ((n_old < 0) || (n_old > n_cols) || ((n_old <= k) && (n_old > 0))) {
+    IGRAPH_ERRORF("The number of old columns must be between k + 1 and the "
+                  "number of columns, got %" IGRAPH_PRId ".\n",
+      IGRAPH_EINVAL, n_old);
+  }
+
+  if ((igraph_vcount(graph) != n_old) ||
+      (igraph_ecount(graph) != n_old_edges) ||
+      (igraph_vector_size(weights) != n_old_edges)) {
+    IGRAPH_ERROR("The graph and weights do not match the old columns.",
+      IGRAPH_EINVAL);
+  }
+
+  IGRAPH_CHECK(igraph_vector_int_init(&edges, 2 * k * n_cols));
+  IGRAPH_FINALLY(igraph_vector_int_destroy, &edges);
+  IGRAPH_CHECK(igraph_vector_init(&new_weights, k * n_cols));
+  IGRAPH_FINALLY(igraph_vector_destroy, &new_weights);
+
+  se2_knn_fill_edges(&edges, k, n_cols);
+  for (igraph_integer_t eid = 0; eid < n_old_edges; eid++) {
+    if (IGRAPH_FROM(graph, eid) != (eid / k)) {
+      IGRAPH_ERROR("The graph's edges are not in the order returned by "
+                   "se2_knn_graph_opts.",
+        IGRAPH_EINVAL);
+    }
+
+    VECTOR(edges)[(2 * eid) + 1] = IGRAPH_TO(graph, eid);
+    VECTOR(new_weights)[eid] = VECTOR(*weights)[eid];
+  }
+
+  igraph_matrix_t normalized;
+  igraph_matrix_t const* compare_mat = mat;
+  igraph_bool_t const dot_weights = opts->metric != SE2_KNN_EUCLIDEAN;
+  if (dot_weights) {
+    IGRAPH_CHECK(se2_knn_normalize(mat, opts->metric, &normalized));
+    IGRAPH_FINALLY(igraph_matrix_destroy, &normalized);
+    compare_mat = &normalized;
+  }
+
+  if (k > 0) {
+    IGRAPH_CHECK(se2_closest_k_range(compare_mat, k, n_old, n_cols, 0, false,
+      dot_weights, opts->max_threads, &edges, &new_weights));
+    IGRAPH_CHECK(se2_closest_k_range(compare_mat, k, 0, n_old, n_old, true,
+      dot_weights, opts->max_threads, &edges, &new_weights));
+  }
+
+  if (dot_weights) {
+    igraph_matrix_destroy(&normalized);
+    IGRAPH_FINALLY_CLEAN(1);
   }
 
+  IGRAPH_CHECK(igraph_empty(&new_graph, n_cols, IGRAPH_DIRECTED));
+  IGRAPH_FINALLY(igraph_destroy, &new_graph);
+  IGRAPH_CHECK(igraph_add_edges(&new_graph, &edges, NULL));
+  IGRAPH_CHECK(igraph_vector_update(weights, &new_weights));
+  IGRAPH_FINALLY_CLEAN(1);
+
+  igraph_destroy(graph);
+  *graph = new_graph;
+
+  igraph_vector_destroy(&new_weights);
+  igraph_vector_int_destroy(&edges);
+  IGRAPH_FINALLY_CLEAN(2);
+
+  return IGRAPH_SUCCESS;
+}
+
+/**
+\brief Same as se2_knn_graph_opts for a sparse matrix.
+
+Stored values sharing a row are multiplied through a row-major copy of the
+matrix so the dense matrix is never built. Finds the same neighbors as the
+dense search would. The search is always exact, opts->method is ignored.
+
+\param mat the sparse matrix containing the columns to compare.
+\param k number of edges per column to make (must be >= 0 and < ncols - 1).
+\param opts a kNN options structure (see se2_knn_graph_opts).
+\param res the resulting graph (uninitialized).
+\param weights, if not NULL the similarity (depending on opts->metric) will
+  be stored here for each edge.
+\return Error code:
+         \c IGRAPH_EINVAL: Invalid value for k or malformed matrix.
+ */
+igraph_error_t se2_knn_graph_csc(se2_csc_matrix const* mat,
+  igraph_integer_t const k, se2_knn_options* opts, igraph_t* res,
+  igraph_vector_t* weights)
+{
+  igraph_vector_int_t edges;
+
+  IGRAPH_CHECK(se2_knn_search_csc(mat, k, opts, &edges, weights));
+  IGRAPH_FINALLY(igraph_vector_int_destroy, &edges);
   if (weights) {
-    IGRAPH_CHECK(igraph_vector_init(weights, n_edges));
     IGRAPH_FINALLY(igraph_vector_destroy, weights);
   }
 
-  if (k == 0) {
-    // Return empty graph.
-    goto finish;
+  IGRAPH_CHECK(igraph_empty(res, mat->n_cols, IGRAPH_DIRECTED));
+  IGRAPH_FINALLY(igraph_destroy, res);
+  IGRAPH_CHECK(igraph_add_edges(res, &edges, NULL));
+
+  igraph_vector_int_destroy(&edges);
+  IGRAPH_FINALLY_CLEAN(2);
+
+  if (weights) {
+    IGRAPH_FINALLY_CLEAN(1);
   }
 
-  IGRAPH_CHECK(igraph_vector_int_init(&edges, 2 * n_edges));
+  return IGRAPH_SUCCESS;
+}
+
+/**
+\brief Same as se2_knn_neighs for a sparse matrix.
+
+See se2_knn_graph_csc and se2_knn_neighs.
+ */
+igraph_error_t se2_knn_neighs_csc(se2_csc_matrix const* mat,
+  igraph_integer_t const k, se2_knn_options* opts, se2_neighs* res)
+{
+  igraph_vector_int_t edges;
+  igraph_vector_t weights;
+
+  IGRAPH_CHECK(se2_knn_search_csc(mat, k, opts, &edges, &weights));
   IGRAPH_FINALLY(igraph_vector_int_destroy, &edges);
-  se2_knn_fill_edges(&edges, k, n_cols);
+  IGRAPH_FINALLY(igraph_vector_destroy, &weights);
 
-  for (igraph_integer_t i = 0; i < n_cols; i++) {
-    IGRAPH_CHECK(se2_closest_k(i, k, mat, &edges, weights));
+  IGRAPH_CHECK(se2_knn_to_neighs(
+    &edges, &weights, k, mat->n_cols, opts->symmetrize, res));
+
+  igraph_vector_destroy(&weights);
+  igraph_vector_int_destroy(&edges);
+  IGRAPH_FINALLY_CLEAN(2);
+
+  return IGRAPH_SUCCESS;
+}
+
+/**
+\brief Same as se2_knn_graph_opts for a matrix stored in a file.
+
+For matrices that do not fit in memory. The file must contain the n_rows x
+n_cols matrix as raw igraph_real_t values in column-major order with no
+header, i.e. the data of an igraph_matrix_t written out as is. Columns are
+memory-mapped in chunks so at most opts->max_memory bytes of the matrix are
+mapped at once. The file is read once per chunk of columns so the more memory
+allowed the faster the search.
+
+Only SE2_KNN_EUCLIDEAN is supported, the search is always exact, and
+opts->target_dim is ignored. Gives the same result as se2_knn_graph_opts on
+the same matrix.
+
+\param path the file containing the matrix.
+\param n_rows number of rows in the matrix.
+\param n_cols number of columns in the matrix.
+\param k number of edges per column to make (must be >= 0 and < ncols - 1).
+\param opts a kNN options structure (see se2_knn_graph_opts).
+\param res the resulting graph (uninitialized).
+\param weights, if not NULL the similarity (inverse euclidean distance) will
+  be stored here for each edge.
+\return Error code:
+         \c IGRAPH_EINVAL: Invalid value for k or file of the wrong size.
+         \c IGRAPH_EFILE: The file could not be read.
+ */
+igraph_error_t se2_knn_graph_file(char const* path,
+  igraph_integer_t const n_rows, igraph_integer_t const n_cols,
+  igraph_integer_t const k, se2_knn_options* opts, igraph_t* res,
+  igraph_vector_t* weights)
+{
+  igraph_vector_int_t edges;
+
+  IGRAPH_CHECK(
+    se2_knn_search_file(path, n_rows, n_cols, k, opts, &edges, weights));
+  IGRAPH_FINALLY(igraph_vector_int_destroy, &edges);
+  if (weights) {
+    IGRAPH_FINALLY(igraph_vector_destroy, weights);
   }
 
+  IGRAPH_CHECK(igraph_empty(res, n_cols, IGRAPH_DIRECTED));
+  IGRAPH_FINALLY(igraph_destroy, res);
   IGRAPH_CHECK(igraph_add_edges(res, &edges, NULL));
+
   igraph_vector_int_destroy(&edges);
-  IGRAPH_FINALLY_CLEAN(1);
+  IGRAPH_FINALLY_CLEAN(2);
 
-finish:
   if (weights) {
     IGRAPH_FINALLY_CLEAN(1);
   }
 
-  IGRAPH_FINALLY_CLEAN(1);
+  return IGRAPH_SUCCESS;
+}
+
+/**
+\brief Same as se2_knn_neighs for a matrix stored in a file.
+
+See se2_knn_graph_file and se2_knn_neighs.
+ */
+igraph_error_t se2_knn_neighs_file(char const* path,
+  igraph_integer_t const n_rows, igraph_integer_t const n_cols,
+  igraph_integer_t const k, se2_knn_options* opts, se2_neighs* res)
+{
+  igraph_vector_int_t edges;
+  igraph_vector_t weights;
+
+  IGRAPH_CHECK(
+    se2_knn_search_file(path, n_rows, n_cols, k, opts, &edges, &weights));
+  IGRAPH_FINALLY(igraph_vector_int_destroy, &edges);
+  IGRAPH_FINALLY(igraph_vector_destroy, &weights);
+
+  IGRAPH_CHECK(
+    se2_knn_to_neighs(&edges, &weights, k, n_cols, opts->symmetrize, res));
+
+  igraph_vector_destroy(&weights);
+  igraph_vector_int_destroy(&edges);
+  IGRAPH_FINALLY_CLEAN(2);
 
   return IGRAPH_SUCCESS;
 }
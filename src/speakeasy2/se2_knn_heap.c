@@ -0,0 +1,142 @@
+/* Copyright 2024 David R. Connell <david32@dcon.addy.io>.
+ *
+ * This file is part of SpeakEasy 2.
+ *
+ * SpeakEasy 2 is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * SpeakEasy 2 is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with SpeakEasy 2. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "se2_knn_heap.h"
+
+void se2_knn_heap_init(se2_knn_heap* heap, igraph_real_t* keys,
+  igraph_integer_t* ids, igraph_bool_t* flags, igraph_integer_t const k)
+{
+  heap->keys = keys;
+  heap->ids = ids;
+  heap->flags = flags;
+  heap->k = k;
+  heap->size = 0;
+}
+
+static inline void se2_knn_heap_swap(
+  se2_knn_heap* heap, igraph_integer_t const i, igraph_integer_t const j)
+{
+  igraph_real_t const key = heap->keys[i];
+  igraph_integer_t const id = heap->ids[i];
+  heap->keys[i] = heap->keys[j];
+  heap->ids[i] = heap->ids[j];
+  heap->keys[j] = key;
+  heap->ids[j] = id;
+
+  if (heap->flags) {
+    igraph_bool_t const flag = heap->flags[i];
+    heap->flags[i] = heap->flags[j];
+    heap->flags[j] = flag;
+  }
+}
+
+/* Whether entry i is farther from the query than entry j. Ties in key are
+broken by id so every search orders equally distant candidates the same way
+regardless of the order it finds them in. */
+static inline igraph_bool_t se2_knn_heap_farther(
+  se2_knn_heap const* heap, igraph_integer_t const i, igraph_integer_t const j)
+{
+  return (heap->keys[i] > heap->keys[j]) ||
+         ((heap->keys[i] == heap->keys[j]) && (heap->ids[i] > heap->ids[j]));
+}
+
+static void se2_knn_heap_sift_down(
+  se2_knn_heap* heap, igraph_integer_t node, igraph_integer_t const size)
+{
+  igraph_integer_t child;
+  while ((child = (2 * node) + 1) < size) {
+    if (((child + 1) < size) && se2_knn_heap_farther(heap, child + 1, child)) {
+      child++;
+    }
+
+    if (!se2_knn_heap_farther(heap, child, node)) {
+      return;
+    }
+
+    se2_knn_heap_swap(heap, node, child);
+    node = child;
+  }
+}
+
+/* Offer a candidate to the heap. Candidates are only accepted if
+se2_knn_heap_accepts them, so of candidates with equal keys the ones with the
+smallest ids are kept. If the heap has flags, the flag of an accepted
+candidate is set. */
+void se2_knn_heap_push(
+  se2_knn_heap* heap, igraph_real_t const key, igraph_integer_t const id)
+{
+  if (heap->size < heap->k) {
+    igraph_integer_t node = heap->size++;
+    heap->keys[node] = key;
+    heap->ids[node] = id;
+    if (heap->flags) {
+      heap->flags[node] = true;
+    }
+    while (node > 0) {
+      igraph_integer_t const parent = (node - 1) / 2;
+      if (!se2_knn_heap_farther(heap, node, parent)) {
+        break;
+      }
+
+      se2_knn_heap_swap(heap, parent, node);
+      node = parent;
+    }
+
+    return;
+  }
+
+  if (!se2_knn_heap_accepts(heap, key, id)) {
+    return;
+  }
+
+  heap->keys[0] = key;
+  heap->ids[0] = id;
+  if (heap->flags) {
+    heap->flags[0] = true;
+  }
+  se2_knn_heap_sift_down(heap, 0, heap->size);
+}
+
+/* Like se2_knn_heap_push but rejects candidates already in the heap. Returns
+whether the candidate was accepted. */
+igraph_bool_t se2_knn_heap_push_unique(
+  se2_knn_heap* heap, igraph_real_t const key, igraph_integer_t const id)
+{
+  if (!se2_knn_heap_accepts(heap, key, id)) {
+    return false;
+  }
+
+  for (igraph_integer_t i = 0; i < heap->size; i++) {
+    if (heap->ids[i] == id) {
+      return false;
+    }
+  }
+
+  se2_knn_heap_push(heap, key, id);
+  return true;
+}
+
+/* Sort the candidates in place from closest to farthest. The heap is no
+longer valid afterwards. */
+void se2_knn_heap_sort(se2_knn_heap* heap)
+{
+  for (igraph_integer_t end = heap->size - 1; end > 0; end--) {
+    se2_knn_heap_swap(heap, 0, end);
+    se2_knn_heap_sift_down(heap, 0, end);
+  }
+}
@@ -0,0 +1,65 @@
+/* Copyright 2024 David R. Connell <david32@dcon.addy.io>.
+ *
+ * This file is part of SpeakEasy 2.
+ *
+ * SpeakEasy 2 is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * SpeakEasy 2 is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with SpeakEasy 2. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef SE2_KNN_HEAP_H
+#define SE2_KNN_HEAP_H
+
+#include <igraph.h>
+
+/* Bounded max-heap holding the k closest candidates seen so far for a single
+query. The root is the current worst candidate so testing a new candidate is a
+single comparison against se2_knn_heap_bound.
+
+The heap does not own its storage. Callers processing queries in batches
+carve the keys and ids of all heaps out of one buffer. Optionally, a flag per
+entry can be kept alongside the entries, this is used by NN-descent to track
+which neighbors have not been joined yet. */
+typedef struct {
+  igraph_real_t* keys; // Distance (or any "smaller is closer" measure).
+  igraph_integer_t* ids;
+  igraph_bool_t* flags; // Optional (NULL).
+  igraph_integer_t k;
+  igraph_integer_t size;
+} se2_knn_heap;
+
+void se2_knn_heap_init(se2_knn_heap* heap, igraph_real_t* keys,
+  igraph_integer_t* ids, igraph_bool_t* flags, igraph_integer_t const k);
+void se2_knn_heap_push(
+  se2_knn_heap* heap, igraph_real_t const key, igraph_integer_t const id);
+igraph_bool_t se2_knn_heap_push_unique(
+  se2_knn_heap* heap, igraph_real_t const key, igraph_integer_t const id);
+void se2_knn_heap_sort(se2_knn_heap* heap);
+
+/* Key of the current worst candidate. Candidates with a larger key cannot
+enter the heap, candidates with an equal key can if their id is smaller. */
+static inline igraph_real_t se2_knn_heap_bound(se2_knn_heap const* heap)
+{
+  return heap->size < heap->k ? IGRAPH_INFINITY : heap->keys[0];
+}
+
+/* Whether a candidate would enter the heap. Candidates are ordered by key then
+by id so all searches agree on which of several equally close candidates are
+kept. */
+static inline igraph_bool_t se2_knn_heap_accepts(se2_knn_heap const* heap,
+  igraph_real_t const key, igraph_integer_t const id)
+{
+  return (heap->size < heap->k) || (key < heap->keys[0]) ||
+         ((key == heap->keys[0]) && (id < heap->ids[0]));
+}
+
+#endif
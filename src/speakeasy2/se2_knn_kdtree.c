@@ -0,0 +1,379 @@
+/* Copyright 2024 David R. Connell <david32@dcon.addy.io>.
+ *
+ * This file is part of SpeakEasy 2.
+ *
+ * SpeakEasy 2 is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * SpeakEasy 2 is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with SpeakEasy 2. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "se2_knn_kdtree.h"
+
+#include "se2_knn_heap.h"
+
+#ifdef SE2PAR
+# include <pthread.h>
+#endif
+
+/* Exact kNN search with a KD-tree. For inputs with few rows, most of the
+all-pairs comparisons made by the brute-force search are between columns that
+are far apart. The tree lets queries skip whole regions that cannot contain a
+closer column than the current k-th nearest. */
+
+// Ranges with at most this many columns are not split further.
+#define SE2_KDTREE_LEAF_SIZE 16
+// Number of consecutive queries a thread handles at a time.
+#define SE2_KDTREE_QUERY_BLOCK 64
+
+/* Nodes are stored as parallel arrays. A node covers the columns
+perm[start] to perm[end - 1]. Internal nodes split their columns at
+split_value along split_dim, columns in left have values <= split_value and
+columns in right have values >= split_value. Leaves have a split_dim of -1. */
+typedef struct {
+  igraph_matrix_t const* mat;
+  igraph_vector_int_t perm;
+  igraph_vector_int_t start;
+  igraph_vector_int_t end;
+  igraph_vector_int_t split_dim;
+  igraph_vector_t split_value;
+  igraph_vector_int_t left;
+  igraph_vector_int_t right;
+} se2_kdtree;
+
+static void se2_kdtree_destroy(se2_kdtree* tree)
+{
+  igraph_vector_int_destroy(&tree->perm);
+  igraph_vector_int_destroy(&tree->start);
+  igraph_vector_int_destroy(&tree->end);
+  igraph_vector_int_destroy(&tree->split_dim);
+  igraph_vector_destroy(&tree->split_value);
+  igraph_vector_int_destroy(&tree->left);
+  igraph_vector_int_destroy(&tree->right);
+}
+
+static inline igraph_real_t se2_kdtree_coord(
+  se2_kdtree const* tree, igraph_integer_t const col, igraph_integer_t dim)
+{
+  return MATRIX(*tree->mat, dim, col);
+}
+
+/* Reorder perm[start, end) so perm[nth] holds the column that would be there
+if the range was sorted along dim, with smaller or equal values before it and
+larger or equal after it. */
+static void se2_kdtree_select(se2_kdtree* tree, igraph_integer_t start,
+  igraph_integer_t end, igraph_integer_t const nth, igraph_integer_t const dim)
+{
+  igraph_integer_t* perm = VECTOR(tree->perm);
+  while ((end - start) > 1) {
+    igraph_real_t const pivot =
+      se2_kdtree_coord(tree, perm[start + ((end - start) / 2)], dim);
+    igraph_integer_t i = start;
+    igraph_integer_t j = end - 1;
+    while (i <= j) {
+      while (se2_kdtree_coord(tree, perm[i], dim) < pivot) {
+        i++;
+      }
+      while (se2_kdtree_coord(tree, perm[j], dim) > pivot) {
+        j--;
+      }
+      if (i <= j) {
+        igraph_integer_t const swap = perm[i];
+        perm[i] = perm[j];
+        perm[j] = swap;
+        i++;
+        j--;
+      }
+    }
+
+    if (nth <= j) {
+      end = j + 1;
+    } else if (nth >= i) {
+      start = i;
+    } else {
+      return;
+    }
+  }
+}
+
+static igraph_error_t se2_kdtree_add_node(se2_kdtree* tree,
+  igraph_integer_t const start, igraph_integer_t const end,
+  igraph_integer_t* node_id)
+{
+  *node_id = igraph_vector_int_size(&tree->start);
+  IGRAPH_CHECK(igraph_vector_int_push_back(&tree->start, start));
+  IGRAPH_CHECK(igraph_vector_int_push_back(&tree->end, end));
+  IGRAPH_CHECK(igraph_vector_int_push_back(&tree->split_dim, -1));
+  IGRAPH_CHECK(igraph_vector_push_back(&tree->split_value, 0));
+  IGRAPH_CHECK(igraph_vector_int_push_back(&tree->left, -1));
+  IGRAPH_CHECK(igraph_vector_int_push_back(&tree->right, -1));
+
+  return IGRAPH_SUCCESS;
+}
+
+/* Split the range at the median of the dimension with the largest spread. */
+static igraph_error_t se2_kdtree_build_i(se2_kdtree* tree,
+  igraph_integer_t const start, igraph_integer_t const end,
+  igraph_integer_t* node_id)
+{
+  igraph_integer_t const n_rows = igraph_matrix_nrow(tree->mat);
+  igraph_integer_t const* perm = VECTOR(tree->perm);
+
+  IGRAPH_CHECK(se2_kdtree_add_node(tree, start, end, node_id));
+  if ((end - start) <= SE2_KDTREE_LEAF_SIZE) {
+    return IGRAPH_SUCCESS;
+  }
+
+  igraph_integer_t best_dim = 0;
+  igraph_real_t best_spread = 0;
+  for (igraph_integer_t dim = 0; dim < n_rows; dim++) {
+    igraph_real_t min = se2_kdtree_coord(tree, perm[start], dim);
+    igraph_real_t max = min;
+    for (igraph_integer_t i = start + 1; i < end; i++) {
+      igraph_real_t const value = se2_kdtree_coord(tree, perm[i], dim);
+      min = value < min ? value : min;
+      max = value > max ? value : max;
+    }
+
+    if ((max - min) > best_spread) {
+      best_spread = max - min;
+      best_dim = dim;
+    }
+  }
+
+  if (best_spread == 0) { // All columns identical, cannot split.
+    return IGRAPH_SUCCESS;
+  }
+
+  igraph_integer_t const mid = start + ((end - start) / 2);
+  igraph_integer_t left, right;
+  se2_kdtree_select(tree, start, end, mid, best_dim);
+  VECTOR(tree->split_dim)[*node_id] = best_dim;
+  VECTOR(tree->split_value)
+  [*node_id] = se2_kdtree_coord(tree, VECTOR(tree->perm)[mid], best_dim);
+
+  IGRAPH_CHECK(se2_kdtree_build_i(tree, start, mid, &left));
+  IGRAPH_CHECK(se2_kdtree_build_i(tree, mid, end, &right));
+  VECTOR(tree->left)[*node_id] = left;
+  VECTOR(tree->right)[*node_id] = right;
+
+  return IGRAPH_SUCCESS;
+}
+
+static igraph_error_t se2_kdtree_init(
+  se2_kdtree* tree, igraph_matrix_t const* mat)
+{
+  igraph_integer_t const n_cols = igraph_matrix_ncol(mat);
+  igraph_integer_t root;
+
+  tree->mat = mat;
+  IGRAPH_CHECK(igraph_vector_int_init_range(&tree->perm, 0, n_cols));
+  IGRAPH_FINALLY(igraph_vector_int_destroy, &tree->perm);
+  IGRAPH_CHECK(igraph_vector_int_init(&tree->start, 0));
+  IGRAPH_FINALLY(igraph_vector_int_destroy, &tree->start);
+  IGRAPH_CHECK(igraph_vector_int_init(&tree->end, 0));
+  IGRAPH_FINALLY(igraph_vector_int_destroy, &tree->end);
+  IGRAPH_CHECK(igraph_vector_int_init(&tree->split_dim, 0));
+  IGRAPH_FINALLY(igraph_vector_int_destroy, &tree->split_dim);
+  IGRAPH_CHECK(igraph_vector_init(&tree->split_value, 0));
+  IGRAPH_FINALLY(igraph_vector_destroy, &tree->split_value);
+  IGRAPH_CHECK(igraph_vector_int_init(&tree->left, 0));
+  IGRAPH_FINALLY(igraph_vector_int_destroy, &tree->left);
+  IGRAPH_CHECK(igraph_vector_int_init(&tree->right, 0));
+  IGRAPH_FINALLY(igraph_vector_int_destroy, &tree->right);
+
+  IGRAPH_CHECK(se2_kdtree_build_i(tree, 0, n_cols, &root));
+
+  IGRAPH_FINALLY_CLEAN(7);
+
+  return IGRAPH_SUCCESS;
+}
+
+static igraph_real_t se2_sq_dist(igraph_real_t const* restrict a,
+  igraph_real_t const* restrict b, igraph_integer_t const n_rows)
+{
+  igraph_real_t out = 0;
+  for (igraph_integer_t i = 0; i < n_rows; i++) {
+    igraph_real_t const el = a[i] - b[i];
+    out += el * el;
+  }
+
+  return out;
+}
+
+static void se2_kdtree_query(se2_kdtree const* tree,
+  igraph_integer_t const node_id, igraph_integer_t const col,
+  se2_knn_heap* heap)
+{
+  igraph_integer_t const n_rows = igraph_matrix_nrow(tree->mat);
+  igraph_integer_t const dim = VECTOR(tree->split_dim)[node_id];
+  igraph_real_t const* query = &MATRIX(*tree->mat, 0, col);
+
+  if (dim == -1) {
+    igraph_integer_t const* perm = VECTOR(tree->perm);
+    for (igraph_integer_t i = VECTOR(tree->start)[node_id];
+         i < VECTOR(tree->end)[node_id]; i++) {
+      if (perm[i] == col) {
+        continue;
+      }
+
+      igraph_real_t const d2 =
+        se2_sq_dist(query, &MATRIX(*tree->mat, 0, perm[i]), n_rows);
+      if (se2_knn_heap_accepts(heap, d2, perm[i])) {
+        se2_knn_heap_push(heap, d2, perm[i]);
+      }
+    }
+
+    return;
+  }
+
+  igraph_real_t const diff = query[dim] - VECTOR(tree->split_value)[node_id];
+  igraph_integer_t const near =
+    diff < 0 ? VECTOR(tree->left)[node_id] : VECTOR(tree->right)[node_id];
+  igraph_integer_t const far =
+    diff < 0 ? VECTOR(tree->right)[node_id] : VECTOR(tree->left)[node_id];
+
+  se2_kdtree_query(tree, near, col, heap);
+  // Every column in far is at least |diff| away along dim. Columns exactly at
+  // the bound can still win a tie by id.
+  if ((diff * diff) <= se2_knn_heap_bound(heap)) {
+    se2_kdtree_query(tree, far, col, heap);
+  }
+}
+
+struct kdtree_params {
+  igraph_integer_t tid;
+  igraph_integer_t n_threads;
+  igraph_integer_t k;
+  se2_kdtree const* tree;
+  igraph_real_t* keys;
+  igraph_integer_t* ids;
+  igraph_vector_int_t* edges;
+  igraph_vector_t* weights;
+};
+
+static void* se2_thread_kdtree(void* parameters)
+{
+  struct kdtree_params const* p = (struct kdtree_params*)parameters;
+  igraph_integer_t const n_cols = igraph_matrix_ncol(p->tree->mat);
+  igraph_integer_t const k = p->k;
+  se2_knn_heap heap;
+
+  for (igraph_integer_t q_start = p->tid * SE2_KDTREE_QUERY_BLOCK;
+       q_start < n_cols; q_start += p->n_threads * SE2_KDTREE_QUERY_BLOCK) {
+    igraph_integer_t const q_end = q_start + SE2_KDTREE_QUERY_BLOCK < n_cols ?
+                                     q_start + SE2_KDTREE_QUERY_BLOCK :
+                                     n_cols;
+    for (igraph_integer_t col = q_start; col < q_end; col++) {
+      igraph_integer_t* col_edges = VECTOR(*p->edges) + (2 * col * k);
+
+      se2_knn_heap_init(&heap, p->keys, p->ids, NULL, k);
+      se2_kdtree_query(p->tree, 0, col, &heap);
+
+      // Closest first after sorting, output is closest last.
+      se2_knn_heap_sort(&heap);
+      for (igraph_integer_t i = 0; i < k; i++) {
+        col_edges[(2 * i) + 1] = heap.ids[k - 1 - i];
+        if (p->weights) {
+          VECTOR(*p->weights)[(col * k) + i] = 1 / sqrt(heap.keys[k - 1 - i]);
+        }
+      }
+    }
+  }
+
+  return NULL;
+}
+
+/* Whether the KD-tree is expected to beat the brute-force search. Trees lose
+their advantage as the number of dimensions grows unless there are many more
+columns than regions of the space. */
+igraph_bool_t se2_knn_kdtree_is_suitable(igraph_matrix_t const* mat)
+{
+  igraph_integer_t const n_rows = igraph_matrix_nrow(mat);
+  igraph_integer_t const n_cols = igraph_matrix_ncol(mat);
+
+  return (n_rows <= SE2_KDTREE_MAX_DIM) && (n_cols >= SE2_KDTREE_MIN_COLS) &&
+         (((igraph_integer_t)1 << n_rows) <= n_cols);
+}
+
+/* Find the exact k nearest columns of every column of mat. Writes the
+results in the same layout as the brute-force search. */
+igraph_error_t se2_knn_kdtree(igraph_matrix_t const* mat,
+  igraph_integer_t const k, igraph_integer_t n_threads,
+  igraph_vector_int_t* edges, igraph_vector_t* weights)
+{
+  igraph_integer_t const n_cols = igraph_matrix_ncol(mat);
+  igraph_integer_t const n_blocks =
+    (n_cols + SE2_KDTREE_QUERY_BLOCK - 1) / SE2_KDTREE_QUERY_BLOCK;
+  se2_kdtree tree;
+  igraph_vector_t keys;
+  igraph_vector_int_t ids;
+
+#ifndef SE2PAR
+  n_threads = 1;
+#endif
+
+  if (n_threads > n_blocks) {
+    n_threads = n_blocks;
+  }
+
+  IGRAPH_CHECK(se2_kdtree_init(&tree, mat));
+  IGRAPH_FINALLY(se2_kdtree_destroy, &tree);
+
+  IGRAPH_CHECK(igraph_vector_init(&keys, n_threads * k));
+  IGRAPH_FINALLY(igraph_vector_destroy, &keys);
+  IGRAPH_CHECK(igraph_vector_int_init(&ids, n_threads * k));
+  IGRAPH_FINALLY(igraph_vector_int_destroy, &ids);
+
+  struct kdtree_params* args = malloc(sizeof(*args) * n_threads);
+  IGRAPH_CHECK_OOM(args, "Out of memory.");
+  IGRAPH_FINALLY(free, args);
+
+#ifdef SE2PAR
+  pthread_t* threads = malloc(sizeof(*threads) * n_threads);
+  IGRAPH_CHECK_OOM(threads, "Out of memory.");
+  IGRAPH_FINALLY(free, threads);
+#endif
+
+  for (igraph_integer_t tid = 0; tid < n_threads; tid++) {
+    args[tid].tid = tid;
+    args[tid].n_threads = n_threads;
+    args[tid].k = k;
+    args[tid].tree = &tree;
+    args[tid].keys = VECTOR(keys) + (tid * k);
+    args[tid].ids = VECTOR(ids) + (tid * k);
+    args[tid].edges = edges;
+    args[tid].weights = weights;
+
+#ifdef SE2PAR
+    pthread_create(&threads[tid], NULL, se2_thread_kdtree, (void*)&args[tid]);
+#else
+    se2_thread_kdtree((void*)&args[tid]);
+#endif
+  }
+
+#ifdef SE2PAR
+  for (igraph_integer_t tid = 0; tid < n_threads; tid++) {
+    pthread_join(threads[tid], NULL);
+  }
+
+  free(threads);
+  IGRAPH_FINALLY_CLEAN(1);
+#endif
+
+  free(args);
+  igraph_vector_int_destroy(&ids);
+  igraph_vector_destroy(&keys);
+  se2_kdtree_destroy(&tree);
+  IGRAPH_FINALLY_CLEAN(4);
+
+  return IGRAPH_SUCCESS;
+}
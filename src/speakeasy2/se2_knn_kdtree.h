@@ -0,0 +1,33 @@
+/* Copyright 2024 David R. Connell <david32@dcon.addy.io>.
+ *
+ * This file is part of SpeakEasy 2.
+ *
+ * SpeakEasy 2 is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * SpeakEasy 2 is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with SpeakEasy 2. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef SE2_KNN_KDTREE_H
+#define SE2_KNN_KDTREE_H
+
+#include <speak_easy_2.h>
+
+/* Limits for automatically using the KD-tree over the brute-force search. */
+#define SE2_KDTREE_MAX_DIM 16
+#define SE2_KDTREE_MIN_COLS 1024
+
+igraph_bool_t se2_knn_kdtree_is_suitable(igraph_matrix_t const* mat);
+igraph_error_t se2_knn_kdtree(igraph_matrix_t const* mat,
+  igraph_integer_t const k, igraph_integer_t n_threads,
+  igraph_vector_int_t* edges, igraph_vector_t* weights);
+
+#endif
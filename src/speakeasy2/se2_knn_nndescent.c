@@ -0,0 +1,501 @@
+/* Copyright 2024 David R. Connell <david32@dcon.addy.io>.
+ *
+ * This file is part of SpeakEasy 2.
+ *
+ * SpeakEasy 2 is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * SpeakEasy 2 is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with SpeakEasy 2. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "se2_knn_nndescent.h"
+
+#include "se2_knn_heap.h"
+
+#ifdef SE2PAR
+# include <pthread.h>
+#endif
+
+/* NN-descent (Dong, Moses, and Li 2011) builds an approximate kNN graph by
+repeatedly comparing each node's neighbors with each other ("local join") on
+the assumption that a neighbor of a neighbor is likely also a neighbor.
+
+Each round, only pairs involving at least one neighbor that has been added
+since the node's last join are compared. Reverse neighbors are included,
+sampled down to k, so information flows in both directions. */
+
+/* Maximum number of candidate pairs whose distances are computed in a single
+parallel pass. Bounds the size of the distance buffer. */
+#define SE2_NNDESCENT_PAIR_BUDGET (1 << 20)
+
+/* Neighbor lists shorter than this barely connect the graph so the search
+gets stuck. For small k, a longer list is kept and truncated at the end. */
+#define SE2_NNDESCENT_MIN_LIST 10
+
+#define SE2_NNDESCENT_DEFAULT_ITERATIONS 10
+#define SE2_NNDESCENT_DEFAULT_TOLERANCE 0.001
+
+static igraph_real_t se2_sq_dist(igraph_real_t const* restrict a,
+  igraph_real_t const* restrict b, igraph_integer_t const n_rows)
+{
+  igraph_real_t out = 0;
+  for (igraph_integer_t i = 0; i < n_rows; i++) {
+    igraph_real_t const el = a[i] - b[i];
+    out += el * el;
+  }
+
+  return out;
+}
+
+/* Candidate lists for the local join. Each node has room for 2k candidates:
+its own neighbors in the first k slots and a sample of its reverse neighbors
+in the last k. After merging, the first size[i] slots hold the unique
+candidates. */
+typedef struct {
+  igraph_vector_int_t ids;
+  igraph_vector_int_t size;
+  igraph_vector_int_t n_reverse; // Reverse neighbors seen (for sampling).
+  igraph_integer_t k;
+} se2_candidates;
+
+static void se2_candidates_destroy(se2_candidates* cands)
+{
+  igraph_vector_int_destroy(&cands->ids);
+  igraph_vector_int_destroy(&cands->size);
+  igraph_vector_int_destroy(&cands->n_reverse);
+}
+
+static igraph_error_t se2_candidates_init(
+  se2_candidates* cands, igraph_integer_t const n, igraph_integer_t const k)
+{
+  IGRAPH_CHECK(igraph_vector_int_init(&cands->ids, 2 * k * n));
+  IGRAPH_FINALLY(igraph_vector_int_destroy, &cands->ids);
+  IGRAPH_CHECK(igraph_vector_int_init(&cands->size, n));
+  IGRAPH_FINALLY(igraph_vector_int_destroy, &cands->size);
+  IGRAPH_CHECK(igraph_vector_int_init(&cands->n_reverse, n));
+  cands->k = k;
+  IGRAPH_FINALLY_CLEAN(2);
+
+  return IGRAPH_SUCCESS;
+}
+
+static inline igraph_integer_t* se2_candidates_of(
+  se2_candidates const* cands, igraph_integer_t const node_id)
+{
+  return VECTOR(cands->ids) + (2 * cands->k * node_id);
+}
+
+/* Reservoir sample node_id into the reverse candidates of neigh so every
+reverse neighbor has the same chance of being kept. */
+static void se2_candidates_add_reverse(se2_candidates* cands,
+  igraph_integer_t const neigh, igraph_integer_t const node_id,
+  igraph_rng_t* rng)
+{
+  igraph_integer_t const k = cands->k;
+  igraph_integer_t* reverse = se2_candidates_of(cands, neigh) + k;
+  igraph_integer_t const seen = VECTOR(cands->n_reverse)[neigh]++;
+
+  if (seen < k) {
+    reverse[seen] = node_id;
+    return;
+  }
+
+  igraph_integer_t const pos = igraph_rng_get_integer(rng, 0, seen);
+  if (pos < k) {
+    reverse[pos] = node_id;
+  }
+}
+
+static int se2_cmp_integer(void const* a, void const* b)
+{
+  igraph_integer_t const x = *(igraph_integer_t const*)a;
+  igraph_integer_t const y = *(igraph_integer_t const*)b;
+  return (x > y) - (x < y);
+}
+
+/* Move the sampled reverse neighbors next to the node's own neighbors and
+remove duplicates. */
+static void se2_candidates_merge(
+  se2_candidates* cands, igraph_integer_t const node_id)
+{
+  igraph_integer_t const k = cands->k;
+  igraph_integer_t* ids = se2_candidates_of(cands, node_id);
+  igraph_integer_t n_reverse = VECTOR(cands->n_reverse)[node_id];
+  igraph_integer_t size = VECTOR(cands->size)[node_id];
+
+  n_reverse = n_reverse < k ? n_reverse : k;
+  for (igraph_integer_t i = 0; i < n_reverse; i++) {
+    ids[size++] = ids[k + i];
+  }
+
+  igraph_qsort(ids, size, sizeof(*ids), se2_cmp_integer);
+  igraph_integer_t n_unique = size > 0 ? 1 : 0;
+  for (igraph_integer_t i = 1; i < size; i++) {
+    if (ids[i] != ids[n_unique - 1]) {
+      ids[n_unique++] = ids[i];
+    }
+  }
+
+  VECTOR(cands->size)[node_id] = n_unique;
+}
+
+/* A contiguous range of nodes whose local joins are computed in one pass.
+The distance of every candidate pair is written to dists so threads never
+touch the heaps. */
+struct nndescent_chunk {
+  igraph_matrix_t const* mat;
+  se2_candidates const* new_cands;
+  se2_candidates const* old_cands;
+  igraph_integer_t start;
+  igraph_integer_t n_nodes;
+  igraph_integer_t const* offsets; // Start of each node's pairs in dists.
+  igraph_real_t* dists;
+};
+
+struct nndescent_params {
+  igraph_integer_t tid;
+  igraph_integer_t n_threads;
+  struct nndescent_chunk const* chunk;
+};
+
+static igraph_integer_t se2_nndescent_n_pairs(se2_candidates const* new_cands,
+  se2_candidates const* old_cands, igraph_integer_t const node_id)
+{
+  igraph_integer_t const n_new = VECTOR(new_cands->size)[node_id];
+  igraph_integer_t const n_old = VECTOR(old_cands->size)[node_id];
+  return ((n_new * (n_new - 1)) / 2) + (n_new * n_old);
+}
+
+static void* se2_thread_nndescent(void* parameters)
+{
+  struct nndescent_params const* p = (struct nndescent_params*)parameters;
+  struct nndescent_chunk const* chunk = p->chunk;
+  igraph_integer_t const n_rows = igraph_matrix_nrow(chunk->mat);
+
+  for (igraph_integer_t i = p->tid; i < chunk->n_nodes; i += p->n_threads) {
+    igraph_integer_t const node_id = chunk->start + i;
+    igraph_integer_t const* new_ids =
+      se2_candidates_of(chunk->new_cands, node_id);
+    igraph_integer_t const* old_ids =
+      se2_candidates_of(chunk->old_cands, node_id);
+    igraph_integer_t const n_new = VECTOR(chunk->new_cands->size)[node_id];
+    igraph_integer_t const n_old = VECTOR(chunk->old_cands->size)[node_id];
+    igraph_real_t* dists = chunk->dists + chunk->offsets[i];
+
+    for (igraph_integer_t a = 0; a < n_new; a++) {
+      igraph_real_t const* col_a = &MATRIX(*chunk->mat, 0, new_ids[a]);
+      for (igraph_integer_t b = a + 1; b < n_new; b++) {
+        *dists++ =
+          se2_sq_dist(col_a, &MATRIX(*chunk->mat, 0, new_ids[b]), n_rows);
+      }
+
+      for (igraph_integer_t b = 0; b < n_old; b++) {
+        *dists++ = new_ids[a] == old_ids[b] ?
+                     IGRAPH_INFINITY :
+                     se2_sq_dist(
+                       col_a, &MATRIX(*chunk->mat, 0, old_ids[b]), n_rows);
+      }
+    }
+  }
+
+  return NULL;
+}
+
+static igraph_integer_t se2_nndescent_offer(se2_knn_heap* heaps,
+  igraph_integer_t const a, igraph_integer_t const b, igraph_real_t const d)
+{
+  return se2_knn_heap_push_unique(&heaps[a], d, b) +
+         se2_knn_heap_push_unique(&heaps[b], d, a);
+}
+
+/* Offer every pair of the chunk's local joins to the heaps in the same order
+the distances were computed. Done serially so the result does not depend on
+the number of threads. */
+static igraph_integer_t se2_nndescent_apply(
+  struct nndescent_chunk const* chunk, se2_knn_heap* heaps)
+{
+  igraph_integer_t n_updates = 0;
+  igraph_real_t const* dists = chunk->dists;
+
+  for (igraph_integer_t i = 0; i < chunk->n_nodes; i++) {
+    igraph_integer_t const node_id = chunk->start + i;
+    igraph_integer_t const* new_ids =
+      se2_candidates_of(chunk->new_cands, node_id);
+    igraph_integer_t const* old_ids =
+      se2_candidates_of(chunk->old_cands, node_id);
+    igraph_integer_t const n_new = VECTOR(chunk->new_cands->size)[node_id];
+    igraph_integer_t const n_old = VECTOR(chunk->old_cands->size)[node_id];
+
+    for (igraph_integer_t a = 0; a < n_new; a++) {
+      for (igraph_integer_t b = a + 1; b < n_new; b++) {
+        n_updates += se2_nndescent_offer(heaps, new_ids[a], new_ids[b],
+          *dists++);
+      }
+
+      for (igraph_integer_t b = 0; b < n_old; b++) {
+        igraph_real_t const d = *dists++;
+        if (d < IGRAPH_INFINITY) {
+          n_updates += se2_nndescent_offer(heaps, new_ids[a], old_ids[b], d);
+        }
+      }
+    }
+  }
+
+  return n_updates;
+}
+
+static igraph_error_t se2_nndescent_run_chunk(
+  struct nndescent_chunk const* chunk, igraph_integer_t n_threads)
+{
+  if (n_threads > chunk->n_nodes) {
+    n_threads = chunk->n_nodes;
+  }
+
+  struct nndescent_params* args = malloc(sizeof(*args) * n_threads);
+  IGRAPH_CHECK_OOM(args, "Out of memory.");
+  IGRAPH_FINALLY(free, args);
+
+#ifdef SE2PAR
+  pthread_t* threads = malloc(sizeof(*threads) * n_threads);
+  IGRAPH_CHECK_OOM(threads, "Out of memory.");
+  IGRAPH_FINALLY(free, threads);
+#endif
+
+  for (igraph_integer_t tid = 0; tid < n_threads; tid++) {
+    args[tid].tid = tid;
+    args[tid].n_threads = n_threads;
+    args[tid].chunk = chunk;
+
+#ifdef SE2PAR
+    pthread_create(
+      &threads[tid], NULL, se2_thread_nndescent, (void*)&args[tid]);
+#else
+    se2_thread_nndescent((void*)&args[tid]);
+#endif
+  }
+
+#ifdef SE2PAR
+  for (igraph_integer_t tid = 0; tid < n_threads; tid++) {
+    pthread_join(threads[tid], NULL);
+  }
+
+  free(threads);
+  IGRAPH_FINALLY_CLEAN(1);
+#endif
+
+  free(args);
+  IGRAPH_FINALLY_CLEAN(1);
+
+  return IGRAPH_SUCCESS;
+}
+
+/* Split each node's neighbors into ones added since the last round (new) and
+the rest (old), add sampled reverse neighbors to both, and mark all neighbors
+as old. */
+static void se2_nndescent_candidates(se2_knn_heap* heaps,
+  igraph_integer_t const n_nodes, se2_candidates* new_cands,
+  se2_candidates* old_cands, igraph_rng_t* rng)
+{
+  igraph_vector_int_null(&new_cands->n_reverse);
+  igraph_vector_int_null(&old_cands->n_reverse);
+
+  for (igraph_integer_t node_id = 0; node_id < n_nodes; node_id++) {
+    se2_knn_heap* heap = &heaps[node_id];
+    igraph_integer_t* new_ids = se2_candidates_of(new_cands, node_id);
+    igraph_integer_t* old_ids = se2_candidates_of(old_cands, node_id);
+    igraph_integer_t n_new = 0;
+    igraph_integer_t n_old = 0;
+
+    for (igraph_integer_t i = 0; i < heap->size; i++) {
+      if (heap->flags[i]) {
+        new_ids[n_new++] = heap->ids[i];
+        heap->flags[i] = false;
+      } else {
+        old_ids[n_old++] = heap->ids[i];
+      }
+    }
+
+    VECTOR(new_cands->size)[node_id] = n_new;
+    VECTOR(old_cands->size)[node_id] = n_old;
+  }
+
+  for (igraph_integer_t node_id = 0; node_id < n_nodes; node_id++) {
+    igraph_integer_t const* new_ids = se2_candidates_of(new_cands, node_id);
+    igraph_integer_t const* old_ids = se2_candidates_of(old_cands, node_id);
+
+    for (igraph_integer_t i = 0; i < VECTOR(new_cands->size)[node_id]; i++) {
+      se2_candidates_add_reverse(new_cands, new_ids[i], node_id, rng);
+    }
+
+    for (igraph_integer_t i = 0; i < VECTOR(old_cands->size)[node_id]; i++) {
+      se2_candidates_add_reverse(old_cands, old_ids[i], node_id, rng);
+    }
+  }
+
+  for (igraph_integer_t node_id = 0; node_id < n_nodes; node_id++) {
+    se2_candidates_merge(new_cands, node_id);
+    se2_candidates_merge(old_cands, node_id);
+  }
+}
+
+/* One round of local joins over all nodes. Returns the number of heap
+updates in n_updates. */
+static igraph_error_t se2_nndescent_round(igraph_matrix_t const* mat,
+  se2_knn_heap* heaps, se2_candidates const* new_cands,
+  se2_candidates const* old_cands, igraph_integer_t const n_threads,
+  igraph_integer_t* n_updates)
+{
+  igraph_integer_t const n_nodes = igraph_matrix_ncol(mat);
+  igraph_vector_int_t offsets;
+  igraph_vector_t dists;
+
+  IGRAPH_CHECK(igraph_vector_int_init(&offsets, 0));
+  IGRAPH_FINALLY(igraph_vector_int_destroy, &offsets);
+  IGRAPH_CHECK(igraph_vector_init(&dists, 0));
+  IGRAPH_FINALLY(igraph_vector_destroy, &dists);
+
+  *n_updates = 0;
+  igraph_integer_t start = 0;
+  while (start < n_nodes) {
+    igraph_integer_t end = start;
+    igraph_integer_t n_pairs = 0;
+
+    igraph_vector_int_clear(&offsets);
+    do {
+      IGRAPH_CHECK(igraph_vector_int_push_back(&offsets, n_pairs));
+      n_pairs += se2_nndescent_n_pairs(new_cands, old_cands, end);
+      end++;
+    } while ((end < n_nodes) && (n_pairs < SE2_NNDESCENT_PAIR_BUDGET));
+    IGRAPH_CHECK(igraph_vector_resize(&dists, n_pairs));
+
+    struct nndescent_chunk chunk = {
+      .mat = mat,
+      .new_cands = new_cands,
+      .old_cands = old_cands,
+      .start = start,
+      .n_nodes = end - start,
+      .offsets = VECTOR(offsets),
+      .dists = VECTOR(dists),
+    };
+
+    IGRAPH_CHECK(se2_nndescent_run_chunk(&chunk, n_threads));
+    *n_updates += se2_nndescent_apply(&chunk, heaps);
+
+    start = end;
+    IGRAPH_ALLOW_INTERRUPTION();
+  }
+
+  igraph_vector_destroy(&dists);
+  igraph_vector_int_destroy(&offsets);
+  IGRAPH_FINALLY_CLEAN(2);
+
+  return IGRAPH_SUCCESS;
+}
+
+/* Approximate the k nearest columns of every column of mat. Writes the
+results in the same layout as the exact search: the neighbors of column i are
+the second members of edges k * i to k * (i + 1) in ascending order of
+similarity and weights holds the matching inverse euclidean distances. */
+igraph_error_t se2_knn_nndescent(igraph_matrix_t const* mat,
+  igraph_integer_t const k, se2_knn_options const* opts,
+  igraph_vector_int_t* edges, igraph_vector_t* weights)
+{
+  igraph_integer_t const n_nodes = igraph_matrix_ncol(mat);
+  igraph_integer_t const n_rows = igraph_matrix_nrow(mat);
+  igraph_integer_t list_len =
+    k > SE2_NNDESCENT_MIN_LIST ? k : SE2_NNDESCENT_MIN_LIST;
+  list_len = list_len < n_nodes ? list_len : n_nodes - 1;
+  igraph_integer_t const max_iterations = opts->max_iterations > 0 ?
+                                            opts->max_iterations :
+                                            SE2_NNDESCENT_DEFAULT_ITERATIONS;
+  igraph_real_t const tolerance = opts->tolerance > 0 ?
+                                    opts->tolerance :
+                                    SE2_NNDESCENT_DEFAULT_TOLERANCE;
+  igraph_vector_t keys;
+  igraph_vector_int_t ids;
+  igraph_vector_bool_t flags;
+  se2_candidates new_cands, old_cands;
+  igraph_rng_t rng;
+
+  IGRAPH_CHECK(igraph_rng_init(&rng, &igraph_rngtype_mt19937));
+  IGRAPH_FINALLY(igraph_rng_destroy, &rng);
+  IGRAPH_CHECK(igraph_rng_seed(&rng, opts->random_seed));
+
+  IGRAPH_CHECK(igraph_vector_init(&keys, n_nodes * list_len));
+  IGRAPH_FINALLY(igraph_vector_destroy, &keys);
+  IGRAPH_CHECK(igraph_vector_int_init(&ids, n_nodes * list_len));
+  IGRAPH_FINALLY(igraph_vector_int_destroy, &ids);
+  IGRAPH_CHECK(igraph_vector_bool_init(&flags, n_nodes * list_len));
+  IGRAPH_FINALLY(igraph_vector_bool_destroy, &flags);
+
+  se2_knn_heap* heaps = malloc(sizeof(*heaps) * n_nodes);
+  IGRAPH_CHECK_OOM(heaps, "Out of memory.");
+  IGRAPH_FINALLY(free, heaps);
+
+  IGRAPH_CHECK(se2_candidates_init(&new_cands, n_nodes, list_len));
+  IGRAPH_FINALLY(se2_candidates_destroy, &new_cands);
+  IGRAPH_CHECK(se2_candidates_init(&old_cands, n_nodes, list_len));
+  IGRAPH_FINALLY(se2_candidates_destroy, &old_cands);
+
+  // Start from k random neighbors per node.
+  for (igraph_integer_t node_id = 0; node_id < n_nodes; node_id++) {
+    se2_knn_heap* heap = &heaps[node_id];
+    igraph_real_t const* col = &MATRIX(*mat, 0, node_id);
+    se2_knn_heap_init(heap, VECTOR(keys) + (node_id * list_len),
+      VECTOR(ids) + (node_id * list_len), VECTOR(flags) + (node_id * list_len),
+      list_len);
+
+    while (heap->size < list_len) {
+      igraph_integer_t const neigh =
+        igraph_rng_get_integer(&rng, 0, n_nodes - 1);
+      if (neigh != node_id) {
+        se2_knn_heap_push_unique(heap,
+          se2_sq_dist(col, &MATRIX(*mat, 0, neigh), n_rows), neigh);
+      }
+    }
+  }
+
+  for (igraph_integer_t iter = 0; iter < max_iterations; iter++) {
+    igraph_integer_t n_updates;
+    se2_nndescent_candidates(heaps, n_nodes, &new_cands, &old_cands, &rng);
+    IGRAPH_CHECK(se2_nndescent_round(
+      mat, heaps, &new_cands, &old_cands, opts->max_threads, &n_updates));
+
+    if (n_updates <= (tolerance * n_nodes * list_len)) {
+      break;
+    }
+  }
+
+  for (igraph_integer_t node_id = 0; node_id < n_nodes; node_id++) {
+    se2_knn_heap* heap = &heaps[node_id];
+    igraph_integer_t* col_edges = VECTOR(*edges) + (2 * node_id * k);
+
+    // Closest first after sorting, output is closest last.
+    se2_knn_heap_sort(heap);
+    for (igraph_integer_t i = 0; i < k; i++) {
+      col_edges[(2 * i) + 1] = heap->ids[k - 1 - i];
+      if (weights) {
+        VECTOR(*weights)[(node_id * k) + i] = 1 / sqrt(heap->keys[k - 1 - i]);
+      }
+    }
+  }
+
+  se2_candidates_destroy(&old_cands);
+  se2_candidates_destroy(&new_cands);
+  free(heaps);
+  igraph_vector_bool_destroy(&flags);
+  igraph_vector_int_destroy(&ids);
+  igraph_vector_destroy(&keys);
+  igraph_rng_destroy(&rng);
+  IGRAPH_FINALLY_CLEAN(7);
+
+  return IGRAPH_SUCCESS;
+}
@@ -0,0 +1,28 @@
+/* Copyright 2024 David R. Connell <david32@dcon.addy.io>.
+ *
+ * This file is part of SpeakEasy 2.
+ *
+ * SpeakEasy 2 is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * SpeakEasy 2 is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with SpeakEasy 2. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef SE2_KNN_NNDESCENT_H
+#define SE2_KNN_NNDESCENT_H
+
+#include <speak_easy_2.h>
+
+igraph_error_t se2_knn_nndescent(igraph_matrix_t const* mat,
+  igraph_integer_t const k, se2_knn_options const* opts,
+  igraph_vector_int_t* edges, igraph_vector_t* weights);
+
+#endif
@@ -0,0 +1,153 @@
+/* Copyright 2024 David R. Connell <david32@dcon.addy.io>.
+ *
+ * This file is part of SpeakEasy 2.
+ *
+ * SpeakEasy 2 is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * SpeakEasy 2 is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with SpeakEasy 2. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "se2_knn_projection.h"
+
+#ifdef SE2PAR
+# include <pthread.h>
+#endif
+
+/* Johnson-Lindenstrauss random projection. Multiplying the columns by a
+target_dim x n_rows matrix of independent N(0, 1 / target_dim) entries keeps
+the distances between columns within a small relative error with high
+probability, so neighbors can be searched for in far fewer dimensions. */
+
+// Number of consecutive columns a thread projects at a time.
+#define SE2_PROJECTION_BLOCK 64
+
+struct projection_params {
+  igraph_integer_t tid;
+  igraph_integer_t n_threads;
+  igraph_matrix_t const* mat;
+  igraph_matrix_t const* projection;
+  igraph_matrix_t* res;
+};
+
+static void* se2_thread_project(void* parameters)
+{
+  struct projection_params const* p = (struct projection_params*)parameters;
+  igraph_integer_t const n_rows = igraph_matrix_nrow(p->mat);
+  igraph_integer_t const n_cols = igraph_matrix_ncol(p->mat);
+  igraph_integer_t const target_dim = igraph_matrix_nrow(p->projection);
+
+  for (igraph_integer_t start = p->tid * SE2_PROJECTION_BLOCK; start < n_cols;
+       start += p->n_threads * SE2_PROJECTION_BLOCK) {
+    igraph_integer_t const end = start + SE2_PROJECTION_BLOCK < n_cols ?
+                                   start + SE2_PROJECTION_BLOCK :
+                                   n_cols;
+    for (igraph_integer_t col = start; col < end; col++) {
+      igraph_real_t const* restrict x = &MATRIX(*p->mat, 0, col);
+      igraph_real_t* restrict y = &MATRIX(*p->res, 0, col);
+
+      // Sum of the projection's columns weighted by x, contiguous in both.
+      for (igraph_integer_t i = 0; i < n_rows; i++) {
+        igraph_real_t const* restrict r = &MATRIX(*p->projection, 0, i);
+        igraph_real_t const el = x[i];
+        for (igraph_integer_t j = 0; j < target_dim; j++) {
+          y[j] += el * r[j];
+        }
+      }
+    }
+  }
+
+  return NULL;
+}
+
+/* Project the columns of mat down to target_dim rows. The projection only
+depends on random_seed and the shape of mat, not on the number of threads.
+res is initialized here. */
+igraph_error_t se2_knn_project(igraph_matrix_t const* mat,
+  igraph_integer_t const target_dim, igraph_integer_t const random_seed,
+  igraph_integer_t n_threads, igraph_matrix_t* res)
+{
+  igraph_integer_t const n_rows = igraph_matrix_nrow(mat);
+  igraph_integer_t const n_cols = igraph_matrix_ncol(mat);
+  igraph_integer_t const n_blocks =
+    (n_cols + SE2_PROJECTION_BLOCK - 1) / SE2_PROJECTION_BLOCK;
+  igraph_real_t const sd = 1 / sqrt((igraph_real_t)target_dim);
+  igraph_matrix_t projection;
+  igraph_rng_t rng;
+
+#ifndef SE2PAR
+  n_threads = 1;
+#endif
+
+  if (n_threads > n_blocks) {
+    n_threads = n_blocks;
+  }
+
+  IGRAPH_CHECK(igraph_matrix_init(&projection, target_dim, n_rows));
+  IGRAPH_FINALLY(igraph_matrix_destroy, &projection);
+
+  IGRAPH_CHECK(igraph_rng_init(&rng, &igraph_rngtype_mt19937));
+  IGRAPH_FINALLY(igraph_rng_destroy, &rng);
+  IGRAPH_CHECK(igraph_rng_seed(&rng, random_seed));
+
+  for (igraph_integer_t i = 0; i < n_rows; i++) {
+    for (igraph_integer_t j = 0; j < target_dim; j++) {
+      MATRIX(projection, j, i) = igraph_rng_get_normal(&rng, 0, sd);
+    }
+  }
+
+  igraph_rng_destroy(&rng);
+  IGRAPH_FINALLY_CLEAN(1);
+
+  IGRAPH_CHECK(igraph_matrix_init(res, target_dim, n_cols));
+  IGRAPH_FINALLY(igraph_matrix_destroy, res);
+
+  struct projection_params* args = malloc(sizeof(*args) * n_threads);
+  IGRAPH_CHECK_OOM(args, "Out of memory.");
+  IGRAPH_FINALLY(free, args);
+
+#ifdef SE2PAR
+  pthread_t* threads = malloc(sizeof(*threads) * n_threads);
+  IGRAPH_CHECK_OOM(threads, "Out of memory.");
+  IGRAPH_FINALLY(free, threads);
+#endif
+
+  for (igraph_integer_t tid = 0; tid < n_threads; tid++) {
+    args[tid].tid = tid;
+    args[tid].n_threads = n_threads;
+    args[tid].mat = mat;
+    args[tid].projection = &projection;
+    args[tid].res = res;
+
+#ifdef SE2PAR
+    pthread_create(&threads[tid], NULL, se2_thread_project, (void*)&args[tid]);
+#else
+    se2_thread_project((void*)&args[tid]);
+#endif
+  }
+
+#ifdef SE2PAR
+  for (igraph_integer_t tid = 0; tid < n_threads; tid++) {
+    pthread_join(threads[tid], NULL);
+  }
+
+  free(threads);
+  IGRAPH_FINALLY_CLEAN(1);
+#endif
+
+  free(args);
+  IGRAPH_FINALLY_CLEAN(2);
+
+  igraph_matrix_destroy(&projection);
+  IGRAPH_FINALLY_CLEAN(1);
+
+  return IGRAPH_SUCCESS;
+}
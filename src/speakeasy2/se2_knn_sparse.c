@@ -0,0 +1,427 @@
+/* Copyright 2024 David R. Connell <david32@dcon.addy.io>.
+ *
+ * This file is part of SpeakEasy 2.
+ *
+ * SpeakEasy 2 is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * SpeakEasy 2 is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with SpeakEasy 2. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "se2_knn_sparse.h"
+
+#include "se2_knn_heap.h"
+
+#include <float.h>
+
+#ifdef SE2PAR
+# include <pthread.h>
+#endif
+
+/* Exact kNN search for sparse columns. The dot products between a query and
+every other column are accumulated through a row-major copy of the matrix so
+only pairs of stored values sharing a row are ever multiplied. Columns are
+then ranked with the same keys as the dense search would use so the same
+neighbors are found without densifying the input. Euclidean keys are only used
+to screen candidates, as in the dense search. */
+
+// Number of consecutive queries a thread handles at a time.
+#define SE2_SPARSE_QUERY_BLOCK 64
+
+/* Row-major copy of the matrix and the per-column statistics needed to turn
+dot products into distances or similarities. For cosine and Pearson, sim(a, b)
+= (a.b - n_rows * mean_a * mean_b) / (norm_a * norm_b), where the means are 0
+for cosine. For euclidean, norm is the column's length. */
+typedef struct {
+  se2_csc_matrix const* mat;
+  se2_knn_metric metric;
+  igraph_vector_int_t row_ptr;
+  igraph_vector_int_t row_cols;
+  igraph_vector_t row_values;
+  igraph_vector_t mean;
+  igraph_vector_t norm;
+} se2_sparse_index;
+
+static void se2_sparse_index_destroy(se2_sparse_index* index)
+{
+  igraph_vector_int_destroy(&index->row_ptr);
+  igraph_vector_int_destroy(&index->row_cols);
+  igraph_vector_destroy(&index->row_values);
+  igraph_vector_destroy(&index->mean);
+  igraph_vector_destroy(&index->norm);
+}
+
+static igraph_error_t se2_sparse_index_init(se2_sparse_index* index,
+  se2_csc_matrix const* mat, se2_knn_metric const metric)
+{
+  igraph_integer_t const n_rows = mat->n_rows;
+  igraph_integer_t const n_cols = mat->n_cols;
+  igraph_integer_t const nnz = mat->col_ptr[n_cols];
+
+  index->mat = mat;
+  index->metric = metric;
+
+  IGRAPH_CHECK(igraph_vector_int_init(&index->row_ptr, n_rows + 1));
+  IGRAPH_FINALLY(igraph_vector_int_destroy, &index->row_ptr);
+  IGRAPH_CHECK(igraph_vector_int_init(&index->row_cols, nnz));
+  IGRAPH_FINALLY(igraph_vector_int_destroy, &index->row_cols);
+  IGRAPH_CHECK(igraph_vector_init(&index->row_values, nnz));
+  IGRAPH_FINALLY(igraph_vector_destroy, &index->row_values);
+  IGRAPH_CHECK(igraph_vector_init(&index->mean, n_cols));
+  IGRAPH_FINALLY(igraph_vector_destroy, &index->mean);
+  IGRAPH_CHECK(igraph_vector_init(&index->norm, n_cols));
+  IGRAPH_FINALLY(igraph_vector_destroy, &index->norm);
+
+  igraph_integer_t* row_ptr = VECTOR(index->row_ptr);
+  for (igraph_integer_t i = 0; i < nnz; i++) {
+    row_ptr[mat->row_idx[i] + 1]++;
+  }
+
+  for (igraph_integer_t i = 0; i < n_rows; i++) {
+    row_ptr[i + 1] += row_ptr[i];
+  }
+
+  // Filling columns in order keeps each row's columns sorted.
+  for (igraph_integer_t j = 0; j < n_cols; j++) {
+    for (igraph_integer_t i = mat->col_ptr[j]; i < mat->col_ptr[j + 1]; i++) {
+      igraph_integer_t const pos = row_ptr[mat->row_idx[i]]++;
+      VECTOR(index->row_cols)[pos] = j;
+      VECTOR(index->row_values)[pos] = mat->values[i];
+    }
+  }
+
+  // Filling advanced each row's start to the next row's start.
+  for (igraph_integer_t i = n_rows; i > 0; i--) {
+    row_ptr[i] = row_ptr[i - 1];
+  }
+  row_ptr[0] = 0;
+
+  for (igraph_integer_t j = 0; j < n_cols; j++) {
+    igraph_integer_t const start = mat->col_ptr[j];
+    igraph_integer_t const end = mat->col_ptr[j + 1];
+    igraph_real_t mean = 0;
+
+    if (metric == SE2_KNN_PEARSON) {
+      for (igraph_integer_t i = start; i < end; i++) {
+        mean += mat->values[i];
+      }
+      mean /= n_rows;
+    }
+
+    // Unstored values are 0 so each contributes mean^2.
+    igraph_real_t sum_sq = (n_rows - (end - start)) * mean * mean;
+    for (igraph_integer_t i = start; i < end; i++) {
+      igraph_real_t const el = mat->values[i] - mean;
+      sum_sq += el * el;
+    }
+
+    VECTOR(index->mean)[j] = mean;
+    VECTOR(index->norm)[j] = sqrt(sum_sq);
+  }
+
+  IGRAPH_FINALLY_CLEAN(5);
+
+  return IGRAPH_SUCCESS;
+}
+
+static inline igraph_real_t se2_sparse_similarity(
+  se2_sparse_index const* index, igraph_integer_t const a,
+  igraph_integer_t const b, igraph_real_t const dot)
+{
+  igraph_real_t const norm_a = VECTOR(index->norm)[a];
+  igraph_real_t const norm_b = VECTOR(index->norm)[b];
+  if ((norm_a == 0) || (norm_b == 0)) {
+    return 0;
+  }
+
+  return (dot - (index->mat->n_rows * VECTOR(index->mean)[a] *
+                  VECTOR(index->mean)[b])) /
+         (norm_a * norm_b);
+}
+
+/* Ranking key matching the dense search. Cosine and Pearson columns are
+compared by their distance after scaling to unit length, where columns that
+cannot be scaled are left as 0. */
+static inline igraph_real_t se2_sparse_key(se2_sparse_index const* index,
+  igraph_integer_t const a, igraph_integer_t const b, igraph_real_t const dot)
+{
+  igraph_real_t const norm_a = VECTOR(index->norm)[a];
+  igraph_real_t const norm_b = VECTOR(index->norm)[b];
+
+  if (index->metric == SE2_KNN_EUCLIDEAN) {
+    return (norm_a * norm_a) + (norm_b * norm_b) - (2 * dot);
+  }
+
+  return (norm_a > 0) + (norm_b > 0) -
+         (2 * se2_sparse_similarity(index, a, b, dot));
+}
+
+/* Squared euclidean distance between two columns by merging their stored
+values. */
+static igraph_real_t se2_sparse_sq_dist(se2_csc_matrix const* mat,
+  igraph_integer_t const a, igraph_integer_t const b)
+{
+  igraph_integer_t i = mat->col_ptr[a];
+  igraph_integer_t j = mat->col_ptr[b];
+  igraph_integer_t const end_a = mat->col_ptr[a + 1];
+  igraph_integer_t const end_b = mat->col_ptr[b + 1];
+  igraph_real_t out = 0;
+
+  while ((i < end_a) || (j < end_b)) {
+    igraph_real_t el;
+    if ((j == end_b) ||
+        ((i < end_a) && (mat->row_idx[i] < mat->row_idx[j]))) {
+      el = mat->values[i++];
+    } else if ((i == end_a) || (mat->row_idx[j] < mat->row_idx[i])) {
+      el = mat->values[j++];
+    } else {
+      el = mat->values[i++] - mat->values[j++];
+    }
+    out += el * el;
+  }
+
+  return out;
+}
+
+/* Dot product of two columns by merging their stored values. */
+static igraph_real_t se2_sparse_dot(se2_csc_matrix const* mat,
+  igraph_integer_t const a, igraph_integer_t const b)
+{
+  igraph_integer_t i = mat->col_ptr[a];
+  igraph_integer_t j = mat->col_ptr[b];
+  igraph_integer_t const end_a = mat->col_ptr[a + 1];
+  igraph_integer_t const end_b = mat->col_ptr[b + 1];
+  igraph_real_t out = 0;
+
+  while ((i < end_a) && (j < end_b)) {
+    if (mat->row_idx[i] < mat->row_idx[j]) {
+      i++;
+    } else if (mat->row_idx[j] < mat->row_idx[i]) {
+      j++;
+    } else {
+      out += mat->values[i++] * mat->values[j++];
+    }
+  }
+
+  return out;
+}
+
+struct sparse_params {
+  igraph_integer_t tid;
+  igraph_integer_t n_threads;
+  igraph_integer_t k;
+  se2_sparse_index const* index;
+  igraph_real_t* dots;
+  igraph_real_t* keys;
+  igraph_integer_t* ids;
+  igraph_vector_int_t* edges;
+  igraph_vector_t* similarities;
+};
+
+static void se2_sparse_query(struct sparse_params const* p,
+  igraph_integer_t const col, se2_knn_heap* heap)
+{
+  se2_sparse_index const* index = p->index;
+  se2_csc_matrix const* mat = index->mat;
+  igraph_integer_t const* row_ptr = VECTOR(index->row_ptr);
+  igraph_integer_t const* row_cols = VECTOR(index->row_cols);
+  igraph_real_t const* row_values = VECTOR(index->row_values);
+  igraph_real_t* dots = p->dots;
+  igraph_real_t const tol = 4 * (mat->n_rows + 2) * DBL_EPSILON;
+
+  for (igraph_integer_t i = mat->col_ptr[col]; i < mat->col_ptr[col + 1];
+       i++) {
+    igraph_integer_t const row = mat->row_idx[i];
+    igraph_real_t const val = mat->values[i];
+    for (igraph_integer_t j = row_ptr[row]; j < row_ptr[row + 1]; j++) {
+      dots[row_cols[j]] += val * row_values[j];
+    }
+  }
+
+  se2_knn_heap_init(heap, p->keys, p->ids, NULL, p->k);
+  for (igraph_integer_t ref = 0; ref < mat->n_cols; ref++) {
+    igraph_real_t const dot = dots[ref];
+    dots[ref] = 0;
+    if (ref == col) {
+      continue;
+    }
+
+    igraph_real_t key = se2_sparse_key(index, col, ref, dot);
+    if (index->metric == SE2_KNN_EUCLIDEAN) {
+      // As in the dense search, the key only screens candidates.
+      igraph_real_t const norms =
+        (VECTOR(index->norm)[col] * VECTOR(index->norm)[col]) +
+        (VECTOR(index->norm)[ref] * VECTOR(index->norm)[ref]);
+      if (key - (tol * norms) > se2_knn_heap_bound(heap)) {
+        continue;
+      }
+
+      key = se2_sparse_sq_dist(mat, col, ref);
+    }
+
+    if (se2_knn_heap_accepts(heap, key, ref)) {
+      se2_knn_heap_push(heap, key, ref);
+    }
+  }
+}
+
+static void* se2_thread_sparse(void* parameters)
+{
+  struct sparse_params const* p = (struct sparse_params*)parameters;
+  se2_sparse_index const* index = p->index;
+  se2_csc_matrix const* mat = index->mat;
+  igraph_integer_t const n_cols = mat->n_cols;
+  igraph_integer_t const k = p->k;
+  se2_knn_heap heap;
+
+  for (igraph_integer_t q_start = p->tid * SE2_SPARSE_QUERY_BLOCK;
+       q_start < n_cols; q_start += p->n_threads * SE2_SPARSE_QUERY_BLOCK) {
+    igraph_integer_t const q_end = q_start + SE2_SPARSE_QUERY_BLOCK < n_cols ?
+                                     q_start + SE2_SPARSE_QUERY_BLOCK :
+                                     n_cols;
+    for (igraph_integer_t col = q_start; col < q_end; col++) {
+      igraph_integer_t* col_edges = VECTOR(*p->edges) + (2 * col * k);
+      igraph_real_t* col_sims = VECTOR(*p->similarities) + (col * k);
+
+      se2_sparse_query(p, col, &heap);
+
+      // Closest first after sorting, output is closest last.
+      se2_knn_heap_sort(&heap);
+      for (igraph_integer_t i = 0; i < k; i++) {
+        igraph_integer_t const neigh = heap.ids[k - 1 - i];
+        col_edges[(2 * i) + 1] = neigh;
+        if (index->metric == SE2_KNN_EUCLIDEAN) {
+          col_sims[i] = 1 / sqrt(se2_sparse_sq_dist(mat, col, neigh));
+        } else {
+          col_sims[i] = se2_sparse_similarity(
+            index, col, neigh, se2_sparse_dot(mat, col, neigh));
+        }
+      }
+    }
+  }
+
+  return NULL;
+}
+
+static igraph_error_t se2_sparse_validate(se2_csc_matrix const* mat)
+{
+  if ((mat->n_rows < 0) || (mat->n_cols < 0) || (mat->col_ptr[0] != 0)) {
+    IGRAPH_ERROR("Invalid sparse matrix dimensions.", IGRAPH_EINVAL);
+  }
+
+  for (igraph_integer_t j = 0; j < mat->n_cols; j++) {
+    if (mat->col_ptr[j + 1] < mat->col_ptr[j]) {
+      IGRAPH_ERROR("Sparse matrix column pointers must be non-decreasing.",
+        IGRAPH_EINVAL);
+    }
+
+    for (igraph_integer_t i = mat->col_ptr[j]; i < mat->col_ptr[j + 1];
+         i++) {
+      igraph_integer_t const row = mat->row_idx[i];
+      if ((row < 0) || (row >= mat->n_rows)) {
+        IGRAPH_ERROR("Sparse matrix row index out of range.", IGRAPH_EINVAL);
+      }
+
+      if ((i > mat->col_ptr[j]) && (row <= mat->row_idx[i - 1])) {
+        IGRAPH_ERROR("Sparse matrix row indices must be strictly increasing "
+                     "within each column.",
+          IGRAPH_EINVAL);
+      }
+    }
+  }
+
+  return IGRAPH_SUCCESS;
+}
+
+/* Find the exact k nearest columns of every column of a sparse matrix. The
+neighbors are written in the same layout as the dense search, similarities
+holds their similarity under metric (the inverse euclidean distance for
+SE2_KNN_EUCLIDEAN) but columns may still need to be sorted by it to correct
+for rounding in the ranking keys. */
+igraph_error_t se2_knn_sparse(se2_csc_matrix const* mat,
+  igraph_integer_t const k, se2_knn_metric const metric,
+  igraph_integer_t n_threads, igraph_vector_int_t* edges,
+  igraph_vector_t* similarities)
+{
+  igraph_integer_t const n_cols = mat->n_cols;
+  igraph_integer_t const n_blocks =
+    (n_cols + SE2_SPARSE_QUERY_BLOCK - 1) / SE2_SPARSE_QUERY_BLOCK;
+  se2_sparse_index index;
+  igraph_vector_t dots;
+  igraph_vector_t keys;
+  igraph_vector_int_t ids;
+
+#ifndef SE2PAR
+  n_threads = 1;
+#endif
+
+  if (n_threads > n_blocks) {
+    n_threads = n_blocks;
+  }
+
+  IGRAPH_CHECK(se2_sparse_validate(mat));
+
+  IGRAPH_CHECK(se2_sparse_index_init(&index, mat, metric));
+  IGRAPH_FINALLY(se2_sparse_index_destroy, &index);
+
+  IGRAPH_CHECK(igraph_vector_init(&dots, n_threads * n_cols));
+  IGRAPH_FINALLY(igraph_vector_destroy, &dots);
+  IGRAPH_CHECK(igraph_vector_init(&keys, n_threads * k));
+  IGRAPH_FINALLY(igraph_vector_destroy, &keys);
+  IGRAPH_CHECK(igraph_vector_int_init(&ids, n_threads * k));
+  IGRAPH_FINALLY(igraph_vector_int_destroy, &ids);
+
+  struct sparse_params* args = malloc(sizeof(*args) * n_threads);
+  IGRAPH_CHECK_OOM(args, "Out of memory.");
+  IGRAPH_FINALLY(free, args);
+
+#ifdef SE2PAR
+  pthread_t* threads = malloc(sizeof(*threads) * n_threads);
+  IGRAPH_CHECK_OOM(threads, "Out of memory.");
+  IGRAPH_FINALLY(free, threads);
+#endif
+
+  for (igraph_integer_t tid = 0; tid < n_threads; tid++) {
+    args[tid].tid = tid;
+    args[tid].n_threads = n_threads;
+    args[tid].k = k;
+    args[tid].index = &index;
+    args[tid].dots = VECTOR(dots) + (tid * n_cols);
+    args[tid].keys = VECTOR(keys) + (tid * k);
+    args[tid].ids = VECTOR(ids) + (tid * k);
+    args[tid].edges = edges;
+    args[tid].similarities = similarities;
+
+#ifdef SE2PAR
+    pthread_create(&threads[tid], NULL, se2_thread_sparse, (void*)&args[tid]);
+#else
+    se2_thread_sparse((void*)&args[tid]);
+#endif
+  }
+
+#ifdef SE2PAR
+  for (igraph_integer_t tid = 0; tid < n_threads; tid++) {
+    pthread_join(threads[tid], NULL);
+  }
+
+  free(threads);
+  IGRAPH_FINALLY_CLEAN(1);
+#endif
+
+  free(args);
+  igraph_vector_int_destroy(&ids);
+  igraph_vector_destroy(&keys);
+  igraph_vector_destroy(&dots);
+  se2_sparse_index_destroy(&index);
+  IGRAPH_FINALLY_CLEAN(5);
+
+  return IGRAPH_SUCCESS;
+}
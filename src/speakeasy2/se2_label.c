@@ -64,18 +64,41 @@ igraph_error_t se2_find_most_specific_labels_i(se2_neighs const* graph,
   while ((node_id = se2_iterator_next(node_iter)) != -1) {
     igraph_real_t const norm_factor = kin[node_id] * total_weight_inv;
     igraph_integer_t const n_neighbors = N_NEIGHBORS(*graph, node_id);
-    igraph_integer_t const* neighbors =
-      graph->neigh_list ? VECTOR(VECTOR(*graph->neigh_list)[node_id]) : NULL;
-    igraph_real_t const* weights =
-      HASWEIGHTS(*graph) ? VECTOR(VECTOR(*graph->weights)[node_id]) : NULL;
 
     for (igraph_integer_t label_id = 0; label_id < n_labels; label_id++) {
       scores[label_id] = -global_heard[label_id] * norm_factor;
     }
 
-    for (igraph_integer_t i = 0; i < n_neighbors; i++) {
-      scores[labels[neighbors ? neighbors[i] : i]] +=
-        weights ? weights[i] : 1.0;
+    if (ISVIEW(*graph)) {
+      for (igraph_integer_t i = 0; i < n_neighbors; i++) {
+        igraph_integer_t const neigh = NEIGHBOR(*graph, node_id, i);
+        if (neigh != -1) {
+          scores[labels[neigh]] += WEIGHT(*graph, node_id, i);
+        }
+      }
+    } else if (ISPACKED(*graph)) {
+      se2_packed_add_row(graph, node_id, labels, scores);
+    } else if (ISCOMPACT(*graph)) {
+      se2_compact_add_row(graph, node_id, labels, scores);
+    } else if (ISCOMPRESSED(*graph)) {
+      se2_compressed_add_row(graph, node_id, labels, scores);
+    } else if (ISLAZY(*graph)) {
+      // Dense, so the neighbor is i.
+      se2_lazy_weights const* lazy = graph->borrowed->lazy;
+      igraph_real_t const* weights = VECTOR(WEIGHTS_IN(*graph, node_id));
+      for (igraph_integer_t i = 0; i < n_neighbors; i++) {
+        scores[labels[i]] +=
+          se2_lazy_weight(lazy, node_id, weights[i], i == node_id);
+      }
+    } else {
+      igraph_integer_t const* neighbors =
+        ISSPARSE(*graph) ? VECTOR(NEIGHBORS(*graph, node_id)) : NULL;
+      igraph_real_t const* weights =
+        HASWEIGHTS(*graph) ? VECTOR(WEIGHTS_IN(*graph, node_id)) : NULL;
+      for (igraph_integer_t i = 0; i < n_neighbors; i++) {
+        scores[labels[neighbors ? neighbors[i] : i]] +=
+          weights ? weights[i] : 1.0;
+      }
     }
 
     igraph_integer_t best_label = 0;
@@ -282,8 +305,13 @@ static igraph_error_t se2_best_merges(se2_neighs const* graph,
 
   for (igraph_integer_t i = 0; i < se2_vcount(graph); i++) {
     for (igraph_integer_t j = 0; j < N_NEIGHBORS(*graph, i); j++) {
-      MATRIX(crosstalk, LABEL(*partition)[NEIGHBOR(*graph, i, j)],
-        LABEL(*partition)[i]) += WEIGHT(*graph, i, j);
+      igraph_integer_t const neigh = NEIGHBOR(*graph, i, j);
+      if (neigh == -1) {
+        continue;
+      }
+
+      MATRIX(crosstalk, LABEL(*partition)[neigh], LABEL(*partition)[i]) +=
+        WEIGHT(*graph, i, j);
     }
   }
 
@@ -0,0 +1,126 @@
+/* Copyright 2024 David R. Connell <david32@dcon.addy.io>.
+ *
+ * This file is part of SpeakEasy 2.
+ *
+ * SpeakEasy 2 is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * SpeakEasy 2 is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with SpeakEasy 2. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "se2_mapped_file.h"
+
+#ifndef _WIN32
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
+
+void se2_mapped_file_close(se2_mapped_file* file)
+{
+#ifdef _WIN32
+  CloseHandle(file->mapping);
+  CloseHandle(file->file);
+#else
+  close(file->fd);
+#endif
+}
+
+igraph_error_t se2_mapped_file_open(se2_mapped_file* file, char const* path)
+{
+#ifdef _WIN32
+  SYSTEM_INFO info;
+  LARGE_INTEGER size;
+
+  file->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+    OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file->file == INVALID_HANDLE_VALUE) {
+    IGRAPH_ERRORF("Could not open \"%s\".", IGRAPH_EFILE, path);
+  }
+
+  if (!GetFileSizeEx(file->file, &size)) {
+    CloseHandle(file->file);
+    IGRAPH_ERRORF("Could not get the size of \"%s\".", IGRAPH_EFILE, path);
+  }
+
+  file->mapping =
+    CreateFileMappingA(file->file, NULL, PAGE_READONLY, 0, 0, NULL);
+  if (!file->mapping) {
+    CloseHandle(file->file);
+    IGRAPH_ERRORF("Could not map \"%s\".", IGRAPH_EFILE, path);
+  }
+
+  GetSystemInfo(&info);
+  file->size = size.QuadPart;
+  file->granularity = info.dwAllocationGranularity;
+#else
+  struct stat info;
+
+  file->fd = open(path, O_RDONLY);
+  if (file->fd == -1) {
+    IGRAPH_ERRORF("Could not open \"%s\".", IGRAPH_EFILE, path);
+  }
+
+  if (fstat(file->fd, &info) == -1) {
+    close(file->fd);
+    IGRAPH_ERRORF("Could not get the size of \"%s\".", IGRAPH_EFILE, path);
+  }
+
+  file->size = info.st_size;
+  file->granularity = sysconf(_SC_PAGESIZE);
+#endif
+
+  return IGRAPH_SUCCESS;
+}
+
+void se2_mapped_view_destroy(se2_mapped_view* view)
+{
+#ifdef _WIN32
+  UnmapViewOfFile(view->base);
+#else
+  munmap(view->base, view->length);
+#endif
+}
+
+/* Map length bytes of the file starting at byte offset. If sequential, the
+range is expected to be read front to back. */
+igraph_error_t se2_mapped_view_init(se2_mapped_view* view,
+  se2_mapped_file const* file, igraph_integer_t const offset,
+  igraph_integer_t const length, igraph_bool_t const sequential)
+{
+  igraph_integer_t const aligned = offset - (offset % file->granularity);
+
+  view->length = (offset - aligned) + length;
+
+#ifdef _WIN32
+  view->base = MapViewOfFile(file->mapping, FILE_MAP_READ,
+    (DWORD)((uint64_t)aligned >> 32), (DWORD)(aligned & 0xFFFFFFFF),
+    view->length);
+  if (!view->base) {
+    IGRAPH_ERROR("Could not map file.", IGRAPH_EFILE);
+  }
+#else
+  view->base =
+    mmap(NULL, view->length, PROT_READ, MAP_PRIVATE, file->fd, aligned);
+  if (view->base == MAP_FAILED) {
+    IGRAPH_ERROR("Could not map file.", IGRAPH_EFILE);
+  }
+
+  if (sequential) {
+    posix_madvise(view->base, view->length, POSIX_MADV_SEQUENTIAL);
+  }
+#endif
+
+  view->data = (char const*)view->base + (offset - aligned);
+
+  return IGRAPH_SUCCESS;
+}
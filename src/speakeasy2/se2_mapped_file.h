@@ -0,0 +1,57 @@
+/* Copyright 2024 David R. Connell <david32@dcon.addy.io>.
+ *
+ * This file is part of SpeakEasy 2.
+ *
+ * SpeakEasy 2 is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * SpeakEasy 2 is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with SpeakEasy 2. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef SE2_MAPPED_FILE_H
+#define SE2_MAPPED_FILE_H
+
+#include <speak_easy_2.h>
+
+#ifdef _WIN32
+# include <windows.h>
+#endif
+
+/* Read-only memory mapping of files shared by the file readers. */
+
+typedef struct {
+#ifdef _WIN32
+  HANDLE file;
+  HANDLE mapping;
+#else
+  int fd;
+#endif
+  igraph_integer_t size;
+  igraph_integer_t granularity; // Mapping offsets must be a multiple of this.
+} se2_mapped_file;
+
+/* A mapped range of a file. data points to the requested offset, which can
+be after the start of the mapping for alignment. The range stays mapped after
+the file is closed. */
+typedef struct se2_mapped_view {
+  void* base;
+  size_t length;
+  void const* data;
+} se2_mapped_view;
+
+igraph_error_t se2_mapped_file_open(se2_mapped_file* file, char const* path);
+void se2_mapped_file_close(se2_mapped_file* file);
+igraph_error_t se2_mapped_view_init(se2_mapped_view* view,
+  se2_mapped_file const* file, igraph_integer_t const offset,
+  igraph_integer_t const length, igraph_bool_t const sequential);
+void se2_mapped_view_destroy(se2_mapped_view* view);
+
+#endif
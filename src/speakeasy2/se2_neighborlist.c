@@ -18,144 +18,113 @@
 
 #include "se2_neighborlist.h"
 
-#include <speak_easy_2.h>
-
-/* Convert an igraph graph to a list of neighbor lists where the ith vector
-   contains a list of the ith node's neighbors.
+#include "se2_mapped_file.h"
 
-   If the graph is weighted, a weight list will be returned in the same
-   structure as the neighbor list. If the graph is not weighted the two weight
-   arguments should be set to NULL.
+#include <speak_easy_2.h>
 
-   If the graph is directed, the neighbors are the neighbors out from the node.
+/* Create a view of the induced subgraph of parent containing the n_members
+nodes in members. All members must belong to community comm of memb and be
+in ascending order. local_ids maps each parent node to its position in its own
+community.
 
-   When finished the SpeakEasy 2 algorithm no longer needs the graph so it is
-   safe to delete the graph (and it's weight vector) unless they are needed
-   elsewhere.
- */
-igraph_error_t se2_igraph_to_neighbor_list(igraph_t const* graph,
-  igraph_vector_t const* weights, se2_neighs* neigh_list)
+The view borrows memb, local_ids, and members so they must outlive it. */
+igraph_error_t se2_neighs_view_init(se2_neighs* view_graph,
+  se2_neighs const* parent, igraph_integer_t const* memb,
+  igraph_integer_t const* local_ids, igraph_integer_t const comm,
+  igraph_integer_t const* members, igraph_integer_t const n_members)
 {
-  igraph_integer_t const n_nodes = igraph_vcount(graph);
-  igraph_bool_t const directed = igraph_is_directed(graph);
-  igraph_bool_t const is_sparse = igraph_ecount(graph) != (n_nodes * n_nodes);
-
-  neigh_list->n_nodes = n_nodes;
-  neigh_list->total_weight = 0;
-
-  if (is_sparse) {
-    neigh_list->neigh_list = igraph_malloc(sizeof(*neigh_list->neigh_list));
-    IGRAPH_CHECK_OOM(neigh_list->neigh_list, "");
-    IGRAPH_FINALLY(igraph_free, neigh_list->neigh_list);
-    IGRAPH_CHECK(igraph_vector_int_list_init(neigh_list->neigh_list, n_nodes));
-    IGRAPH_FINALLY(igraph_vector_int_list_destroy, neigh_list->neigh_list);
-
-    neigh_list->sizes = igraph_malloc(sizeof(*neigh_list->sizes));
-    IGRAPH_CHECK_OOM(neigh_list->sizes, "");
-    IGRAPH_FINALLY(igraph_free, neigh_list->sizes);
-    IGRAPH_CHECK(igraph_vector_int_init(neigh_list->sizes, n_nodes));
-    IGRAPH_FINALLY(igraph_vector_int_destroy, neigh_list->sizes);
-  } else {
-    neigh_list->neigh_list = NULL;
-    neigh_list->sizes = NULL;
-  }
-
-  neigh_list->kin = igraph_malloc(sizeof(*neigh_list->kin));
-  IGRAPH_CHECK_OOM(neigh_list->kin, "");
-  IGRAPH_FINALLY(igraph_free, neigh_list->kin);
-  IGRAPH_CHECK(igraph_vector_init(neigh_list->kin, n_nodes));
-  IGRAPH_FINALLY(igraph_vector_destroy, neigh_list->kin);
-
-  if (weights) {
-    neigh_list->weights = igraph_malloc(sizeof(*neigh_list->weights));
-    IGRAPH_CHECK_OOM(neigh_list->weights, "");
-    IGRAPH_FINALLY(igraph_free, neigh_list->weights);
-
-    IGRAPH_CHECK(igraph_vector_list_init(neigh_list->weights, n_nodes));
-    IGRAPH_FINALLY(igraph_vector_list_destroy, neigh_list->weights);
-  } else {
-    neigh_list->weights = NULL;
-  }
-
-  if (is_sparse) {
-    for (igraph_integer_t eid = 0; eid < igraph_ecount(graph); eid++) {
-      VECTOR(*neigh_list->sizes)[IGRAPH_FROM(graph, eid)]++;
-      if (!directed) {
-        VECTOR(*neigh_list->sizes)[IGRAPH_TO(graph, eid)]++;
-      }
-    }
-
-    for (igraph_integer_t node_id = 0; node_id < n_nodes; node_id++) {
-      igraph_vector_int_t* neighbors =
-        &VECTOR(*neigh_list->neigh_list)[node_id];
-      IGRAPH_CHECK(igraph_vector_int_resize(
-        neighbors, N_NEIGHBORS(*neigh_list, node_id)));
-    }
+  if (ISVIEW(*parent)) {
+    IGRAPH_ERROR("Cannot create a view of a view.", IGRAPH_EINVAL);
   }
 
-  if (weights) {
-    for (igraph_integer_t node_id = 0; node_id < n_nodes; node_id++) {
-      igraph_vector_t* w = &VECTOR(*neigh_list->weights)[node_id];
-      IGRAPH_CHECK(igraph_vector_resize(w, N_NEIGHBORS(*neigh_list, node_id)));
-    }
-  }
-
-  igraph_vector_int_t neigh_counts;
-  IGRAPH_CHECK(igraph_vector_int_init(&neigh_counts, n_nodes));
-  IGRAPH_FINALLY(igraph_vector_int_destroy, &neigh_counts);
-
-  for (igraph_integer_t eid = 0; eid < igraph_ecount(graph); eid++) {
-    igraph_integer_t const from = IGRAPH_FROM(graph, eid);
-    igraph_integer_t const to = IGRAPH_TO(graph, eid);
-    igraph_integer_t neigh_pos = VECTOR(neigh_counts)[from];
-
-    if (is_sparse) {
-      igraph_vector_int_t* neighbors = &VECTOR(*neigh_list->neigh_list)[from];
-      VECTOR(*neighbors)[neigh_pos] = to;
-    }
-
-    if (weights) {
-      igraph_vector_t* w = &VECTOR(*neigh_list->weights)[from];
-      VECTOR(*w)[neigh_pos] = VECTOR(*weights)[eid];
-      neigh_list->total_weight += VECTOR(*weights)[eid];
-    }
+  se2_view* view = igraph_malloc(sizeof(*view));
+  IGRAPH_CHECK_OOM(view, "");
+  IGRAPH_FINALLY(igraph_free, view);
+
+  view->parent = parent;
+  view->members = members;
+  view->local_ids = local_ids;
+  view->memb = memb;
+  view->comm = comm;
+  view->n_edges = 0;
+  view->lazy.scale = 1;
+  view->lazy.offset = 0;
+  IGRAPH_CHECK(igraph_vector_init(&view->lazy.diagonal, n_members));
+  IGRAPH_FINALLY(igraph_vector_destroy, &view->lazy.diagonal);
+
+  igraph_vector_t* kin = igraph_malloc(sizeof(*kin));
+  IGRAPH_CHECK_OOM(kin, "");
+  IGRAPH_FINALLY(igraph_free, kin);
+  IGRAPH_CHECK(igraph_vector_init(kin, n_members));
+  IGRAPH_FINALLY(igraph_vector_destroy, kin);
+
+  view_graph->neigh_list = parent->neigh_list;
+  view_graph->weights = parent->weights;
+  view_graph->sizes = parent->sizes;
+  view_graph->n_nodes = n_members;
+  view_graph->kin = kin;
+  view_graph->reweighed = false;
+  view_graph->view = view;
+  view_graph->borrowed = NULL;
+
+  for (igraph_integer_t i = 0; i < n_members; i++) {
+    igraph_integer_t const node_id = members[i];
+    for (igraph_integer_t j = 0; j < N_NEIGHBORS_I(*parent, node_id); j++) {
+      igraph_integer_t const neigh = NEIGHBOR_I(*parent, node_id, j);
+      if (memb[neigh] != comm) {
+        continue;
+      }
 
-    VECTOR(neigh_counts)[from]++;
+      if (neigh == node_id) {
+        VECTOR(view->lazy.diagonal)[i] = WEIGHT_I(*parent, node_id, j);
+      }
 
-    if (directed) {
-      continue;
+      VECTOR(*kin)[local_ids[neigh]] += WEIGHT_I(*parent, node_id, j);
+      view->n_edges++;
     }
+  }
+  view_graph->total_weight = igraph_vector_sum(kin);
 
-    neigh_pos = VECTOR(neigh_counts)[to];
+  IGRAPH_FINALLY_CLEAN(4);
 
-    if (is_sparse) {
-      igraph_vector_int_t* neighbors = &VECTOR(*neigh_list->neigh_list)[to];
-      VECTOR(*neighbors)[neigh_pos] = from;
-    }
+  return IGRAPH_SUCCESS;
+}
 
-    if (weights) {
-      igraph_vector_t* w = &VECTOR(*neigh_list->weights)[to];
-      VECTOR(*w)[neigh_pos] = VECTOR(*weights)[eid];
-      neigh_list->total_weight += VECTOR(*weights)[eid];
-    }
+/* Destroy lists of vectors that view borrowed memory without freeing it. */
+void se2_int_views_destroy(igraph_vector_int_list_t* list)
+{
+  while (igraph_vector_int_list_size(list) > 0) {
+    igraph_vector_int_list_pop_back(list);
+  }
+  igraph_vector_int_list_destroy(list);
+}
 
-    VECTOR(neigh_counts)[to]++;
+void se2_real_views_destroy(igraph_vector_list_t* list)
+{
+  while (igraph_vector_list_size(list) > 0) {
+    igraph_vector_list_pop_back(list);
   }
+  igraph_vector_list_destroy(list);
+}
 
-  igraph_vector_int_destroy(&neigh_counts);
-  IGRAPH_FINALLY_CLEAN(1);
+/* Resize node_id's neighbors, and weights if any, to n_neighs edges. Sparse
+rows get room for one more edge so adding the self-loop while reweighing does
+not reallocate them. */
+igraph_error_t se2_neighs_resize_row(se2_neighs* graph,
+  igraph_integer_t const node_id, igraph_integer_t const n_neighs)
+{
+  igraph_integer_t const capacity = n_neighs + (ISSPARSE(*graph) ? 1 : 0);
 
-  if (is_sparse) {
-    IGRAPH_FINALLY_CLEAN(4);
+  if (ISSPARSE(*graph)) {
+    igraph_vector_int_t* neighbors = &NEIGHBORS(*graph, node_id);
+    IGRAPH_CHECK(igraph_vector_int_reserve(neighbors, capacity));
+    IGRAPH_CHECK(igraph_vector_int_resize(neighbors, n_neighs));
   }
 
-  IGRAPH_FINALLY_CLEAN(2);
-
-  if (weights) {
-    IGRAPH_FINALLY_CLEAN(2);
-  } else {
-    neigh_list->total_weight =
-      is_sparse ? igraph_vector_int_sum(neigh_list->sizes) : n_nodes * n_nodes;
+  if (HASWEIGHTS(*graph)) {
+    igraph_vector_t* weights = &WEIGHTS_IN(*graph, node_id);
+    IGRAPH_CHECK(igraph_vector_reserve(weights, capacity));
+    IGRAPH_CHECK(igraph_vector_resize(weights, n_neighs));
   }
 
   return IGRAPH_SUCCESS;
@@ -163,20 +132,68 @@ igraph_error_t se2_igraph_to_neighbor_list(igraph_t const* graph,
 
 void se2_neighs_destroy(se2_neighs* graph)
 {
+  se2_borrowed* borrowed = graph->borrowed;
+
+  if (!borrowed || !borrowed->kin) {
+    igraph_vector_destroy(graph->kin);
+  }
+  igraph_free(graph->kin);
+
+  if (ISVIEW(*graph)) {
+    // Edges are owned by the parent.
+    igraph_vector_destroy(&graph->view->lazy.diagonal);
+    igraph_free(graph->view);
+    return;
+  }
+
   if (ISSPARSE(*graph)) {
-    igraph_vector_int_list_destroy(graph->neigh_list);
+    if (borrowed && borrowed->neighbors) {
+      se2_int_views_destroy(graph->neigh_list);
+    } else {
+      igraph_vector_int_list_destroy(graph->neigh_list);
+    }
     igraph_free(graph->neigh_list);
     igraph_vector_int_destroy(graph->sizes);
     igraph_free(graph->sizes);
   }
 
   if (HASWEIGHTS(*graph)) {
-    igraph_vector_list_destroy(graph->weights);
+    if (borrowed && borrowed->weights) {
+      se2_real_views_destroy(graph->weights);
+    } else {
+      igraph_vector_list_destroy(graph->weights);
+    }
     igraph_free(graph->weights);
   }
 
-  igraph_vector_destroy(graph->kin);
-  igraph_free(graph->kin);
+  if (borrowed) {
+    if (borrowed->mapping) {
+      se2_mapped_view_destroy(borrowed->mapping);
+      igraph_free(borrowed->mapping);
+    }
+    if (borrowed->lazy) {
+      igraph_vector_destroy(&borrowed->lazy->diagonal);
+      igraph_free(borrowed->lazy);
+    }
+    if (borrowed->compact) {
+      if (borrowed->compact->owned) {
+        igraph_free((void*)borrowed->compact->neighbors);
+        igraph_free((void*)borrowed->compact->weights);
+      }
+      igraph_free(borrowed->compact->offsets);
+      igraph_free(borrowed->compact);
+    }
+    if (borrowed->compressed) {
+      igraph_free(borrowed->compressed->id_offsets);
+      igraph_free(borrowed->compressed->edge_offsets);
+      igraph_free(borrowed->compressed->ids);
+      igraph_free(borrowed->compressed->codes);
+      igraph_free(borrowed->compressed->added_loops);
+      igraph_free(borrowed->compressed->dictionary);
+      igraph_free(borrowed->compressed);
+    }
+    igraph_free(borrowed);
+  }
 }
 
 /* Return the number of nodes in the graph represented by \p graph. */
@@ -185,11 +202,30 @@ igraph_integer_t se2_vcount(se2_neighs const* graph) { return graph->n_nodes; }
 /* Return the number of edges in the graph represented by \p graph. */
 igraph_integer_t se2_ecount(se2_neighs const* graph)
 {
+  if (ISVIEW(*graph)) {
+    return graph->view->n_edges;
+  }
+
   return ISSPARSE(*graph) ?
            igraph_vector_int_sum(graph->sizes) :
            graph->n_nodes * graph->n_nodes;
 }
 
+/* Return the number of neighbors of \p node_id including its self-loop. */
+igraph_integer_t se2_degree(se2_neighs const* graph, igraph_integer_t node_id)
+{
+  if (!ISVIEW(*graph)) {
+    return N_NEIGHBORS(*graph, node_id);
+  }
+
+  igraph_integer_t degree = 0;
+  for (igraph_integer_t j = 0; j < N_NEIGHBORS(*graph, node_id); j++) {
+    degree += NEIGHBOR(*graph, node_id, j) != -1;
+  }
+
+  return degree;
+}
+
 igraph_real_t se2_total_weight(se2_neighs const* graph)
 {
   return graph->total_weight;
@@ -207,7 +243,13 @@ static igraph_error_t se2_strength_out_i(
 {
   igraph_integer_t const n_nodes = se2_vcount(graph);
   for (igraph_integer_t i = 0; i < n_nodes; i++) {
-    if (HASWEIGHTS(*graph)) {
+    if (ISVIEW(*graph) || ISLAZY(*graph)) {
+      for (igraph_integer_t j = 0; j < N_NEIGHBORS(*graph, i); j++) {
+        if (NEIGHBOR(*graph, i, j) != -1) {
+          VECTOR(*degrees)[i] += WEIGHT(*graph, i, j);
+        }
+      }
+    } else if (HASWEIGHTS(*graph)) {
       VECTOR(*degrees)[i] += igraph_vector_sum(&WEIGHTS_IN(*graph, i));
     } else {
       VECTOR(*degrees)[i] += N_NEIGHBORS(*graph, i);
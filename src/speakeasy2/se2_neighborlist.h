@@ -19,23 +19,465 @@
 #ifndef SE2_NEIGHBORLIST_H
 #define SE2_NEIGHBORLIST_H
 
+#include <stdint.h>
+
 #include <speak_easy_2.h>
 
-/* Return the jth element of the ith list. */
+#ifdef _MSC_VER
+# define SE2_THREAD_LOCAL __declspec(thread)
+#else
+# define SE2_THREAD_LOCAL _Thread_local
+#endif
+
+/* Reweighing results of graphs whose stored weights must not be modified.
+The reweighed weight of an edge is (stored weight / scale) + offset and
+self-loop weights are stored in the diagonal side array. */
+typedef struct se2_lazy_weights {
+  igraph_vector_t diagonal;
+  igraph_real_t scale;
+  igraph_real_t offset;
+} se2_lazy_weights;
+
+static inline igraph_real_t se2_lazy_weight(se2_lazy_weights const* lazy,
+  igraph_integer_t const i, igraph_real_t const weight,
+  igraph_bool_t const is_loop)
+{
+  return is_loop ? VECTOR(lazy->diagonal)[i] :
+                   (weight / lazy->scale) + lazy->offset;
+}
+
+/* An induced subgraph of a parent graph that borrows the parent's edges
+instead of copying them. Only nodes of the parent in community comm are part of
+the view. Nodes are renumbered to local ids following the order of their parent
+ids.
+
+Reweighing a view does not modify the parent. Instead, the results are stored
+in lazy relative to the parent's (reweighed) weights.
+
+The parent must not be a view itself and must have been reweighed so every
+node has exactly one self-loop. */
+typedef struct se2_view {
+  se2_neighs const* parent;
+  igraph_integer_t const* members;   // Local id -> parent id.
+  igraph_integer_t const* local_ids; // Parent id -> local id in its community.
+  igraph_integer_t const* memb;      // Parent id -> community.
+  igraph_integer_t comm;
+  igraph_integer_t n_edges;
+  se2_lazy_weights lazy;
+} se2_view;
+
+/* Which parts of a graph point into memory it does not own. Borrowed
+vectors are views that must not be resized or destroyed. Graphs borrowing
+weights must already be reweighed or be dense with lazy set, in which case
+reweighing only writes to lazy. Graphs borrowing only neighbors must have
+exactly one self-loop per node so reweighing writes to the weights but leaves
+the neighbors as they are.
+
+Dense graphs may store their weights in packed instead of the weight list,
+which is then left empty. packed holds the upper triangle of a symmetric
+matrix row by row, see se2_packed_index. Sparse graphs may store their edges
+in compact or compressed instead of the neighbor and weight lists, which are
+then left empty. */
+typedef struct se2_borrowed {
+  igraph_bool_t neighbors;
+  igraph_bool_t weights;
+  igraph_bool_t kin;
+  struct se2_mapped_view* mapping; // If not NULL, unmapped with the graph.
+  se2_lazy_weights* lazy;          // If not NULL, weights reweighed lazily.
+  float const* packed;             // If not NULL, lazy must be set.
+  struct se2_compact* compact; // If not NULL, lazy must be set if weighted.
+  struct se2_compressed* compressed; // Likewise.
+} se2_borrowed;
+
+/* Sparse edges in CSR arrays kept at the width they were given in, 32-bit
+neighbor ids and single precision weights halving the memory read per edge.
+Node i's stored edges are at offsets[i] to offsets[i + 1] - 1, offsets are
+64-bit since they count edges. Every node has at most one stored self-loop,
+nodes without one have an implicit self-loop after their stored edges so
+reweighing never changes the edges and weights are reweighed lazily. */
+typedef struct se2_compact {
+  igraph_integer_t* offsets; // n_nodes + 1 elements, always owned.
+  void const* neighbors;
+  void const* weights; // NULL for unweighted graphs.
+  se2_csr_index_type index_type;
+  se2_csr_value_type value_type;
+  igraph_integer_t n_implicit; // Nodes without a stored self-loop.
+  igraph_bool_t owned;         // Free neighbors and weights with the graph.
+} se2_compact;
+
+static inline igraph_integer_t se2_compact_id(
+  se2_compact const* compact, igraph_integer_t const k)
+{
+  return compact->index_type == SE2_CSR_INT32 ?
+           ((int32_t const*)compact->neighbors)[k] :
+           (igraph_integer_t)((int64_t const*)compact->neighbors)[k];
+}
+
+static inline igraph_real_t se2_compact_value(
+  se2_compact const* compact, igraph_integer_t const k)
+{
+  return compact->value_type == SE2_CSR_FLOAT ?
+           ((float const*)compact->weights)[k] :
+           ((double const*)compact->weights)[k];
+}
+
+/* Sparse edges compressed for graphs that barely fit in memory. Node i's
+neighbors are sorted and stored from ids + id_offsets[i] as LEB128 varints of
+the difference to the previous neighbor (the first to 0). Its weights start
+at edge edge_offsets[i] of codes, which holds code_size byte indices into
+dictionary if there are few distinct weights or single precision weights
+otherwise. As for compact graphs, every node has exactly one self-loop and
+weights are reweighed lazily. Bit i of added_loops is set if node i's
+self-loop was not among the edges it was compressed from. All arrays are
+owned. */
+typedef struct se2_compressed {
+  igraph_integer_t* id_offsets;   // n_nodes + 1 elements.
+  igraph_integer_t* edge_offsets; // n_nodes + 1 elements.
+  uint8_t* ids;
+  void* codes;               // NULL for unweighted graphs.
+  igraph_real_t* dictionary; // NULL if codes holds the weights.
+  int code_size;             // 1 or 2 with a dictionary, otherwise 4.
+  uint8_t* added_loops;
+  igraph_integer_t n_added; // Number of bits set in added_loops.
+  igraph_integer_t serial;  // Tells graphs apart for se2_compressed_cursor.
+} se2_compressed;
+
+/* The last neighbor decoded by se2_compressed_neighbor, so reading a node's
+neighbors in order decodes each id once. One per thread as threads share
+graphs. */
+typedef struct se2_compressed_cursor {
+  se2_compressed const* compressed;
+  igraph_integer_t serial;
+  igraph_integer_t node_id;
+  igraph_integer_t j;
+  igraph_integer_t neigh;
+  uint8_t const* next;
+} se2_compressed_cursor;
+
+extern SE2_THREAD_LOCAL se2_compressed_cursor se2_cursor;
+
+static inline uint8_t const* se2_varint_next(
+  uint8_t const* pos, igraph_integer_t* value)
+{
+  uint64_t x = *pos & 0x7f;
+  int shift = 7;
+  while (*pos++ & 0x80) {
+    x |= (uint64_t)(*pos & 0x7f) << shift;
+    shift += 7;
+  }
+  *value = (igraph_integer_t)x;
+
+  return pos;
+}
+
+static inline igraph_real_t se2_compressed_weight(
+  se2_compressed const* compressed, igraph_integer_t const edge)
+{
+  switch (compressed->code_size) {
+  case 1:
+    return compressed->dictionary[((uint8_t const*)compressed->codes)[edge]];
+  case 2:
+    return compressed->dictionary[((uint16_t const*)compressed->codes)[edge]];
+  default:
+    return ((float const*)compressed->codes)[edge];
+  }
+}
+
+/* Position of the weight between nodes i <= j of an n_nodes graph in a packed
+upper triangle. */
+static inline igraph_integer_t se2_packed_index(igraph_integer_t const n_nodes,
+  igraph_integer_t const i, igraph_integer_t const j)
+{
+  return (i * n_nodes) - ((i * (i - 1)) / 2) + (j - i);
+}
+
+void se2_int_views_destroy(igraph_vector_int_list_t* list);
+void se2_real_views_destroy(igraph_vector_list_t* list);
+
+/* Accessors for graphs that own their edges. */
+#define NEIGHBOR_I(a, i, j)                                                   \
+  ((a).neigh_list ?                                                           \
+     (ISCOMPACT(a)    ? se2_compact_neighbor(&(a), (i), (j)) :                \
+      ISCOMPRESSED(a) ? se2_compressed_neighbor(&(a), (i), (j)) :             \
+                        VECTOR(VECTOR(*(a).neigh_list)[(i)])[(j)]) :          \
+     (j))
+#define N_NEIGHBORS_I(a, i)                                                   \
+  ((a).neigh_list ? VECTOR(*(a).sizes)[(i)] : (a).n_nodes)
+#define WEIGHT_I(a, i, j)                                                     \
+  ((a).weights ? (ISLAZY(a) ? se2_lazy_weight_i(&(a), (i), (j)) :            \
+                              VECTOR(VECTOR(*(a).weights)[(i)])[(j)]) :       \
+                 1)
+
+#define ISVIEW(a) ((a).view ? true : false)
+#define ISLAZY(a) ((a).borrowed && (a).borrowed->lazy)
+#define ISPACKED(a) ((a).borrowed && (a).borrowed->packed)
+#define ISCOMPACT(a) ((a).borrowed && (a).borrowed->compact)
+#define ISCOMPRESSED(a) ((a).borrowed && (a).borrowed->compressed)
+
+/* Return the jth element of the ith list.
+
+For views, the jth element is taken from the parent's list so it is -1 if the
+neighbor is not in the view. Loops over neighbors must skip these. NEIGHBORS
+and WEIGHTS_IN expose the underlying storage so are not valid for views.
+WEIGHTS_IN holds the weights before reweighing for lazy graphs and neither is
+valid for packed, compact, or compressed graphs. */
 #define NEIGHBOR(a, i, j)                                                     \
-  ((a).neigh_list ? VECTOR(VECTOR(*(a).neigh_list)[(i)])[(j)] : j)
+  ((a).view ? se2_view_neighbor((a).view, (i), (j)) : NEIGHBOR_I(a, i, j))
 #define NEIGHBORS(a, i) (VECTOR(*(a).neigh_list)[(i)])
 #define N_NEIGHBORS(a, i)                                                     \
-  ((a).neigh_list ? VECTOR(*(a).sizes)[(i)] : (a).n_nodes)
+  ((a).view ? N_NEIGHBORS_I(*(a).view->parent, (a).view->members[(i)]) :     \
+              N_NEIGHBORS_I(a, i))
 #define ISSPARSE(a) ((a).neigh_list ? true : false)
 
 #define WEIGHT(a, i, j)                                                       \
-  ((a).weights ? VECTOR(VECTOR(*(a).weights)[(i)])[(j)] : 1)
+  ((a).view ? se2_view_weight((a).view, (i), (j)) : WEIGHT_I(a, i, j))
 #define WEIGHTS_IN(a, i) (VECTOR(*(a).weights)[(i)])
 #define HASWEIGHTS(a) ((a).weights ? true : false)
 
+static inline igraph_integer_t se2_compact_neighbor(
+  se2_neighs const* graph, igraph_integer_t const i, igraph_integer_t const j)
+{
+  se2_compact const* compact = graph->borrowed->compact;
+  igraph_integer_t const k = compact->offsets[i] + j;
+  return k < compact->offsets[i + 1] ? se2_compact_id(compact, k) : i;
+}
+
+/* Stored weight of node i's jth edge in a compact graph, 0 for its implicit
+self-loop whose weight is only ever read from the lazy diagonal. */
+static inline igraph_real_t se2_compact_weight(
+  se2_neighs const* graph, igraph_integer_t const i, igraph_integer_t const j)
+{
+  se2_compact const* compact = graph->borrowed->compact;
+  igraph_integer_t const k = compact->offsets[i] + j;
+  return k < compact->offsets[i + 1] ? se2_compact_value(compact, k) : 0;
+}
+
+static inline igraph_integer_t se2_compressed_neighbor(
+  se2_neighs const* graph, igraph_integer_t const i, igraph_integer_t const j)
+{
+  se2_compressed const* compressed = graph->borrowed->compressed;
+  se2_compressed_cursor* cursor = &se2_cursor;
+
+  if ((cursor->compressed != compressed) ||
+      (cursor->serial != compressed->serial) || (cursor->node_id != i) ||
+      (cursor->j > j)) {
+    cursor->compressed = compressed;
+    cursor->serial = compressed->serial;
+    cursor->node_id = i;
+    cursor->j = -1;
+    cursor->neigh = 0;
+    cursor->next = compressed->ids + compressed->id_offsets[i];
+  }
+
+  while (cursor->j < j) {
+    igraph_integer_t delta;
+    cursor->next = se2_varint_next(cursor->next, &delta);
+    cursor->neigh += delta;
+    cursor->j++;
+  }
+
+  return cursor->neigh;
+}
+
+/* Whether node i's jth edge is a self-loop added to the edges the graph was
+given, the implicit self-loops of compact graphs and those compressing a graph
+gives nodes without one. Reweighing leaves them out of its statistics. */
+static inline igraph_bool_t se2_added_loop(
+  se2_neighs const* graph, igraph_integer_t const i, igraph_integer_t const j)
+{
+  if (ISCOMPACT(*graph)) {
+    se2_compact const* compact = graph->borrowed->compact;
+    return compact->offsets[i] + j >= compact->offsets[i + 1];
+  }
+
+  if (ISCOMPRESSED(*graph)) {
+    se2_compressed const* compressed = graph->borrowed->compressed;
+    return ((compressed->added_loops[i / 8] >> (i % 8)) & 1) &&
+           (se2_compressed_neighbor(graph, i, j) == i);
+  }
+
+  return false;
+}
+
+static inline igraph_real_t se2_lazy_weight_i(
+  se2_neighs const* graph, igraph_integer_t const i, igraph_integer_t const j)
+{
+  float const* packed = graph->borrowed->packed;
+  se2_compact const* compact = graph->borrowed->compact;
+  se2_compressed const* compressed = graph->borrowed->compressed;
+  igraph_real_t const weight =
+    packed     ? packed[i <= j ? se2_packed_index(graph->n_nodes, i, j) :
+                                 se2_packed_index(graph->n_nodes, j, i)] :
+    compact    ? se2_compact_weight(graph, i, j) :
+    compressed ? se2_compressed_weight(
+                   compressed, compressed->edge_offsets[i] + j) :
+                 VECTOR(VECTOR(*graph->weights)[i])[j];
+
+  return se2_lazy_weight(
+    graph->borrowed->lazy, i, weight, NEIGHBOR_I(*graph, i, j) == i);
+}
+
+static inline igraph_integer_t se2_view_neighbor(
+  se2_view const* view, igraph_integer_t const i, igraph_integer_t const j)
+{
+  igraph_integer_t const neigh =
+    NEIGHBOR_I(*view->parent, view->members[i], j);
+  return view->memb[neigh] == view->comm ? view->local_ids[neigh] : -1;
+}
+
+static inline igraph_real_t se2_view_weight(
+  se2_view const* view, igraph_integer_t const i, igraph_integer_t const j)
+{
+  igraph_integer_t const node_id = view->members[i];
+  if (!HASWEIGHTS(*view->parent)) {
+    return 1;
+  }
+
+  return se2_lazy_weight(&view->lazy, i, WEIGHT_I(*view->parent, node_id, j),
+    NEIGHBOR_I(*view->parent, node_id, j) == node_id);
+}
+
+/* Add the reweighed weight of each of node i's edges in a packed graph to
+sums[labels[j]], in order of neighbor j. Weights to lower ids are strided
+through their rows while the rest are contiguous in row i. */
+static inline void se2_packed_add_row(se2_neighs const* graph,
+  igraph_integer_t const i, igraph_integer_t const* labels,
+  igraph_real_t* sums)
+{
+  igraph_integer_t const n_nodes = graph->n_nodes;
+  se2_lazy_weights const* lazy = graph->borrowed->lazy;
+  float const* packed = graph->borrowed->packed;
+
+  igraph_integer_t pos = i;
+  for (igraph_integer_t j = 0; j < i; j++) {
+    sums[labels[j]] += se2_lazy_weight(lazy, i, packed[pos], false);
+    pos += n_nodes - j - 1;
+  }
+
+  sums[labels[i]] += VECTOR(lazy->diagonal)[i];
+
+  float const* row = packed + pos - i;
+  for (igraph_integer_t j = i + 1; j < n_nodes; j++) {
+    sums[labels[j]] += se2_lazy_weight(lazy, i, row[j], false);
+  }
+}
+
+/* Add the weight of each of node i's edges in a compact graph to
+sums[labels[neighbor]]. The common 32-bit single precision layout gets its own
+loop, other widths convert each edge. */
+static inline void se2_compact_add_row(se2_neighs const* graph,
+  igraph_integer_t const i, igraph_integer_t const* labels,
+  igraph_real_t* sums)
+{
+  se2_compact const* compact = graph->borrowed->compact;
+  se2_lazy_weights const* lazy = graph->borrowed->lazy;
+  igraph_integer_t const start = compact->offsets[i];
+  igraph_integer_t const end = compact->offsets[i + 1];
+  igraph_bool_t const implicit_loop = N_NEIGHBORS_I(*graph, i) > end - start;
+
+  if ((compact->index_type == SE2_CSR_INT32) &&
+      (!compact->weights || (compact->value_type == SE2_CSR_FLOAT))) {
+    int32_t const* neighbors = (int32_t const*)compact->neighbors + start;
+    igraph_integer_t const n_neighs = end - start;
+    if (!compact->weights) {
+      for (igraph_integer_t j = 0; j < n_neighs; j++) {
+        sums[labels[neighbors[j]]] += 1.0;
+      }
+    } else {
+      float const* weights = (float const*)compact->weights + start;
+      for (igraph_integer_t j = 0; j < n_neighs; j++) {
+        sums[labels[neighbors[j]]] +=
+          se2_lazy_weight(lazy, i, weights[j], neighbors[j] == i);
+      }
+    }
+  } else {
+    for (igraph_integer_t k = start; k < end; k++) {
+      igraph_integer_t const neigh = se2_compact_id(compact, k);
+      sums[labels[neigh]] += compact->weights ?
+                               se2_lazy_weight(lazy, i,
+                                 se2_compact_value(compact, k), neigh == i) :
+                               1.0;
+    }
+  }
+
+  if (implicit_loop) {
+    sums[labels[i]] += compact->weights ? VECTOR(lazy->diagonal)[i] : 1.0;
+  }
+}
+
+/* Add the weight of each of node i's edges in a compressed graph to
+sums[labels[neighbor]], decoding the neighbors in order. */
+static inline void se2_compressed_add_row(se2_neighs const* graph,
+  igraph_integer_t const i, igraph_integer_t const* labels,
+  igraph_real_t* sums)
+{
+  se2_compressed const* compressed = graph->borrowed->compressed;
+  igraph_integer_t const n_neighs = N_NEIGHBORS_I(*graph, i);
+  igraph_integer_t const start = compressed->edge_offsets[i];
+  uint8_t const* pos = compressed->ids + compressed->id_offsets[i];
+  igraph_integer_t neigh = 0;
+
+  if (!compressed->codes) {
+    for (igraph_integer_t j = 0; j < n_neighs; j++) {
+      igraph_integer_t delta;
+      pos = se2_varint_next(pos, &delta);
+      neigh += delta;
+      sums[labels[neigh]] += 1.0;
+    }
+    return;
+  }
+
+  se2_lazy_weights const* lazy = graph->borrowed->lazy;
+  for (igraph_integer_t j = 0; j < n_neighs; j++) {
+    igraph_integer_t delta;
+    pos = se2_varint_next(pos, &delta);
+    neigh += delta;
+    sums[labels[neigh]] += se2_lazy_weight(lazy, i,
+      se2_compressed_weight(compressed, start + j), neigh == i);
+  }
+}
+
+/* Total weight of node i's edges in a compressed graph to neighbors labeled
+label. */
+static inline igraph_real_t se2_compressed_label_weight(
+  se2_neighs const* graph, igraph_integer_t const i,
+  igraph_integer_t const* labels, igraph_integer_t const label)
+{
+  se2_compressed const* compressed = graph->borrowed->compressed;
+  se2_lazy_weights const* lazy = graph->borrowed->lazy;
+  igraph_integer_t const n_neighs = N_NEIGHBORS_I(*graph, i);
+  igraph_integer_t const start = compressed->edge_offsets[i];
+  uint8_t const* pos = compressed->ids + compressed->id_offsets[i];
+  igraph_integer_t neigh = 0;
+  igraph_real_t total = 0;
+
+  for (igraph_integer_t j = 0; j < n_neighs; j++) {
+    igraph_integer_t delta;
+    pos = se2_varint_next(pos, &delta);
+    neigh += delta;
+    if (labels[neigh] != label) {
+      continue;
+    }
+
+    total += compressed->codes ?
+               se2_lazy_weight(lazy, i,
+                 se2_compressed_weight(compressed, start + j), neigh == i) :
+               1;
+  }
+
+  return total;
+}
+
+igraph_error_t se2_neighs_view_init(se2_neighs* view_graph,
+  se2_neighs const* parent, igraph_integer_t const* memb,
+  igraph_integer_t const* local_ids, igraph_integer_t const comm,
+  igraph_integer_t const* members, igraph_integer_t const n_members);
+igraph_error_t se2_neighs_resize_row(se2_neighs* graph,
+  igraph_integer_t const node_id, igraph_integer_t const n_neighs);
+
 igraph_integer_t se2_vcount(se2_neighs const* graph);
 igraph_integer_t se2_ecount(se2_neighs const* graph);
+igraph_integer_t se2_degree(se2_neighs const* graph, igraph_integer_t node_id);
 igraph_real_t se2_total_weight(se2_neighs const* graph);
 igraph_error_t se2_strength(se2_neighs const* neigh_list,
   igraph_vector_t* degrees, igraph_neimode_t const mode);
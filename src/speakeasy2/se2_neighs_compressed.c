@@ -0,0 +1,407 @@
+/* Copyright 2024 David R. Connell <david32@dcon.addy.io>.
+ *
+ * This file is part of SpeakEasy 2.
+ *
+ * SpeakEasy 2 is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * SpeakEasy 2 is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with SpeakEasy 2. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _MSC_VER
+# include <intrin.h>
+#else
+# include <stdatomic.h>
+#endif
+
+#include "se2_neighborlist.h"
+
+/* Compressed copies of graphs that barely fit in memory, see se2_compressed.
+
+Sorting each node's neighbors makes the differences between consecutive ids
+small, so most take one or two bytes as varints instead of eight. Weights
+are often drawn from a few distinct values (e.g. integer counts), which are
+stored once in a dictionary and referenced by one or two byte codes. */
+
+#define SE2_DICTIONARY_MAX 65536
+#define SE2_DICTIONARY_BITS 17 // Twice as many slots as values.
+#define SE2_DICTIONARY_SLOTS ((size_t)1 << SE2_DICTIONARY_BITS)
+
+SE2_THREAD_LOCAL se2_compressed_cursor se2_cursor;
+
+/* Serials tell apart graphs that may reuse the same address. Graphs can be
+compressed from multiple threads at once, so the counter is atomic. */
+#ifdef _MSC_VER
+static volatile long long se2_compressed_serial = 0;
+# define SE2_NEXT_SERIAL() _InterlockedIncrement64(&se2_compressed_serial)
+#else
+static atomic_llong se2_compressed_serial = 0;
+# define SE2_NEXT_SERIAL() (atomic_fetch_add(&se2_compressed_serial, 1) + 1)
+#endif
+
+typedef struct {
+  igraph_integer_t neigh;
+  igraph_real_t weight;
+} se2_edge;
+
+/* Open addressing hash table of the distinct weights in order of appearance.
+Weights are compared by their bits so the dictionary is lossless. */
+typedef struct {
+  uint64_t* keys;
+  igraph_integer_t* codes; // -1 for empty slots.
+  igraph_real_t* values;
+  igraph_integer_t size;
+} se2_dictionary;
+
+static int se2_edge_cmp(void const* a, void const* b)
+{
+  igraph_integer_t const a_neigh = ((se2_edge const*)a)->neigh;
+  igraph_integer_t const b_neigh = ((se2_edge const*)b)->neigh;
+  return (a_neigh > b_neigh) - (a_neigh < b_neigh);
+}
+
+static igraph_integer_t se2_varint_size(uint64_t x)
+{
+  igraph_integer_t n_bytes = 1;
+  while (x >= 0x80) {
+    x >>= 7;
+    n_bytes++;
+  }
+
+  return n_bytes;
+}
+
+static uint8_t* se2_varint_put(uint8_t* pos, uint64_t x)
+{
+  while (x >= 0x80) {
+    *pos++ = (uint8_t)(x | 0x80);
+    x >>= 7;
+  }
+  *pos++ = (uint8_t)x;
+
+  return pos;
+}
+
+static void se2_dictionary_destroy(se2_dictionary* dict)
+{
+  igraph_free(dict->keys);
+  igraph_free(dict->codes);
+  igraph_free(dict->values);
+}
+
+static igraph_error_t se2_dictionary_init(se2_dictionary* dict)
+{
+  dict->keys = IGRAPH_CALLOC(SE2_DICTIONARY_SLOTS, uint64_t);
+  dict->codes = IGRAPH_CALLOC(SE2_DICTIONARY_SLOTS, igraph_integer_t);
+  dict->values = IGRAPH_CALLOC(SE2_DICTIONARY_MAX, igraph_real_t);
+  dict->size = 0;
+  if (!dict->keys || !dict->codes || !dict->values) {
+    se2_dictionary_destroy(dict);
+    IGRAPH_ERROR("", IGRAPH_ENOMEM);
+  }
+
+  for (size_t i = 0; i < SE2_DICTIONARY_SLOTS; i++) {
+    dict->codes[i] = -1;
+  }
+
+  return IGRAPH_SUCCESS;
+}
+
+/* Return the code of value, adding it if it is new. Returns -1 if it is new
+but the dictionary is full. */
+static igraph_integer_t se2_dictionary_code(
+  se2_dictionary* dict, igraph_real_t const value)
+{
+  uint64_t key;
+  memcpy(&key, &value, sizeof(key));
+  size_t slot = (size_t)((key * UINT64_C(0x9E3779B97F4A7C15)) >>
+                         (64 - SE2_DICTIONARY_BITS));
+
+  while (dict->codes[slot] != -1) {
+    if (dict->keys[slot] == key) {
+      return dict->codes[slot];
+    }
+    slot = (slot + 1) & (SE2_DICTIONARY_SLOTS - 1);
+  }
+
+  if (dict->size == SE2_DICTIONARY_MAX) {
+    return -1;
+  }
+
+  dict->keys[slot] = key;
+  dict->codes[slot] = dict->size;
+  dict->values[dict->size] = value;
+
+  return dict->size++;
+}
+
+/* Copy node i's edges to edges sorted by neighbor, keeping only its first
+self-loop or adding one with weight 0 if it has none, as reweighing would.
+Sets added if the self-loop was not one of graph's given edges. Returns the
+number of edges. */
+static igraph_integer_t se2_sorted_row(se2_neighs const* graph,
+  igraph_integer_t const i, se2_edge* edges, igraph_bool_t* added)
+{
+  igraph_bool_t found_loop = false;
+  igraph_integer_t n_edges = 0;
+
+  for (igraph_integer_t j = 0; j < N_NEIGHBORS_I(*graph, i); j++) {
+    igraph_integer_t const neigh = NEIGHBOR_I(*graph, i, j);
+    if (neigh == i) {
+      if (found_loop) {
+        continue;
+      }
+      found_loop = true;
+      *added = se2_added_loop(graph, i, j);
+    }
+
+    edges[n_edges].neigh = neigh;
+    edges[n_edges].weight = WEIGHT_I(*graph, i, j);
+    n_edges++;
+  }
+
+  if (!found_loop) {
+    edges[n_edges].neigh = i;
+    edges[n_edges].weight = 0;
+    n_edges++;
+    *added = true;
+  }
+
+  qsort(edges, n_edges, sizeof(*edges), se2_edge_cmp);
+
+  return n_edges;
+}
+
+/* Write the code of weight, or the weight itself, to edge of codes. */
+static void se2_compressed_put_weight(se2_compressed* compressed,
+  se2_dictionary* dict, igraph_integer_t const edge,
+  igraph_real_t const weight)
+{
+  switch (compressed->code_size) {
+  case 1:
+    ((uint8_t*)compressed->codes)[edge] =
+      (uint8_t)se2_dictionary_code(dict, weight);
+    break;
+  case 2:
+    ((uint16_t*)compressed->codes)[edge] =
+      (uint16_t)se2_dictionary_code(dict, weight);
+    break;
+  default:
+    ((float*)compressed->codes)[edge] = (float)weight;
+  }
+}
+
+/* Create a compressed copy of graph in res. Neighbors are reordered by id and
+self-loops are made unique, otherwise the edges are the same. Weights are
+kept exactly if there are at most 65536 distinct weights, otherwise they are
+rounded to single precision. Destroy res with se2_neighs_destroy when done,
+graph can be destroyed as soon as this returns.
+
+Compressed graphs trade decoding neighbors as they are read for using about a
+quarter of the memory of a graph stored in neighbor lists. */
+igraph_error_t se2_neighs_compress(se2_neighs const* graph, se2_neighs* res)
+{
+  igraph_integer_t const n_nodes = se2_vcount(graph);
+  igraph_bool_t const weighted = HASWEIGHTS(*graph);
+  igraph_bool_t in_dictionary = weighted;
+  igraph_integer_t max_degree = 0;
+  se2_dictionary dict;
+
+  if (ISVIEW(*graph)) {
+    IGRAPH_ERROR("Cannot compress a view.", IGRAPH_EINVAL);
+  }
+
+  for (igraph_integer_t i = 0; i < n_nodes; i++) {
+    if (N_NEIGHBORS_I(*graph, i) > max_degree) {
+      max_degree = N_NEIGHBORS_I(*graph, i);
+    }
+  }
+
+  se2_edge* edges = IGRAPH_CALLOC(max_degree + 1, se2_edge);
+  IGRAPH_CHECK_OOM(edges, "");
+  IGRAPH_FINALLY(igraph_free, edges);
+
+  if (weighted) {
+    IGRAPH_CHECK(se2_dictionary_init(&dict));
+    IGRAPH_FINALLY(se2_dictionary_destroy, &dict);
+  }
+
+  se2_compressed* compressed = igraph_malloc(sizeof(*compressed));
+  IGRAPH_CHECK_OOM(compressed, "");
+  IGRAPH_FINALLY(igraph_free, compressed);
+  compressed->ids = NULL;
+  compressed->codes = NULL;
+  compressed->dictionary = NULL;
+  compressed->code_size = 0;
+  compressed->n_added = 0;
+  compressed->serial = SE2_NEXT_SERIAL();
+
+  compressed->added_loops = IGRAPH_CALLOC((n_nodes / 8) + 1, uint8_t);
+  IGRAPH_CHECK_OOM(compressed->added_loops, "");
+  IGRAPH_FINALLY(igraph_free, compressed->added_loops);
+
+  compressed->id_offsets = IGRAPH_CALLOC(n_nodes + 1, igraph_integer_t);
+  IGRAPH_CHECK_OOM(compressed->id_offsets, "");
+  IGRAPH_FINALLY(igraph_free, compressed->id_offsets);
+  compressed->edge_offsets = IGRAPH_CALLOC(n_nodes + 1, igraph_integer_t);
+  IGRAPH_CHECK_OOM(compressed->edge_offsets, "");
+  IGRAPH_FINALLY(igraph_free, compressed->edge_offsets);
+
+  res->sizes = igraph_malloc(sizeof(*res->sizes));
+  IGRAPH_CHECK_OOM(res->sizes, "");
+  IGRAPH_FINALLY(igraph_free, res->sizes);
+  IGRAPH_CHECK(igraph_vector_int_init(res->sizes, n_nodes));
+  IGRAPH_FINALLY(igraph_vector_int_destroy, res->sizes);
+
+  res->kin = igraph_malloc(sizeof(*res->kin));
+  IGRAPH_CHECK_OOM(res->kin, "");
+  IGRAPH_FINALLY(igraph_free, res->kin);
+  IGRAPH_CHECK(igraph_vector_init(res->kin, n_nodes));
+  IGRAPH_FINALLY(igraph_vector_destroy, res->kin);
+
+  // The lists are left empty but mark the graph as sparse and weighted.
+  res->neigh_list = igraph_malloc(sizeof(*res->neigh_list));
+  IGRAPH_CHECK_OOM(res->neigh_list, "");
+  IGRAPH_FINALLY(igraph_free, res->neigh_list);
+  IGRAPH_CHECK(igraph_vector_int_list_init(res->neigh_list, 0));
+  IGRAPH_FINALLY(igraph_vector_int_list_destroy, res->neigh_list);
+
+  se2_borrowed* borrowed = igraph_malloc(sizeof(*borrowed));
+  IGRAPH_CHECK_OOM(borrowed, "");
+  IGRAPH_FINALLY(igraph_free, borrowed);
+  borrowed->neighbors = false;
+  borrowed->weights = false;
+  borrowed->kin = false;
+  borrowed->mapping = NULL;
+  borrowed->lazy = NULL;
+  borrowed->packed = NULL;
+  borrowed->compact = NULL;
+  borrowed->compressed = compressed;
+
+  if (weighted) {
+    res->weights = igraph_malloc(sizeof(*res->weights));
+    IGRAPH_CHECK_OOM(res->weights, "");
+    IGRAPH_FINALLY(igraph_free, res->weights);
+    IGRAPH_CHECK(igraph_vector_list_init(res->weights, 0));
+    IGRAPH_FINALLY(igraph_vector_list_destroy, res->weights);
+
+    borrowed->lazy = igraph_malloc(sizeof(*borrowed->lazy));
+    IGRAPH_CHECK_OOM(borrowed->lazy, "");
+    IGRAPH_FINALLY(igraph_free, borrowed->lazy);
+    borrowed->lazy->scale = 1;
+    borrowed->lazy->offset = 0;
+    IGRAPH_CHECK(igraph_vector_init(&borrowed->lazy->diagonal, n_nodes));
+    IGRAPH_FINALLY(igraph_vector_destroy, &borrowed->lazy->diagonal);
+  } else {
+    res->weights = NULL;
+  }
+
+  // Measure the encoded rows and collect the distinct weights.
+  for (igraph_integer_t i = 0; i < n_nodes; i++) {
+    igraph_bool_t added = false;
+    igraph_integer_t const n_row = se2_sorted_row(graph, i, edges, &added);
+    igraph_integer_t n_bytes = 0;
+    igraph_integer_t prev = 0;
+
+    if (added) {
+      compressed->added_loops[i / 8] |= (uint8_t)(1 << (i % 8));
+      compressed->n_added++;
+    }
+
+    for (igraph_integer_t j = 0; j < n_row; j++) {
+      n_bytes += se2_varint_size(edges[j].neigh - prev);
+      prev = edges[j].neigh;
+      if (in_dictionary) {
+        in_dictionary = se2_dictionary_code(&dict, edges[j].weight) != -1;
+      }
+    }
+
+    VECTOR(*res->sizes)[i] = n_row;
+    compressed->id_offsets[i + 1] = compressed->id_offsets[i] + n_bytes;
+    compressed->edge_offsets[i + 1] = compressed->edge_offsets[i] + n_row;
+  }
+
+  igraph_integer_t const n_edges = compressed->edge_offsets[n_nodes];
+  compressed->ids =
+    IGRAPH_CALLOC(compressed->id_offsets[n_nodes] + 1, uint8_t);
+  IGRAPH_CHECK_OOM(compressed->ids, "");
+  IGRAPH_FINALLY(igraph_free, compressed->ids);
+
+  if (weighted) {
+    if (!in_dictionary) {
+      compressed->code_size = sizeof(float);
+    } else {
+      compressed->code_size =
+        dict.size <= UINT8_MAX + 1 ? sizeof(uint8_t) : sizeof(uint16_t);
+    }
+    compressed->codes = igraph_malloc((n_edges + 1) * compressed->code_size);
+    IGRAPH_CHECK_OOM(compressed->codes, "");
+    IGRAPH_FINALLY(igraph_free, compressed->codes);
+  }
+
+  if (in_dictionary) {
+    compressed->dictionary = IGRAPH_CALLOC(dict.size, igraph_real_t);
+    IGRAPH_CHECK_OOM(compressed->dictionary, "");
+    IGRAPH_FINALLY(igraph_free, compressed->dictionary);
+    memcpy(compressed->dictionary, dict.values,
+      dict.size * sizeof(*dict.values));
+  }
+
+  res->total_weight = weighted ? 0 : n_edges;
+  for (igraph_integer_t i = 0; i < n_nodes; i++) {
+    igraph_bool_t added;
+    igraph_integer_t const n_row = se2_sorted_row(graph, i, edges, &added);
+    igraph_integer_t const start = compressed->edge_offsets[i];
+    uint8_t* pos = compressed->ids + compressed->id_offsets[i];
+    igraph_integer_t prev = 0;
+
+    for (igraph_integer_t j = 0; j < n_row; j++) {
+      pos = se2_varint_put(pos, edges[j].neigh - prev);
+      prev = edges[j].neigh;
+      if (!weighted) {
+        continue;
+      }
+
+      se2_compressed_put_weight(
+        compressed, &dict, start + j, edges[j].weight);
+      igraph_real_t const weight =
+        se2_compressed_weight(compressed, start + j);
+      if (edges[j].neigh == i) {
+        VECTOR(borrowed->lazy->diagonal)[i] = weight;
+      }
+      res->total_weight += weight;
+    }
+  }
+
+  res->n_nodes = n_nodes;
+  res->reweighed = graph->reweighed;
+  res->view = NULL;
+  res->borrowed = borrowed;
+  if (graph->reweighed) {
+    // Reweighing is not repeated so keep the degrees it computed.
+    IGRAPH_CHECK(igraph_vector_update(res->kin, graph->kin));
+    res->total_weight = graph->total_weight;
+  }
+
+  IGRAPH_FINALLY_CLEAN(12 + (weighted ? 5 : 0) + (in_dictionary ? 1 : 0));
+
+  if (weighted) {
+    se2_dictionary_destroy(&dict);
+    IGRAPH_FINALLY_CLEAN(1);
+  }
+  igraph_free(edges);
+  IGRAPH_FINALLY_CLEAN(1);
+
+  return IGRAPH_SUCCESS;
+}
@@ -0,0 +1,357 @@
+/* Copyright 2024 David R. Connell <david32@dcon.addy.io>.
+ *
+ * This file is part of SpeakEasy 2.
+ *
+ * SpeakEasy 2 is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * SpeakEasy 2 is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with SpeakEasy 2. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+
+#include "se2_neighborlist.h"
+
+/* Neighbor lists that borrow a caller's CSR adjacency matrix.
+
+Reweighing rescales every weight and makes sure each node has exactly one
+self-loop. Matrices with at most one self-loop per row, such as a matrix with
+its diagonal stored, are borrowed as a compact graph at whatever widths they
+use: weights are reweighed lazily and a missing self-loop is an implicit edge
+whose weight lives in the lazy diagonal, so neither array is written.
+
+Rows with repeated self-loops have to be rewritten. Matrices with 32-bit
+indices and single precision (or no) weights are then copied into an owned
+compact graph, keeping each row's first self-loop, everything else is copied
+into lists owned by the graph and reweighed in place. */
+
+static inline igraph_integer_t se2_csr_index(void const* arr,
+  se2_csr_index_type const type, igraph_integer_t const i)
+{
+  return type == SE2_CSR_INT32 ? ((int32_t const*)arr)[i] :
+                                 ((int64_t const*)arr)[i];
+}
+
+static inline igraph_real_t se2_csr_value(void const* arr,
+  se2_csr_value_type const type, igraph_integer_t const i)
+{
+  return type == SE2_CSR_FLOAT ? ((float const*)arr)[i] :
+                                 ((double const*)arr)[i];
+}
+
+/* Check the matrix and whether every row has at most one self-loop. */
+static igraph_error_t se2_csr_validate(
+  se2_csr_matrix const* mat, igraph_bool_t* unique_loops)
+{
+  igraph_integer_t const n_nodes = mat->n_nodes;
+
+  if ((n_nodes < 0) ||
+      (se2_csr_index(mat->row_ptr, mat->index_type, 0) != 0)) {
+    IGRAPH_ERROR("Invalid sparse matrix dimensions.", IGRAPH_EINVAL);
+  }
+
+  *unique_loops = true;
+  for (igraph_integer_t i = 0; i < n_nodes; i++) {
+    igraph_integer_t const start =
+      se2_csr_index(mat->row_ptr, mat->index_type, i);
+    igraph_integer_t const end =
+      se2_csr_index(mat->row_ptr, mat->index_type, i + 1);
+    igraph_integer_t n_loops = 0;
+
+    if (end < start) {
+      IGRAPH_ERROR("Sparse matrix row pointers must be non-decreasing.",
+        IGRAPH_EINVAL);
+    }
+
+    for (igraph_integer_t j = start; j < end; j++) {
+      igraph_integer_t const col =
+        se2_csr_index(mat->col_idx, mat->index_type, j);
+      if ((col < 0) || (col >= n_nodes)) {
+        IGRAPH_ERROR(
+          "Sparse matrix column index out of range.", IGRAPH_EINVAL);
+      }
+      n_loops += col == i;
+    }
+
+    *unique_loops = *unique_loops && (n_loops <= 1);
+  }
+
+  return IGRAPH_SUCCESS;
+}
+
+/* Copy node i's edges to neighbors and weights, keeping only its first
+self-loop. */
+static void se2_csr_compact_row(se2_csr_matrix const* mat,
+  igraph_integer_t const i, int32_t* neighbors, float* weights)
+{
+  int32_t const* row_ptr = mat->row_ptr;
+  int32_t const* col_idx = mat->col_idx;
+  float const* values = mat->values;
+  igraph_bool_t found_loop = false;
+  igraph_integer_t pos = 0;
+
+  for (igraph_integer_t k = row_ptr[i]; k < row_ptr[i + 1]; k++) {
+    if (col_idx[k] == i) {
+      if (found_loop) {
+        continue;
+      }
+      found_loop = true;
+    }
+
+    neighbors[pos] = col_idx[k];
+    if (weights) {
+      weights[pos] = values[k];
+    }
+    pos++;
+  }
+}
+
+/* Create a compact graph from mat, borrowing its arrays if borrow is set
+(every row has at most one self-loop) or otherwise copying them, which needs
+32-bit indices and single precision weights. */
+static igraph_error_t se2_csr_to_compact(
+  se2_csr_matrix const* mat, igraph_bool_t const borrow, se2_neighs* res)
+{
+  igraph_integer_t const n_nodes = mat->n_nodes;
+  igraph_bool_t const weighted = mat->values ? true : false;
+
+  se2_borrowed* borrowed = igraph_malloc(sizeof(*borrowed));
+  IGRAPH_CHECK_OOM(borrowed, "");
+  IGRAPH_FINALLY(igraph_free, borrowed);
+  borrowed->neighbors = false;
+  borrowed->weights = false;
+  borrowed->kin = false;
+  borrowed->mapping = NULL;
+  borrowed->lazy = NULL;
+  borrowed->packed = NULL;
+  borrowed->compressed = NULL;
+
+  se2_compact* compact = igraph_malloc(sizeof(*compact));
+  IGRAPH_CHECK_OOM(compact, "");
+  IGRAPH_FINALLY(igraph_free, compact);
+  compact->owned = !borrow;
+  compact->index_type = mat->index_type;
+  compact->value_type = mat->value_type;
+  compact->n_implicit = 0;
+  compact->offsets = IGRAPH_CALLOC(n_nodes + 1, igraph_integer_t);
+  IGRAPH_CHECK_OOM(compact->offsets, "");
+  IGRAPH_FINALLY(igraph_free, compact->offsets);
+  borrowed->compact = compact;
+
+  // The neighbor list is left empty but marks the graph as sparse.
+  res->neigh_list = igraph_malloc(sizeof(*res->neigh_list));
+  IGRAPH_CHECK_OOM(res->neigh_list, "");
+  IGRAPH_FINALLY(igraph_free, res->neigh_list);
+  IGRAPH_CHECK(igraph_vector_int_list_init(res->neigh_list, 0));
+  IGRAPH_FINALLY(igraph_vector_int_list_destroy, res->neigh_list);
+
+  res->sizes = igraph_malloc(sizeof(*res->sizes));
+  IGRAPH_CHECK_OOM(res->sizes, "");
+  IGRAPH_FINALLY(igraph_free, res->sizes);
+  IGRAPH_CHECK(igraph_vector_int_init(res->sizes, n_nodes));
+  IGRAPH_FINALLY(igraph_vector_int_destroy, res->sizes);
+
+  res->kin = igraph_malloc(sizeof(*res->kin));
+  IGRAPH_CHECK_OOM(res->kin, "");
+  IGRAPH_FINALLY(igraph_free, res->kin);
+  IGRAPH_CHECK(igraph_vector_init(res->kin, n_nodes));
+  IGRAPH_FINALLY(igraph_vector_destroy, res->kin);
+
+  if (weighted) {
+    // Likewise left empty so the graph counts as weighted.
+    res->weights = igraph_malloc(sizeof(*res->weights));
+    IGRAPH_CHECK_OOM(res->weights, "");
+    IGRAPH_FINALLY(igraph_free, res->weights);
+    IGRAPH_CHECK(igraph_vector_list_init(res->weights, 0));
+    IGRAPH_FINALLY(igraph_vector_list_destroy, res->weights);
+
+    borrowed->lazy = igraph_malloc(sizeof(*borrowed->lazy));
+    IGRAPH_CHECK_OOM(borrowed->lazy, "");
+    IGRAPH_FINALLY(igraph_free, borrowed->lazy);
+    borrowed->lazy->scale = 1;
+    borrowed->lazy->offset = 0;
+    IGRAPH_CHECK(igraph_vector_init(&borrowed->lazy->diagonal, n_nodes));
+    IGRAPH_FINALLY(igraph_vector_destroy, &borrowed->lazy->diagonal);
+  } else {
+    res->weights = NULL;
+  }
+
+  for (igraph_integer_t i = 0; i < n_nodes; i++) {
+    igraph_integer_t const start =
+      se2_csr_index(mat->row_ptr, mat->index_type, i);
+    igraph_integer_t const end =
+      se2_csr_index(mat->row_ptr, mat->index_type, i + 1);
+    igraph_integer_t n_loops = 0;
+    for (igraph_integer_t k = start; k < end; k++) {
+      n_loops += se2_csr_index(mat->col_idx, mat->index_type, k) == i;
+    }
+
+    igraph_integer_t const n_stored =
+      end - start - (n_loops > 1 ? n_loops - 1 : 0);
+    compact->offsets[i + 1] = compact->offsets[i] + n_stored;
+    VECTOR(*res->sizes)[i] = n_stored + (n_loops == 0);
+    compact->n_implicit += n_loops == 0;
+  }
+
+  if (borrow) {
+    compact->neighbors = mat->col_idx;
+    compact->weights = mat->values;
+  } else {
+    igraph_integer_t const n_edges = compact->offsets[n_nodes];
+    int32_t* neighbors = IGRAPH_CALLOC(n_edges, int32_t);
+    IGRAPH_CHECK_OOM(neighbors, "");
+    IGRAPH_FINALLY(igraph_free, neighbors);
+    float* weights = NULL;
+    if (weighted) {
+      weights = IGRAPH_CALLOC(n_edges, float);
+      IGRAPH_CHECK_OOM(weights, "");
+      IGRAPH_FINALLY(igraph_free, weights);
+    }
+
+    for (igraph_integer_t i = 0; i < n_nodes; i++) {
+      igraph_integer_t const start = compact->offsets[i];
+      se2_csr_compact_row(
+        mat, i, neighbors + start, weights ? weights + start : NULL);
+    }
+
+    compact->neighbors = neighbors;
+    compact->weights = weights;
+  }
+
+  res->n_nodes = n_nodes;
+  res->total_weight = weighted ? 0 : compact->offsets[n_nodes];
+  res->reweighed = false;
+  res->view = NULL;
+  res->borrowed = borrowed;
+
+  for (igraph_integer_t i = 0; weighted && (i < n_nodes); i++) {
+    for (igraph_integer_t k = compact->offsets[i]; k < compact->offsets[i + 1];
+         k++) {
+      igraph_real_t const weight = se2_compact_value(compact, k);
+      if (se2_compact_id(compact, k) == i) {
+        VECTOR(borrowed->lazy->diagonal)[i] = weight;
+      }
+      res->total_weight += weight;
+    }
+  }
+
+  IGRAPH_FINALLY_CLEAN(9 + (weighted ? 4 : 0) +
+                       (borrow ? 0 : (weighted ? 2 : 1)));
+
+  return IGRAPH_SUCCESS;
+}
+
+/* Create a graph from the CSR adjacency matrix mat where row i holds node
+i's neighbors. Destroy res with se2_neighs_destroy when done.
+
+If every row has at most one self-loop, res borrows mat's column indices and
+weights, so they must not change or be freed before res is destroyed.
+Otherwise they are copied. */
+igraph_error_t se2_neighs_from_csr(se2_csr_matrix const* mat, se2_neighs* res)
+{
+  igraph_integer_t const n_nodes = mat->n_nodes;
+  igraph_bool_t unique_loops;
+
+  IGRAPH_CHECK(se2_csr_validate(mat, &unique_loops));
+
+  if (unique_loops) {
+    return se2_csr_to_compact(mat, true, res);
+  }
+
+  if ((mat->index_type == SE2_CSR_INT32) &&
+      (!mat->values || (mat->value_type == SE2_CSR_FLOAT))) {
+    return se2_csr_to_compact(mat, false, res);
+  }
+
+  res->n_nodes = n_nodes;
+  res->total_weight = 0;
+  res->reweighed = false;
+  res->view = NULL;
+  res->borrowed = NULL;
+
+  res->neigh_list = igraph_malloc(sizeof(*res->neigh_list));
+  IGRAPH_CHECK_OOM(res->neigh_list, "");
+  IGRAPH_FINALLY(igraph_free, res->neigh_list);
+  IGRAPH_CHECK(igraph_vector_int_list_init(res->neigh_list, 0));
+  IGRAPH_FINALLY(igraph_vector_int_list_destroy, res->neigh_list);
+  IGRAPH_CHECK(igraph_vector_int_list_reserve(res->neigh_list, n_nodes));
+
+  res->sizes = igraph_malloc(sizeof(*res->sizes));
+  IGRAPH_CHECK_OOM(res->sizes, "");
+  IGRAPH_FINALLY(igraph_free, res->sizes);
+  IGRAPH_CHECK(igraph_vector_int_init(res->sizes, n_nodes));
+  IGRAPH_FINALLY(igraph_vector_int_destroy, res->sizes);
+
+  res->kin = igraph_malloc(sizeof(*res->kin));
+  IGRAPH_CHECK_OOM(res->kin, "");
+  IGRAPH_FINALLY(igraph_free, res->kin);
+  IGRAPH_CHECK(igraph_vector_init(res->kin, n_nodes));
+  IGRAPH_FINALLY(igraph_vector_destroy, res->kin);
+
+  if (mat->values) {
+    res->weights = igraph_malloc(sizeof(*res->weights));
+    IGRAPH_CHECK_OOM(res->weights, "");
+    IGRAPH_FINALLY(igraph_free, res->weights);
+    IGRAPH_CHECK(igraph_vector_list_init(res->weights, 0));
+    IGRAPH_FINALLY(igraph_vector_list_destroy, res->weights);
+    IGRAPH_CHECK(igraph_vector_list_reserve(res->weights, n_nodes));
+  } else {
+    res->weights = NULL;
+  }
+
+  for (igraph_integer_t i = 0; i < n_nodes; i++) {
+    igraph_integer_t const start =
+      se2_csr_index(mat->row_ptr, mat->index_type, i);
+    igraph_integer_t const n_neighs =
+      se2_csr_index(mat->row_ptr, mat->index_type, i + 1) - start;
+    igraph_vector_int_t neighbors;
+    igraph_vector_t weights;
+
+    // Leave room for a self-loop as in se2_neighs_resize_row.
+    IGRAPH_CHECK(igraph_vector_int_init(&neighbors, 0));
+    IGRAPH_FINALLY(igraph_vector_int_destroy, &neighbors);
+    IGRAPH_CHECK(igraph_vector_int_reserve(&neighbors, n_neighs + 1));
+    IGRAPH_CHECK(igraph_vector_int_resize(&neighbors, n_neighs));
+    for (igraph_integer_t j = 0; j < n_neighs; j++) {
+      VECTOR(neighbors)[j] =
+        se2_csr_index(mat->col_idx, mat->index_type, start + j);
+    }
+    // Space was reserved so the list takes ownership without failing.
+    IGRAPH_CHECK(
+      igraph_vector_int_list_push_back(res->neigh_list, &neighbors));
+    IGRAPH_FINALLY_CLEAN(1);
+    VECTOR(*res->sizes)[i] = n_neighs;
+
+    if (!mat->values) {
+      continue;
+    }
+
+    IGRAPH_CHECK(igraph_vector_init(&weights, 0));
+    IGRAPH_FINALLY(igraph_vector_destroy, &weights);
+    IGRAPH_CHECK(igraph_vector_reserve(&weights, n_neighs + 1));
+    IGRAPH_CHECK(igraph_vector_resize(&weights, n_neighs));
+    for (igraph_integer_t j = 0; j < n_neighs; j++) {
+      VECTOR(weights)[j] =
+        se2_csr_value(mat->values, mat->value_type, start + j);
+      res->total_weight += VECTOR(weights)[j];
+    }
+    IGRAPH_CHECK(igraph_vector_list_push_back(res->weights, &weights));
+    IGRAPH_FINALLY_CLEAN(1);
+  }
+
+  if (!mat->values) {
+    res->total_weight = se2_csr_index(mat->row_ptr, mat->index_type, n_nodes);
+  }
+
+  IGRAPH_FINALLY_CLEAN(6 + (mat->values ? 2 : 0));
+
+  return IGRAPH_SUCCESS;
+}
@@ -0,0 +1,158 @@
+/* Copyright 2024 David R. Connell <david32@dcon.addy.io>.
+ *
+ * This file is part of SpeakEasy 2.
+ *
+ * SpeakEasy 2 is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * SpeakEasy 2 is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with SpeakEasy 2. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "se2_neighborlist.h"
+
+/* Dense graphs that borrow a caller's adjacency matrix.
+
+Column i of a full column-major matrix holds the weights of node i's edges to
+every node, in node order, so it is used as node i's weight vector without
+copying. Packed symmetric matrices are read in place through WEIGHT_I instead
+and leave the weight list empty. Either way reweighing never writes to the
+matrix. The scale, offset, and self-loop weights it computes are kept in an
+se2_lazy_weights side array and applied as weights are read. */
+
+/* Initialize res as a dense graph with lazy weights and reserve space for
+n_nodes weight vectors. The initial diagonal, the weights, and the total
+weight are left to the caller. */
+static igraph_error_t se2_borrowed_dense_init(
+  igraph_integer_t const n_nodes, se2_neighs* res)
+{
+  if (n_nodes < 0) {
+    IGRAPH_ERROR("Invalid dense matrix dimensions.", IGRAPH_EINVAL);
+  }
+
+  se2_borrowed* borrowed = igraph_malloc(sizeof(*borrowed));
+  IGRAPH_CHECK_OOM(borrowed, "");
+  IGRAPH_FINALLY(igraph_free, borrowed);
+  borrowed->neighbors = false;
+  borrowed->weights = true;
+  borrowed->kin = false;
+  borrowed->mapping = NULL;
+  borrowed->packed = NULL;
+  borrowed->compact = NULL;
+  borrowed->compressed = NULL;
+
+  borrowed->lazy = igraph_malloc(sizeof(*borrowed->lazy));
+  IGRAPH_CHECK_OOM(borrowed->lazy, "");
+  IGRAPH_FINALLY(igraph_free, borrowed->lazy);
+  borrowed->lazy->scale = 1;
+  borrowed->lazy->offset = 0;
+  IGRAPH_CHECK(igraph_vector_init(&borrowed->lazy->diagonal, n_nodes));
+  IGRAPH_FINALLY(igraph_vector_destroy, &borrowed->lazy->diagonal);
+
+  res->kin = igraph_malloc(sizeof(*res->kin));
+  IGRAPH_CHECK_OOM(res->kin, "");
+  IGRAPH_FINALLY(igraph_free, res->kin);
+  IGRAPH_CHECK(igraph_vector_init(res->kin, n_nodes));
+  IGRAPH_FINALLY(igraph_vector_destroy, res->kin);
+
+  res->weights = igraph_malloc(sizeof(*res->weights));
+  IGRAPH_CHECK_OOM(res->weights, "");
+  IGRAPH_FINALLY(igraph_free, res->weights);
+  IGRAPH_CHECK(igraph_vector_list_init(res->weights, 0));
+  IGRAPH_FINALLY(se2_real_views_destroy, res->weights);
+  IGRAPH_CHECK(igraph_vector_list_reserve(res->weights, n_nodes));
+
+  res->neigh_list = NULL;
+  res->sizes = NULL;
+  res->n_nodes = n_nodes;
+  res->total_weight = 0;
+  res->reweighed = false;
+  res->view = NULL;
+  res->borrowed = borrowed;
+
+  IGRAPH_FINALLY_CLEAN(7);
+
+  return IGRAPH_SUCCESS;
+}
+
+/* Create a dense graph from the n_nodes x n_nodes column-major matrix stored
+in data, where data[(i * n_nodes) + j] is the weight of the edge from node i
+to node j. Destroy res with se2_neighs_destroy when done.
+
+res borrows data, so it must not change or be freed before res is destroyed.
+This is the same layout as the weights of a complete graph whose edges are
+added in order of source then target, as in the dense example. */
+igraph_error_t se2_neighs_from_dense(
+  igraph_real_t const* data, igraph_integer_t const n_nodes, se2_neighs* res)
+{
+  IGRAPH_CHECK(se2_borrowed_dense_init(n_nodes, res));
+
+  for (igraph_integer_t i = 0; i < n_nodes; i++) {
+    igraph_real_t const* column = data + (i * n_nodes);
+    igraph_vector_t weights;
+
+    igraph_vector_view(&weights, column, n_nodes);
+    // Space was reserved so the list takes ownership without failing.
+    IGRAPH_CHECK(igraph_vector_list_push_back(res->weights, &weights));
+
+    VECTOR(res->borrowed->lazy->diagonal)[i] = column[i];
+    for (igraph_integer_t j = 0; j < n_nodes; j++) {
+      res->total_weight += column[j];
+    }
+  }
+
+  return IGRAPH_SUCCESS;
+}
+
+/* Create a dense graph from the square matrix mat, where column i holds the
+weights of node i's edges, i.e. MATRIX(*mat, j, i) is the weight of the edge
+from node i to node j. Destroy res with se2_neighs_destroy when done.
+
+res borrows mat's data, so mat must not change or be freed before res is
+destroyed. */
+igraph_error_t se2_neighs_from_matrix(
+  igraph_matrix_t const* mat, se2_neighs* res)
+{
+  igraph_integer_t const n_nodes = igraph_matrix_nrow(mat);
+
+  if (igraph_matrix_ncol(mat) != n_nodes) {
+    IGRAPH_ERROR("Adjacency matrix must be square.", IGRAPH_NONSQUARE);
+  }
+
+  return se2_neighs_from_dense(&MATRIX(*mat, 0, 0), n_nodes, res);
+}
+
+/* Create a dense graph from a symmetric n_nodes x n_nodes matrix of single
+precision weights stored as its upper triangle, row by row, including the
+diagonal. This is the lower packed ("L") layout of LAPACK, so data holds
+n_nodes * (n_nodes + 1) / 2 values and the weight between nodes i <= j is at
+(i * n_nodes) - (i * (i - 1) / 2) + (j - i). Destroy res with
+se2_neighs_destroy when done.
+
+res borrows data, so it must not change or be freed before res is destroyed.
+This needs a quarter of the memory of a full double precision matrix. */
+igraph_error_t se2_neighs_from_packed(
+  float const* data, igraph_integer_t const n_nodes, se2_neighs* res)
+{
+  IGRAPH_CHECK(se2_borrowed_dense_init(n_nodes, res));
+  res->borrowed->packed = data;
+
+  // Sum in the same order as a full matrix so totals match.
+  for (igraph_integer_t i = 0; i < n_nodes; i++) {
+    VECTOR(res->borrowed->lazy->diagonal)[i] =
+      data[se2_packed_index(n_nodes, i, i)];
+    for (igraph_integer_t j = 0; j < n_nodes; j++) {
+      res->total_weight += data[i <= j ? se2_packed_index(n_nodes, i, j) :
+                                         se2_packed_index(n_nodes, j, i)];
+    }
+  }
+
+  return IGRAPH_SUCCESS;
+}
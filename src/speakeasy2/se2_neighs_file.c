@@ -0,0 +1,486 @@
+/* Copyright 2024 David R. Connell <david32@dcon.addy.io>.
+ *
+ * This file is part of SpeakEasy 2.
+ *
+ * SpeakEasy 2 is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * SpeakEasy 2 is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with SpeakEasy 2. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "se2_mapped_file.h"
+#include "se2_neighborlist.h"
+
+/* Binary file format for se2_neighs so a graph can be converted once and
+then opened by memory mapping instead of being rebuilt from an igraph_t on
+every run.
+
+The file starts with a se2_neighs_file_header followed by these sections,
+each starting on an 8 byte boundary:
+
+  offsets    igraph_integer_t[n_nodes + 1], sparse graphs only. Node i's
+             edges are offsets[i] to offsets[i + 1] - 1 of the next sections.
+  neighbors  igraph_integer_t[n_edges], sparse graphs only.
+  weights    igraph_real_t[n_edges], weighted graphs only.
+  kin        igraph_real_t[n_nodes].
+
+Dense graphs store every node's n_nodes edges in node order without
+offsets or neighbors. Values are stored in the writer's native byte order and
+integer width, files from a machine that differs in either are rejected.
+
+If the graph was reweighed before saving, opening the file uses the mapped
+sections directly as the graph's edges, so opening only reads the header and
+the offsets, not the edges, and processes clustering the same graph share its
+pages. Otherwise, the edges are copied since reweighing modifies them. */
+
+#define SE2_NEIGHS_MAGIC "SE2NEIGH"
+#define SE2_NEIGHS_VERSION 1
+#define SE2_NEIGHS_BYTE_ORDER 0x01020304
+
+#define SE2_NEIGHS_SPARSE 0x1
+#define SE2_NEIGHS_WEIGHTED 0x2
+#define SE2_NEIGHS_REWEIGHED 0x4
+
+#define SE2_ALIGN(n) (((n) + 7) & ~(igraph_integer_t)7)
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t index_size;
+  uint32_t flags;
+  int64_t n_nodes;
+  int64_t n_edges;
+  double total_weight;
+} se2_neighs_file_header;
+
+typedef struct {
+  igraph_integer_t offsets;
+  igraph_integer_t neighbors;
+  igraph_integer_t weights;
+  igraph_integer_t kin;
+  igraph_integer_t size;
+} se2_neighs_file_layout;
+
+/* Byte offsets of each section in a file with the given header. */
+static void se2_neighs_file_layout_init(
+  se2_neighs_file_header const* header, se2_neighs_file_layout* layout)
+{
+  igraph_integer_t pos = sizeof(*header);
+
+  layout->offsets = pos;
+  if (header->flags & SE2_NEIGHS_SPARSE) {
+    pos += SE2_ALIGN((header->n_nodes + 1) * header->index_size);
+  }
+
+  layout->neighbors = pos;
+  if (header->flags & SE2_NEIGHS_SPARSE) {
+    pos += SE2_ALIGN(header->n_edges * header->index_size);
+  }
+
+  layout->weights = pos;
+  if (header->flags & SE2_NEIGHS_WEIGHTED) {
+    pos += header->n_edges * sizeof(igraph_real_t);
+  }
+
+  layout->kin = pos;
+  pos += header->n_nodes * sizeof(igraph_real_t);
+
+  layout->size = pos;
+}
+
+static igraph_error_t se2_file_write(
+  FILE* fh, void const* data, size_t const size, char const* path)
+{
+  if ((size > 0) && (fwrite(data, 1, size, fh) != size)) {
+    IGRAPH_ERRORF("Could not write to \"%s\".", IGRAPH_EFILE, path);
+  }
+
+  return IGRAPH_SUCCESS;
+}
+
+// Pad a section of size bytes to the next section boundary.
+static igraph_error_t se2_file_pad(
+  FILE* fh, igraph_integer_t const size, char const* path)
+{
+  char const zeros[8] = { 0 };
+  return se2_file_write(fh, zeros, SE2_ALIGN(size) - size, path);
+}
+
+/* Save graph to the file at path, replacing it if it exists.
+
+Save graphs after they have been reweighed, by passing them to speak_easy_2,
+to get files that open without copying. */
+igraph_error_t se2_neighs_save(se2_neighs const* graph, char const* path)
+{
+  igraph_integer_t const n_nodes = se2_vcount(graph);
+  igraph_integer_t const index_size = sizeof(igraph_integer_t);
+  se2_neighs_file_header header;
+  FILE* fh;
+
+  if (ISVIEW(*graph)) {
+    IGRAPH_ERROR("Cannot save a view.", IGRAPH_EINVAL);
+  }
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, SE2_NEIGHS_MAGIC, sizeof(header.magic));
+  header.version = SE2_NEIGHS_VERSION;
+  header.byte_order = SE2_NEIGHS_BYTE_ORDER;
+  header.index_size = index_size;
+  header.flags = (ISSPARSE(*graph) ? SE2_NEIGHS_SPARSE : 0) |
+                 (HASWEIGHTS(*graph) ? SE2_NEIGHS_WEIGHTED : 0) |
+                 (graph->reweighed ? SE2_NEIGHS_REWEIGHED : 0);
+  header.n_nodes = n_nodes;
+  header.n_edges = se2_ecount(graph);
+  header.total_weight = graph->total_weight;
+
+  fh = fopen(path, "wb");
+  if (!fh) {
+    IGRAPH_ERRORF("Could not open \"%s\" for writing.", IGRAPH_EFILE, path);
+  }
+  IGRAPH_FINALLY(fclose, fh);
+
+  IGRAPH_CHECK(se2_file_write(fh, &header, sizeof(header), path));
+
+  if (ISSPARSE(*graph)) {
+    igraph_integer_t offset = 0;
+    for (igraph_integer_t i = 0; i < n_nodes; i++) {
+      IGRAPH_CHECK(se2_file_write(fh, &offset, index_size, path));
+      offset += N_NEIGHBORS(*graph, i);
+    }
+    IGRAPH_CHECK(se2_file_write(fh, &offset, index_size, path));
+    IGRAPH_CHECK(se2_file_pad(fh, (n_nodes + 1) * index_size, path));
+
+    for (igraph_integer_t i = 0; i < n_nodes; i++) {
+      if (ISCOMPACT(*graph) || ISCOMPRESSED(*graph)) {
+        for (igraph_integer_t j = 0; j < N_NEIGHBORS(*graph, i); j++) {
+          igraph_integer_t const neigh = NEIGHBOR_I(*graph, i, j);
+          IGRAPH_CHECK(se2_file_write(fh, &neigh, index_size, path));
+        }
+        continue;
+      }
+
+      IGRAPH_CHECK(se2_file_write(fh, VECTOR(NEIGHBORS(*graph, i)),
+        N_NEIGHBORS(*graph, i) * index_size, path));
+    }
+    IGRAPH_CHECK(se2_file_pad(fh, header.n_edges * index_size, path));
+  }
+
+  if (ISLAZY(*graph)) {
+    // Write the reweighed weights, not the borrowed ones.
+    for (igraph_integer_t i = 0; i < n_nodes; i++) {
+      for (igraph_integer_t j = 0; j < N_NEIGHBORS(*graph, i); j++) {
+        igraph_real_t const weight = WEIGHT_I(*graph, i, j);
+        IGRAPH_CHECK(se2_file_write(fh, &weight, sizeof(weight), path));
+      }
+    }
+  } else if (HASWEIGHTS(*graph)) {
+    for (igraph_integer_t i = 0; i < n_nodes; i++) {
+      IGRAPH_CHECK(se2_file_write(fh, VECTOR(WEIGHTS_IN(*graph, i)),
+        N_NEIGHBORS(*graph, i) * sizeof(igraph_real_t), path));
+    }
+  }
+
+  IGRAPH_CHECK(se2_file_write(
+    fh, VECTOR(*graph->kin), n_nodes * sizeof(igraph_real_t), path));
+
+  IGRAPH_FINALLY_CLEAN(1);
+  if (fclose(fh) != 0) {
+    IGRAPH_ERRORF("Could not write to \"%s\".", IGRAPH_EFILE, path);
+  }
+
+  return IGRAPH_SUCCESS;
+}
+
+/* Check the header, section sizes and offsets of a mapped file of size bytes
+before any of it is used. The offsets are needed to split the edges between
+nodes anyway. Every neighbor is also checked to be a node if check_neighbors
+or if the graph will be copied, which reads it all anyway. */
+static igraph_error_t se2_neighs_file_check(char const* data,
+  igraph_integer_t const size, char const* path,
+  igraph_bool_t const check_neighbors, se2_neighs_file_header* header,
+  se2_neighs_file_layout* layout)
+{
+  if ((size_t)size < sizeof(*header)) {
+    IGRAPH_ERRORF("\"%s\" is not a SpeakEasy 2 graph file.", IGRAPH_EFILE,
+      path);
+  }
+
+  memcpy(header, data, sizeof(*header));
+  if (memcmp(header->magic, SE2_NEIGHS_MAGIC, sizeof(header->magic)) != 0) {
+    IGRAPH_ERRORF("\"%s\" is not a SpeakEasy 2 graph file.", IGRAPH_EFILE,
+      path);
+  }
+
+  if ((header->byte_order != SE2_NEIGHS_BYTE_ORDER) ||
+      (header->index_size != sizeof(igraph_integer_t))) {
+    IGRAPH_ERRORF("\"%s\" was written on an incompatible platform.",
+      IGRAPH_EFILE, path);
+  }
+
+  if (header->version != SE2_NEIGHS_VERSION) {
+    IGRAPH_ERRORF("\"%s\" has unsupported version %d.", IGRAPH_EFILE, path,
+      (int)header->version);
+  }
+
+  igraph_bool_t const is_sparse = header->flags & SE2_NEIGHS_SPARSE;
+  igraph_bool_t const stores_edges =
+    header->flags & (SE2_NEIGHS_SPARSE | SE2_NEIGHS_WEIGHTED);
+  igraph_integer_t const n_nodes = header->n_nodes;
+  igraph_integer_t const n_edges = header->n_edges;
+
+  /* Bound the counts by the file size, which every node takes space in and
+  every edge takes space in unless the graph is dense and unweighted, so the
+  section sizes do not overflow. */
+  if ((n_nodes < 0) || (n_nodes > size) || (n_edges < 0) ||
+      (stores_edges && (n_edges > size)) ||
+      (!is_sparse && (n_edges != n_nodes * n_nodes))) {
+    IGRAPH_ERRORF("\"%s\" is corrupt.", IGRAPH_EFILE, path);
+  }
+
+  se2_neighs_file_layout_init(header, layout);
+  if (layout->size != size) {
+    IGRAPH_ERRORF("\"%s\" is corrupt.", IGRAPH_EFILE, path);
+  }
+
+  if (!is_sparse) {
+    return IGRAPH_SUCCESS;
+  }
+
+  igraph_integer_t const* offsets =
+    (igraph_integer_t const*)(data + layout->offsets);
+  igraph_integer_t const* neighbors =
+    (igraph_integer_t const*)(data + layout->neighbors);
+
+  if ((offsets[0] != 0) || (offsets[n_nodes] != n_edges)) {
+    IGRAPH_ERRORF("\"%s\" is corrupt.", IGRAPH_EFILE, path);
+  }
+
+  for (igraph_integer_t i = 0; i < n_nodes; i++) {
+    if (offsets[i + 1] < offsets[i]) {
+      IGRAPH_ERRORF("\"%s\" is corrupt.", IGRAPH_EFILE, path);
+    }
+  }
+
+  if (!check_neighbors && (header->flags & SE2_NEIGHS_REWEIGHED)) {
+    return IGRAPH_SUCCESS;
+  }
+
+  for (igraph_integer_t i = 0; i < n_edges; i++) {
+    if ((neighbors[i] < 0) || (neighbors[i] >= n_nodes)) {
+      IGRAPH_ERRORF("\"%s\" is corrupt.", IGRAPH_EFILE, path);
+    }
+  }
+
+  return IGRAPH_SUCCESS;
+}
+
+/* Split data into a vector per node. Node i's elements start at offsets[i]
+or, if offsets is NULL, at i * n_nodes. If borrow, the vectors are views of
+data instead of copies. */
+static igraph_error_t se2_file_int_list(igraph_vector_int_list_t* list,
+  igraph_integer_t const* data, igraph_integer_t const* offsets,
+  igraph_integer_t const n_nodes, igraph_bool_t const borrow)
+{
+  IGRAPH_CHECK(igraph_vector_int_list_init(list, 0));
+  IGRAPH_FINALLY(
+    borrow ? se2_int_views_destroy : igraph_vector_int_list_destroy, list);
+  IGRAPH_CHECK(igraph_vector_int_list_reserve(list, n_nodes));
+
+  for (igraph_integer_t i = 0; i < n_nodes; i++) {
+    igraph_integer_t const start = offsets ? offsets[i] : i * n_nodes;
+    igraph_integer_t const len =
+      offsets ? offsets[i + 1] - offsets[i] : n_nodes;
+    igraph_vector_int_t item;
+
+    if (borrow) {
+      igraph_vector_int_view(&item, data + start, len);
+    } else {
+      IGRAPH_CHECK(igraph_vector_int_init_array(&item, data + start, len));
+    }
+    // Space was reserved so the list takes ownership without failing.
+    IGRAPH_CHECK(igraph_vector_int_list_push_back(list, &item));
+  }
+
+  IGRAPH_FINALLY_CLEAN(1);
+
+  return IGRAPH_SUCCESS;
+}
+
+static igraph_error_t se2_file_real_list(igraph_vector_list_t* list,
+  igraph_real_t const* data, igraph_integer_t const* offsets,
+  igraph_integer_t const n_nodes, igraph_bool_t const borrow)
+{
+  IGRAPH_CHECK(igraph_vector_list_init(list, 0));
+  IGRAPH_FINALLY(
+    borrow ? se2_real_views_destroy : igraph_vector_list_destroy, list);
+  IGRAPH_CHECK(igraph_vector_list_reserve(list, n_nodes));
+
+  for (igraph_integer_t i = 0; i < n_nodes; i++) {
+    igraph_integer_t const start = offsets ? offsets[i] : i * n_nodes;
+    igraph_integer_t const len =
+      offsets ? offsets[i + 1] - offsets[i] : n_nodes;
+    igraph_vector_t item;
+
+    if (borrow) {
+      igraph_vector_view(&item, data + start, len);
+    } else {
+      IGRAPH_CHECK(igraph_vector_init_array(&item, data + start, len));
+    }
+    IGRAPH_CHECK(igraph_vector_list_push_back(list, &item));
+  }
+
+  IGRAPH_FINALLY_CLEAN(1);
+
+  return IGRAPH_SUCCESS;
+}
+
+/* Fill res from the sections of a checked file. */
+static igraph_error_t se2_file_to_neighs(char const* data,
+  se2_neighs_file_header const* header, se2_neighs_file_layout const* layout,
+  igraph_bool_t const borrow, se2_neighs* res)
+{
+  igraph_integer_t const n_nodes = header->n_nodes;
+  igraph_bool_t const is_sparse = header->flags & SE2_NEIGHS_SPARSE;
+  igraph_bool_t const is_weighted = header->flags & SE2_NEIGHS_WEIGHTED;
+  igraph_integer_t const* offsets =
+    is_sparse ? (igraph_integer_t const*)(data + layout->offsets) : NULL;
+  igraph_real_t const* kin = (igraph_real_t const*)(data + layout->kin);
+
+  res->n_nodes = n_nodes;
+  res->total_weight = header->total_weight;
+  res->reweighed = borrow;
+  res->view = NULL;
+  res->borrowed = NULL;
+
+  if (is_sparse) {
+    res->neigh_list = igraph_malloc(sizeof(*res->neigh_list));
+    IGRAPH_CHECK_OOM(res->neigh_list, "");
+    IGRAPH_FINALLY(igraph_free, res->neigh_list);
+    IGRAPH_CHECK(se2_file_int_list(res->neigh_list,
+      (igraph_integer_t const*)(data + layout->neighbors), offsets, n_nodes,
+      borrow));
+    IGRAPH_FINALLY(
+      borrow ? se2_int_views_destroy : igraph_vector_int_list_destroy,
+      res->neigh_list);
+
+    res->sizes = igraph_malloc(sizeof(*res->sizes));
+    IGRAPH_CHECK_OOM(res->sizes, "");
+    IGRAPH_FINALLY(igraph_free, res->sizes);
+    IGRAPH_CHECK(igraph_vector_int_init(res->sizes, n_nodes));
+    IGRAPH_FINALLY(igraph_vector_int_destroy, res->sizes);
+    for (igraph_integer_t i = 0; i < n_nodes; i++) {
+      VECTOR(*res->sizes)[i] = offsets[i + 1] - offsets[i];
+    }
+  } else {
+    res->neigh_list = NULL;
+    res->sizes = NULL;
+  }
+
+  if (is_weighted) {
+    res->weights = igraph_malloc(sizeof(*res->weights));
+    IGRAPH_CHECK_OOM(res->weights, "");
+    IGRAPH_FINALLY(igraph_free, res->weights);
+    IGRAPH_CHECK(se2_file_real_list(res->weights,
+      (igraph_real_t const*)(data + layout->weights), offsets, n_nodes,
+      borrow));
+    IGRAPH_FINALLY(
+      borrow ? se2_real_views_destroy : igraph_vector_list_destroy,
+      res->weights);
+  } else {
+    res->weights = NULL;
+  }
+
+  res->kin = igraph_malloc(sizeof(*res->kin));
+  IGRAPH_CHECK_OOM(res->kin, "");
+  if (borrow) {
+    igraph_vector_view(res->kin, kin, n_nodes);
+  } else {
+    IGRAPH_FINALLY(igraph_free, res->kin);
+    IGRAPH_CHECK(igraph_vector_init_array(res->kin, kin, n_nodes));
+    IGRAPH_FINALLY_CLEAN(1);
+  }
+
+  IGRAPH_FINALLY_CLEAN((is_sparse ? 4 : 0) + (is_weighted ? 2 : 0));
+
+  return IGRAPH_SUCCESS;
+}
+
+/* Open a graph saved with se2_neighs_save. Destroy res with
+se2_neighs_destroy when done.
+
+If the graph was saved after being reweighed, res borrows the file's mapped
+pages so its edges must not be modified. In that case the neighbors are only
+checked to be valid nodes if check is true, since that reads the whole
+neighbors section. Only pass false for files from a trusted source, a corrupt
+neighbor would be used to index other nodes' data. Graphs that are copied are
+always checked. */
+igraph_error_t se2_neighs_open(
+  char const* path, igraph_bool_t const check, se2_neighs* res)
+{
+  se2_mapped_file file;
+  se2_mapped_view mapping;
+  se2_neighs_file_header header;
+  se2_neighs_file_layout layout;
+  se2_borrowed* borrowed = NULL;
+
+  IGRAPH_CHECK(se2_mapped_file_open(&file, path));
+  IGRAPH_FINALLY(se2_mapped_file_close, &file);
+
+  if (file.size == 0) {
+    IGRAPH_ERRORF("\"%s\" is not a SpeakEasy 2 graph file.", IGRAPH_EFILE,
+      path);
+  }
+
+  IGRAPH_CHECK(se2_mapped_view_init(
+    &mapping, &file, 0, file.size, /* sequential */ false));
+  IGRAPH_FINALLY(se2_mapped_view_destroy, &mapping);
+
+  IGRAPH_CHECK(se2_neighs_file_check(
+    mapping.data, file.size, path, check, &header, &layout));
+
+  igraph_bool_t const borrow = header.flags & SE2_NEIGHS_REWEIGHED;
+  if (borrow) {
+    borrowed = igraph_malloc(sizeof(*borrowed));
+    IGRAPH_CHECK_OOM(borrowed, "");
+    IGRAPH_FINALLY(igraph_free, borrowed);
+    borrowed->mapping = igraph_malloc(sizeof(*borrowed->mapping));
+    IGRAPH_CHECK_OOM(borrowed->mapping, "");
+    IGRAPH_FINALLY(igraph_free, borrowed->mapping);
+  }
+
+  IGRAPH_CHECK(
+    se2_file_to_neighs(mapping.data, &header, &layout, borrow, res));
+
+  if (borrow) {
+    borrowed->neighbors = true;
+    borrowed->weights = true;
+    borrowed->kin = true;
+    *borrowed->mapping = mapping;
+    borrowed->lazy = NULL;
+    borrowed->packed = NULL;
+    borrowed->compact = NULL;
+    borrowed->compressed = NULL;
+    res->borrowed = borrowed;
+    IGRAPH_FINALLY_CLEAN(2);
+  } else {
+    se2_mapped_view_destroy(&mapping);
+  }
+  IGRAPH_FINALLY_CLEAN(1);
+
+  se2_mapped_file_close(&file);
+  IGRAPH_FINALLY_CLEAN(1);
+
+  return IGRAPH_SUCCESS;
+}
@@ -0,0 +1,420 @@
+/* Copyright 2024 David R. Connell <david32@dcon.addy.io>.
+ *
+ * This file is part of SpeakEasy 2.
+ *
+ * SpeakEasy 2 is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * SpeakEasy 2 is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with SpeakEasy 2. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+
+#include "se2_neighborlist.h"
+
+#include <speak_easy_2.h>
+
+#ifdef SE2PAR
+# include <pthread.h>
+#endif
+
+/* Convert an igraph graph to a neighbor list.
+
+The edges are split into one contiguous range per thread and converted in
+four passes. The first counts each node's neighbors in every range. The
+second splits the nodes instead of the edges: the counts size every neighbor
+list exactly, allocated by the thread that owns the node, and become the
+position each range starts writing at within every list. The third pass then
+writes each edge into place, so every node's neighbors end up in edge id
+order regardless of the number of threads. The last pass splits the nodes
+again and merges duplicate neighbors if asked to.
+
+Since every range counts the neighbors of every node, there are never more
+threads than edges per node so the counts of all ranges together take no more
+memory than the edges. */
+
+// Smallest range of edges worth a thread.
+#define SE2_CONVERT_MIN_EDGES (1 << 16)
+
+typedef enum {
+  SE2_CONVERT_COUNT,
+  SE2_CONVERT_ALLOC,
+  SE2_CONVERT_FILL,
+  SE2_CONVERT_FINISH
+} se2_convert_pass;
+
+struct convert_params {
+  igraph_t const* graph;
+  igraph_vector_t const* weights;
+  se2_neighs* res;
+  igraph_bool_t merge_duplicates;
+  se2_convert_pass pass;
+  igraph_integer_t edge_start;
+  igraph_integer_t edge_end;
+  igraph_integer_t node_start;
+  igraph_integer_t node_end;
+  /* Counts of each node's neighbors in the first pass. In the third pass,
+  where to write the next neighbor of each node. In the last pass, where each
+  neighbor of the current node was first seen or -1. */
+  igraph_integer_t* counts;
+  igraph_real_t* row_weights; // Shared, every node's summed weights.
+  struct convert_params* ranges; // Shared, the parameters of every thread.
+  igraph_integer_t n_ranges;
+  igraph_error_t status;
+};
+
+typedef struct {
+  struct convert_params* args;
+  igraph_integer_t n_threads;
+#ifdef SE2PAR
+  pthread_t* threads;
+#endif
+} se2_convert_state;
+
+static void se2_convert_state_destroy(se2_convert_state* state)
+{
+  for (igraph_integer_t tid = 0; tid < state->n_threads; tid++) {
+    free(state->args[tid].counts);
+  }
+  free(state->args);
+#ifdef SE2PAR
+  free(state->threads);
+#endif
+}
+
+static inline void se2_convert_add(struct convert_params* p,
+  igraph_integer_t const from, igraph_integer_t const to,
+  igraph_integer_t const eid)
+{
+  igraph_integer_t const pos = p->counts[from]++;
+
+  if (ISSPARSE(*p->res)) {
+    VECTOR(NEIGHBORS(*p->res, from))[pos] = to;
+  }
+
+  if (p->weights) {
+    VECTOR(WEIGHTS_IN(*p->res, from))[pos] = VECTOR(*p->weights)[eid];
+  }
+}
+
+/* Keep the first copy of every neighbor of node_id, adding the weights of
+later copies to it. seen must be -1 for every node and is left that way. */
+static void se2_convert_merge(struct convert_params* p,
+  igraph_integer_t const node_id, igraph_integer_t* seen)
+{
+  igraph_vector_int_t* neighs = &NEIGHBORS(*p->res, node_id);
+  igraph_vector_t* w = p->weights ? &WEIGHTS_IN(*p->res, node_id) : NULL;
+  igraph_integer_t const n_neighs = igraph_vector_int_size(neighs);
+  igraph_integer_t n_unique = 0;
+
+  for (igraph_integer_t j = 0; j < n_neighs; j++) {
+    igraph_integer_t const neigh = VECTOR(*neighs)[j];
+    if (seen[neigh] != -1) {
+      if (w) {
+        VECTOR(*w)[seen[neigh]] += VECTOR(*w)[j];
+      }
+      continue;
+    }
+
+    seen[neigh] = n_unique;
+    VECTOR(*neighs)[n_unique] = neigh;
+    if (w) {
+      VECTOR(*w)[n_unique] = VECTOR(*w)[j];
+    }
+    n_unique++;
+  }
+
+  for (igraph_integer_t j = 0; j < n_unique; j++) {
+    seen[VECTOR(*neighs)[j]] = -1;
+  }
+
+  igraph_vector_int_remove_section(neighs, n_unique, n_neighs);
+  if (w) {
+    igraph_vector_remove_section(w, n_unique, n_neighs);
+  }
+  VECTOR(*p->res->sizes)[node_id] = n_unique;
+}
+
+static void* se2_thread_convert(void* parameters)
+{
+  struct convert_params* p = (struct convert_params*)parameters;
+  igraph_t const* graph = p->graph;
+  igraph_bool_t const directed = igraph_is_directed(graph);
+
+  if (p->pass == SE2_CONVERT_COUNT) {
+    for (igraph_integer_t eid = p->edge_start; eid < p->edge_end; eid++) {
+      p->counts[IGRAPH_FROM(graph, eid)]++;
+      if (!directed) {
+        p->counts[IGRAPH_TO(graph, eid)]++;
+      }
+    }
+
+    return NULL;
+  }
+
+  if (p->pass == SE2_CONVERT_ALLOC) {
+    igraph_bool_t const is_sparse = ISSPARSE(*p->res);
+    for (igraph_integer_t node_id = p->node_start; node_id < p->node_end;
+         node_id++) {
+      igraph_integer_t n_neighs = 0;
+      for (igraph_integer_t tid = 0; tid < p->n_ranges; tid++) {
+        igraph_integer_t const count = p->ranges[tid].counts[node_id];
+        p->ranges[tid].counts[node_id] = n_neighs;
+        n_neighs += count;
+      }
+
+      if (is_sparse) {
+        VECTOR(*p->res->sizes)[node_id] = n_neighs;
+      }
+      p->status =
+        se2_neighs_resize_row(p->res, node_id, N_NEIGHBORS(*p->res, node_id));
+      if (p->status != IGRAPH_SUCCESS) {
+        return NULL;
+      }
+    }
+
+    return NULL;
+  }
+
+  if (p->pass == SE2_CONVERT_FILL) {
+    for (igraph_integer_t eid = p->edge_start; eid < p->edge_end; eid++) {
+      igraph_integer_t const from = IGRAPH_FROM(graph, eid);
+      igraph_integer_t const to = IGRAPH_TO(graph, eid);
+
+      se2_convert_add(p, from, to, eid);
+      if (!directed) {
+        se2_convert_add(p, to, from, eid);
+      }
+    }
+
+    return NULL;
+  }
+
+  igraph_bool_t const merge = p->merge_duplicates && ISSPARSE(*p->res);
+  if (merge) {
+    for (igraph_integer_t node_id = 0; node_id < p->res->n_nodes;
+         node_id++) {
+      p->counts[node_id] = -1;
+    }
+  }
+
+  for (igraph_integer_t node_id = p->node_start; node_id < p->node_end;
+       node_id++) {
+    if (merge) {
+      se2_convert_merge(p, node_id, p->counts);
+    }
+
+    if (p->weights) {
+      p->row_weights[node_id] =
+        igraph_vector_sum(&WEIGHTS_IN(*p->res, node_id));
+    }
+  }
+
+  return NULL;
+}
+
+static void se2_convert_pass_run(
+  se2_convert_state* state, se2_convert_pass const pass)
+{
+  struct convert_params* args = state->args;
+
+  for (igraph_integer_t tid = 0; tid < state->n_threads; tid++) {
+    args[tid].pass = pass;
+#ifdef SE2PAR
+    pthread_create(
+      &state->threads[tid], NULL, se2_thread_convert, (void*)&args[tid]);
+#else
+    se2_thread_convert((void*)&args[tid]);
+#endif
+  }
+
+#ifdef SE2PAR
+  for (igraph_integer_t tid = 0; tid < state->n_threads; tid++) {
+    pthread_join(state->threads[tid], NULL);
+  }
+#endif
+}
+
+/* Allocate res with an empty list for every node. The lists are sized by the
+allocation pass. */
+static igraph_error_t se2_convert_alloc(igraph_integer_t const n_nodes,
+  igraph_bool_t const is_sparse, igraph_bool_t const weighted,
+  se2_neighs* res)
+{
+  res->n_nodes = n_nodes;
+  res->total_weight = 0;
+  res->reweighed = false;
+  res->view = NULL;
+  res->borrowed = NULL;
+  res->neigh_list = NULL;
+  res->sizes = NULL;
+
+  if (is_sparse) {
+    res->neigh_list = igraph_malloc(sizeof(*res->neigh_list));
+    IGRAPH_CHECK_OOM(res->neigh_list, "");
+    IGRAPH_FINALLY(igraph_free, res->neigh_list);
+    IGRAPH_CHECK(igraph_vector_int_list_init(res->neigh_list, n_nodes));
+    IGRAPH_FINALLY(igraph_vector_int_list_destroy, res->neigh_list);
+
+    res->sizes = igraph_malloc(sizeof(*res->sizes));
+    IGRAPH_CHECK_OOM(res->sizes, "");
+    IGRAPH_FINALLY(igraph_free, res->sizes);
+    IGRAPH_CHECK(igraph_vector_int_init(res->sizes, n_nodes));
+    IGRAPH_FINALLY(igraph_vector_int_destroy, res->sizes);
+  }
+
+  res->kin = igraph_malloc(sizeof(*res->kin));
+  IGRAPH_CHECK_OOM(res->kin, "");
+  IGRAPH_FINALLY(igraph_free, res->kin);
+  IGRAPH_CHECK(igraph_vector_init(res->kin, n_nodes));
+  IGRAPH_FINALLY(igraph_vector_destroy, res->kin);
+
+  if (weighted) {
+    res->weights = igraph_malloc(sizeof(*res->weights));
+    IGRAPH_CHECK_OOM(res->weights, "");
+    IGRAPH_FINALLY(igraph_free, res->weights);
+    IGRAPH_CHECK(igraph_vector_list_init(res->weights, n_nodes));
+    IGRAPH_FINALLY(igraph_vector_list_destroy, res->weights);
+  } else {
+    res->weights = NULL;
+  }
+
+  IGRAPH_FINALLY_CLEAN((is_sparse ? 4 : 0) + 2 + (weighted ? 2 : 0));
+
+  return IGRAPH_SUCCESS;
+}
+
+/* Convert an igraph graph to a neighbor list using up to max_threads
+threads.
+
+If weights is not NULL, it holds the weight of every edge. If the graph is
+directed, the neighbors are the neighbors out from the node, otherwise every
+edge is added in both directions. If merge_duplicates is true, edges
+between the same pair of nodes are merged into one edge whose weight is the
+sum of theirs.
+
+The graph and weights are not needed once converted. Destroy res with
+se2_neighs_destroy when done. */
+igraph_error_t se2_neighs_from_igraph(igraph_t const* graph,
+  igraph_vector_t const* weights, igraph_integer_t max_threads,
+  igraph_bool_t const merge_duplicates, se2_neighs* res)
+{
+  igraph_integer_t const n_nodes = igraph_vcount(graph);
+  igraph_integer_t const n_edges = igraph_ecount(graph);
+  igraph_bool_t const is_sparse = n_edges != (n_nodes * n_nodes);
+  se2_convert_state state;
+
+  if (weights && (igraph_vector_size(weights) != n_edges)) {
+    IGRAPH_ERROR("Weights must have one element per edge.", IGRAPH_EINVAL);
+  }
+
+#ifndef SE2PAR
+  max_threads = 1;
+#endif
+
+  state.n_threads = 1 + (n_edges / SE2_CONVERT_MIN_EDGES);
+  if ((n_nodes > 0) && (state.n_threads > (n_edges / n_nodes))) {
+    state.n_threads = n_edges / n_nodes;
+  }
+
+  if (state.n_threads > max_threads) {
+    state.n_threads = max_threads;
+  }
+
+  if (state.n_threads < 1) {
+    state.n_threads = 1;
+  }
+
+  state.args = calloc(state.n_threads, sizeof(*state.args));
+  IGRAPH_CHECK_OOM(state.args, "Out of memory.");
+#ifdef SE2PAR
+  state.threads = malloc(sizeof(*state.threads) * state.n_threads);
+  if (!state.threads) {
+    free(state.args);
+    IGRAPH_ERROR("Out of memory.", IGRAPH_ENOMEM);
+  }
+#endif
+  IGRAPH_FINALLY(se2_convert_state_destroy, &state);
+
+  igraph_real_t* row_weights = NULL;
+  if (weights) {
+    row_weights = calloc(n_nodes > 0 ? n_nodes : 1, sizeof(*row_weights));
+    IGRAPH_CHECK_OOM(row_weights, "Out of memory.");
+  }
+  IGRAPH_FINALLY(free, row_weights);
+
+  for (igraph_integer_t tid = 0; tid < state.n_threads; tid++) {
+    struct convert_params* p = &state.args[tid];
+    p->counts = calloc(n_nodes > 0 ? n_nodes : 1, sizeof(*p->counts));
+    IGRAPH_CHECK_OOM(p->counts, "Out of memory.");
+
+    p->graph = graph;
+    p->weights = weights;
+    p->res = res;
+    p->merge_duplicates = merge_duplicates;
+    p->edge_start = tid * n_edges / state.n_threads;
+    p->edge_end = (tid + 1) * n_edges / state.n_threads;
+    p->node_start = tid * n_nodes / state.n_threads;
+    p->node_end = (tid + 1) * n_nodes / state.n_threads;
+    p->row_weights = row_weights;
+    p->ranges = state.args;
+    p->n_ranges = state.n_threads;
+    p->status = IGRAPH_SUCCESS;
+  }
+
+  se2_convert_pass_run(&state, SE2_CONVERT_COUNT);
+  IGRAPH_CHECK(se2_convert_alloc(n_nodes, is_sparse, weights != NULL, res));
+  IGRAPH_FINALLY(se2_neighs_destroy, res);
+  se2_convert_pass_run(&state, SE2_CONVERT_ALLOC);
+  for (igraph_integer_t tid = 0; tid < state.n_threads; tid++) {
+    IGRAPH_CHECK(state.args[tid].status);
+  }
+  se2_convert_pass_run(&state, SE2_CONVERT_FILL);
+  se2_convert_pass_run(&state, SE2_CONVERT_FINISH);
+
+  // Summed in node order so the total does not depend on the threads.
+  if (weights) {
+    for (igraph_integer_t node_id = 0; node_id < n_nodes; node_id++) {
+      res->total_weight += row_weights[node_id];
+    }
+  } else {
+    res->total_weight =
+      is_sparse ? igraph_vector_int_sum(res->sizes) : n_nodes * n_nodes;
+  }
+
+  free(row_weights);
+  se2_convert_state_destroy(&state);
+  IGRAPH_FINALLY_CLEAN(3);
+
+  return IGRAPH_SUCCESS;
+}
+
+/* Convert an igraph graph to a list of neighbor lists where the ith vector
+   contains a list of the ith node's neighbors.
+
+   If the graph is weighted, a weight list will be returned in the same
+   structure as the neighbor list. If the graph is not weighted the two weight
+   arguments should be set to NULL.
+
+   If the graph is directed, the neighbors are the neighbors out from the node.
+
+   When finished the SpeakEasy 2 algorithm no longer needs the graph so it is
+   safe to delete the graph (and it's weight vector) unless they are needed
+   elsewhere.
+
+   Same as se2_neighs_from_igraph with a single thread and duplicate edges
+   kept.
+ */
+igraph_error_t se2_igraph_to_neighbor_list(igraph_t const* graph,
+  igraph_vector_t const* weights, se2_neighs* neigh_list)
+{
+  return se2_neighs_from_igraph(graph, weights, 1, false, neigh_list);
+}
@@ -0,0 +1,768 @@
+/* Copyright 2024 David R. Connell <david32@dcon.addy.io>.
+ *
+ * This file is part of SpeakEasy 2.
+ *
+ * SpeakEasy 2 is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * SpeakEasy 2 is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with SpeakEasy 2. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "se2_mapped_file.h"
+#include "se2_neighborlist.h"
+
+#ifdef SE2PAR
+# include <pthread.h>
+#endif
+
+/* Read a graph from a text file straight into a neighbor list.
+
+The file is memory-mapped and split into one chunk of whole lines per
+thread. Each file is parsed twice. The first pass validates the entries and
+counts each node's neighbors per chunk. The counts size every neighbor list
+exactly and become the position each chunk starts writing at within every
+list. The second pass then writes each entry into place. Every node's
+neighbors end up in file order, the same order as converting the graph with
+se2_igraph_to_neighbor_list, regardless of the number of threads.
+
+Since every chunk counts the neighbors of every node, threads are limited so
+the counts of all chunks together take no more memory than the entries they
+were counted from, see se2_read_n_threads. */
+
+// Smallest chunk worth a thread.
+#define SE2_READ_MIN_CHUNK (1 << 20)
+
+// Longest weight token that can be parsed.
+#define SE2_READ_MAX_TOKEN 64
+
+typedef struct {
+  char const* data; // Start of the first line that can hold an entry.
+  igraph_bool_t weighted;
+  igraph_bool_t mirror;      // Add each entry in both directions.
+  igraph_integer_t base;     // Id of the first node.
+  igraph_integer_t n_nodes;  // -1 if taken from the entries.
+  igraph_integer_t n_entries; // -1 if not known.
+} se2_read_header;
+
+typedef enum { SE2_LINE_EMPTY, SE2_LINE_ENTRY, SE2_LINE_INVALID } se2_line;
+
+struct read_params {
+  char const* begin;
+  char const* end;
+  se2_read_header const* header;
+  igraph_bool_t fill; // First pass counts, second pass fills res.
+  /* Counts of neighbors for the nodes with ids below n_counts in the first
+  pass. In the second pass, where to write the next neighbor of each node. */
+  igraph_integer_t* counts;
+  igraph_integer_t n_counts;
+  /* Largest number of counts worth keeping. If an id reaches it, the chunk
+  stops counting and only validates entries, see se2_neighs_read. */
+  igraph_integer_t max_counts;
+  igraph_bool_t over_budget;
+  igraph_integer_t max_id;
+  igraph_integer_t n_entries;
+  se2_neighs* res;
+  igraph_error_t status;
+  char const* bad_line;
+};
+
+typedef struct {
+  struct read_params* args;
+  igraph_integer_t n_threads;
+#ifdef SE2PAR
+  pthread_t* threads;
+#endif
+} se2_read_state;
+
+static void se2_read_state_destroy(se2_read_state* state)
+{
+  for (igraph_integer_t tid = 0; tid < state->n_threads; tid++) {
+    free(state->args[tid].counts);
+  }
+  free(state->args);
+#ifdef SE2PAR
+  free(state->threads);
+#endif
+}
+
+static inline igraph_bool_t se2_is_blank(char const c)
+{
+  return (c == ' ') || (c == '\t') || (c == '\r');
+}
+
+static inline char const* se2_skip_blanks(char const* pos, char const* end)
+{
+  while ((pos < end) && se2_is_blank(*pos)) {
+    pos++;
+  }
+
+  return pos;
+}
+
+static inline char const* se2_line_end(char const* pos, char const* end)
+{
+  char const* eol = memchr(pos, '\n', end - pos);
+  return eol ? eol : end;
+}
+
+static igraph_bool_t se2_parse_id(
+  char const** pos, char const* end, igraph_integer_t* res)
+{
+  char const* p = se2_skip_blanks(*pos, end);
+  char const* start = p;
+  igraph_integer_t value = 0;
+
+  while ((p < end) && (*p >= '0') && (*p <= '9')) {
+    if (value > (IGRAPH_INTEGER_MAX - 9) / 10) {
+      return false;
+    }
+    value = (value * 10) + (*p - '0');
+    p++;
+  }
+
+  if ((p == start) || ((p < end) && !se2_is_blank(*p))) {
+    return false;
+  }
+
+  *pos = p;
+  *res = value;
+
+  return true;
+}
+
+/* Parse plain decimals of at most 15 digits without calling strtod. Such a
+decimal is m / 10^e with both m and 10^e exactly representable, so a single
+correctly rounded division gives the same value strtod would (Clinger's fast
+path). Returns false for anything else. */
+static igraph_bool_t se2_parse_decimal(
+  char const* p, char const* end, igraph_real_t* res)
+{
+  static igraph_real_t const powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6,
+    1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15 };
+  igraph_bool_t const negative = *p == '-';
+  igraph_integer_t mantissa = 0;
+  igraph_integer_t n_digits = 0;
+  igraph_integer_t n_decimals = 0;
+  igraph_bool_t point = false;
+
+  if ((*p == '-') || (*p == '+')) {
+    p++;
+  }
+
+  for (; p < end; p++) {
+    if ((*p >= '0') && (*p <= '9')) {
+      mantissa = (mantissa * 10) + (*p - '0');
+      n_digits++;
+      n_decimals += point;
+    } else if ((*p == '.') && !point) {
+      point = true;
+    } else {
+      return false;
+    }
+  }
+
+  if ((n_digits == 0) || (n_digits > 15)) {
+    return false;
+  }
+
+  *res = (igraph_real_t)mantissa / powers[n_decimals];
+  *res = negative ? -*res : *res;
+
+  return true;
+}
+
+static igraph_bool_t se2_parse_weight(
+  char const** pos, char const* end, igraph_real_t* res)
+{
+  char buf[SE2_READ_MAX_TOKEN];
+  char const* p = se2_skip_blanks(*pos, end);
+  char const* start = p;
+  char* tail;
+
+  while ((p < end) && !se2_is_blank(*p)) {
+    p++;
+  }
+
+  if (p == start) {
+    return false;
+  }
+
+  if (se2_parse_decimal(start, p, res)) {
+    *pos = p;
+    return true;
+  }
+
+  // The file is not null terminated so copy the token for strtod.
+  if ((size_t)(p - start) >= sizeof(buf)) {
+    return false;
+  }
+
+  memcpy(buf, start, p - start);
+  buf[p - start] = '\0';
+  *res = strtod(buf, &tail);
+  if (*tail != '\0') {
+    return false;
+  }
+
+  *pos = p;
+
+  return true;
+}
+
+/* Parse the line starting at *pos and move *pos to the start of the next
+line. Blank lines and lines starting with '#' or '%' are empty. */
+static se2_line se2_parse_line(char const** pos, char const* end,
+  igraph_bool_t const weighted, igraph_integer_t* from, igraph_integer_t* to,
+  igraph_real_t* weight)
+{
+  char const* p = se2_skip_blanks(*pos, end);
+  char const* line_end = se2_line_end(p, end);
+
+  *pos = line_end < end ? line_end + 1 : end;
+
+  if ((p == line_end) || (*p == '#') || (*p == '%')) {
+    return SE2_LINE_EMPTY;
+  }
+
+  if (!se2_parse_id(&p, line_end, from) || !se2_parse_id(&p, line_end, to) ||
+      (weighted && !se2_parse_weight(&p, line_end, weight))) {
+    return SE2_LINE_INVALID;
+  }
+
+  if (se2_skip_blanks(p, line_end) != line_end) {
+    return SE2_LINE_INVALID;
+  }
+
+  return SE2_LINE_ENTRY;
+}
+
+/* Make room to count the neighbors of node_id, growing geometrically since
+ids arrive in any order but never past max_counts. */
+static igraph_bool_t se2_read_reserve(
+  struct read_params* p, igraph_integer_t const node_id)
+{
+  if (node_id < p->n_counts) {
+    return true;
+  }
+
+  igraph_integer_t n_counts = 2 * p->n_counts;
+  if (n_counts > p->max_counts) {
+    n_counts = p->max_counts;
+  }
+
+  if (n_counts <= node_id) {
+    n_counts = node_id + 1;
+  }
+
+  igraph_integer_t* counts = realloc(p->counts, n_counts * sizeof(*counts));
+  if (!counts) {
+    return false;
+  }
+
+  memset(counts + p->n_counts, 0, (n_counts - p->n_counts) * sizeof(*counts));
+  p->counts = counts;
+  p->n_counts = n_counts;
+
+  return true;
+}
+
+static void se2_read_add(struct read_params* p, igraph_integer_t const from,
+  igraph_integer_t const to, igraph_real_t const weight)
+{
+  igraph_integer_t const pos = p->counts[from]++;
+
+  VECTOR(NEIGHBORS(*p->res, from))[pos] = to;
+  if (p->header->weighted) {
+    VECTOR(WEIGHTS_IN(*p->res, from))[pos] = weight;
+  }
+}
+
+static void* se2_thread_read(void* parameters)
+{
+  struct read_params* p = (struct read_params*)parameters;
+  se2_read_header const* header = p->header;
+  char const* pos = p->begin;
+
+  while (pos < p->end) {
+    char const* line = pos;
+    igraph_integer_t from;
+    igraph_integer_t to;
+    igraph_real_t weight = 1;
+    se2_line const kind =
+      se2_parse_line(&pos, p->end, header->weighted, &from, &to, &weight);
+
+    if (kind == SE2_LINE_EMPTY) {
+      continue;
+    }
+
+    from -= header->base;
+    to -= header->base;
+    if ((kind == SE2_LINE_INVALID) || (from < 0) || (to < 0) ||
+        ((header->n_nodes != -1) &&
+          ((from >= header->n_nodes) || (to >= header->n_nodes)))) {
+      p->status = IGRAPH_PARSEERROR;
+      p->bad_line = line;
+      return NULL;
+    }
+
+    igraph_bool_t const mirror = header->mirror && (from != to);
+
+    if (p->fill) {
+      se2_read_add(p, from, to, weight);
+      if (mirror) {
+        se2_read_add(p, to, from, weight);
+      }
+      continue;
+    }
+
+    p->n_entries++;
+    p->max_id = from > p->max_id ? from : p->max_id;
+    p->max_id = to > p->max_id ? to : p->max_id;
+
+    if (p->over_budget) {
+      continue;
+    }
+
+    if (p->max_id >= p->max_counts) {
+      free(p->counts);
+      p->counts = NULL;
+      p->n_counts = 0;
+      p->over_budget = true;
+      continue;
+    }
+
+    if (!se2_read_reserve(p, from) || (mirror && !se2_read_reserve(p, to))) {
+      p->status = IGRAPH_ENOMEM;
+      return NULL;
+    }
+
+    p->counts[from]++;
+    if (mirror) {
+      p->counts[to]++;
+    }
+  }
+
+  return NULL;
+}
+
+/* Run one pass over all chunks and report the first chunk's error. */
+static igraph_error_t se2_read_pass(
+  se2_read_state* state, igraph_bool_t const fill, char const* path)
+{
+  struct read_params* args = state->args;
+
+  for (igraph_integer_t tid = 0; tid < state->n_threads; tid++) {
+    args[tid].fill = fill;
+#ifdef SE2PAR
+    pthread_create(
+      &state->threads[tid], NULL, se2_thread_read, (void*)&args[tid]);
+#else
+    se2_thread_read((void*)&args[tid]);
+#endif
+  }
+
+#ifdef SE2PAR
+  for (igraph_integer_t tid = 0; tid < state->n_threads; tid++) {
+    pthread_join(state->threads[tid], NULL);
+  }
+#endif
+
+  for (igraph_integer_t tid = 0; tid < state->n_threads; tid++) {
+    if (args[tid].status == IGRAPH_ENOMEM) {
+      IGRAPH_ERROR("Out of memory.", IGRAPH_ENOMEM);
+    }
+
+    if (args[tid].status != IGRAPH_SUCCESS) {
+      char const* line = args[tid].bad_line;
+      int const len = se2_line_end(line, args[tid].end) - line;
+      IGRAPH_ERRORF("Invalid entry in \"%s\": \"%.*s\".", IGRAPH_PARSEERROR,
+        path, len < 60 ? len : 60, line);
+    }
+  }
+
+  return IGRAPH_SUCCESS;
+}
+
+/* Copy the next blank separated token of [*pos, end) into buf in lower
+case. */
+static igraph_bool_t se2_read_token(
+  char const** pos, char const* end, char* buf, size_t const size)
+{
+  char const* p = se2_skip_blanks(*pos, end);
+  size_t len = 0;
+
+  while ((p < end) && !se2_is_blank(*p)) {
+    if (len == size - 1) {
+      return false;
+    }
+    buf[len++] = (*p >= 'A') && (*p <= 'Z') ? *p - 'A' + 'a' : *p;
+    p++;
+  }
+  buf[len] = '\0';
+  *pos = p;
+
+  return len > 0;
+}
+
+static igraph_error_t se2_read_mm_header(char const* begin, char const* end,
+  char const* path, se2_read_header* header)
+{
+  char const* pos = begin;
+  char const* line_end = se2_line_end(pos, end);
+  char banner[16];
+  char object[16];
+  char format[16];
+  char field[16];
+  char symmetry[16];
+
+  if (!se2_read_token(&pos, line_end, banner, sizeof(banner)) ||
+      (strcmp(banner, "%%matrixmarket") != 0) ||
+      !se2_read_token(&pos, line_end, object, sizeof(object)) ||
+      !se2_read_token(&pos, line_end, format, sizeof(format)) ||
+      !se2_read_token(&pos, line_end, field, sizeof(field)) ||
+      !se2_read_token(&pos, line_end, symmetry, sizeof(symmetry))) {
+    IGRAPH_ERRORF("\"%s\" is not a Matrix Market file.", IGRAPH_PARSEERROR,
+      path);
+  }
+
+  if ((strcmp(object, "matrix") != 0) ||
+      (strcmp(format, "coordinate") != 0) ||
+      ((strcmp(field, "real") != 0) && (strcmp(field, "integer") != 0) &&
+        (strcmp(field, "pattern") != 0)) ||
+      ((strcmp(symmetry, "general") != 0) &&
+        (strcmp(symmetry, "symmetric") != 0))) {
+    IGRAPH_ERRORF("Only real, integer, or pattern coordinate matrices with "
+                  "general or symmetric symmetry can be read from \"%s\".",
+      IGRAPH_UNIMPLEMENTED, path);
+  }
+
+  header->weighted = strcmp(field, "pattern") != 0;
+  header->mirror = strcmp(symmetry, "symmetric") == 0;
+  header->base = 1;
+
+  // Skip comments to the size line.
+  pos = line_end;
+  while (pos < end) {
+    char const* line = se2_skip_blanks(pos + 1, end);
+    line_end = se2_line_end(line, end);
+    pos = line_end;
+    if ((line != line_end) && (*line != '%')) {
+      igraph_integer_t n_rows;
+      igraph_integer_t n_cols;
+
+      if (!se2_parse_id(&line, line_end, &n_rows) ||
+          !se2_parse_id(&line, line_end, &n_cols) ||
+          !se2_parse_id(&line, line_end, &header->n_entries) ||
+          (se2_skip_blanks(line, line_end) != line_end)) {
+        break;
+      }
+
+      if (n_rows != n_cols) {
+        IGRAPH_ERRORF("The matrix in \"%s\" must be square to be a graph.",
+          IGRAPH_EINVAL, path);
+      }
+
+      header->n_nodes = n_rows;
+      header->data = line_end < end ? line_end + 1 : end;
+
+      return IGRAPH_SUCCESS;
+    }
+  }
+
+  IGRAPH_ERRORF("Missing or invalid size line in \"%s\".", IGRAPH_PARSEERROR,
+    path);
+}
+
+// The first entry decides whether the edge list is weighted.
+static igraph_error_t se2_read_edgelist_header(char const* begin,
+  char const* end, char const* path, igraph_bool_t const directed,
+  se2_read_header* header)
+{
+  char const* pos = begin;
+
+  header->data = begin;
+  header->weighted = false;
+  header->mirror = !directed;
+  header->base = 0;
+  header->n_nodes = -1;
+  header->n_entries = -1;
+
+  while (pos < end) {
+    char const* line = se2_skip_blanks(pos, end);
+    char const* line_end = se2_line_end(line, end);
+    char token[SE2_READ_MAX_TOKEN];
+    igraph_integer_t n_tokens = 0;
+
+    pos = line_end < end ? line_end + 1 : end;
+    if ((line == line_end) || (*line == '#') || (*line == '%')) {
+      continue;
+    }
+
+    while (se2_read_token(&line, line_end, token, sizeof(token))) {
+      n_tokens++;
+    }
+
+    if ((n_tokens != 2) && (n_tokens != 3)) {
+      IGRAPH_ERRORF("Edge list lines in \"%s\" must have two node ids and an "
+                    "optional weight.",
+        IGRAPH_PARSEERROR, path);
+    }
+
+    header->weighted = n_tokens == 3;
+    break;
+  }
+
+  return IGRAPH_SUCCESS;
+}
+
+/* Allocate res with the summed neighbor counts of every chunk and turn each
+chunk's counts into where it starts writing in every list. */
+static igraph_error_t se2_read_alloc(se2_read_state* state,
+  igraph_integer_t const n_nodes, igraph_bool_t const weighted,
+  se2_neighs* res)
+{
+  struct read_params* args = state->args;
+
+  res->n_nodes = n_nodes;
+  res->total_weight = 0;
+  res->reweighed = false;
+  res->view = NULL;
+  res->borrowed = NULL;
+
+  res->neigh_list = igraph_malloc(sizeof(*res->neigh_list));
+  IGRAPH_CHECK_OOM(res->neigh_list, "");
+  IGRAPH_FINALLY(igraph_free, res->neigh_list);
+  IGRAPH_CHECK(igraph_vector_int_list_init(res->neigh_list, n_nodes));
+  IGRAPH_FINALLY(igraph_vector_int_list_destroy, res->neigh_list);
+
+  res->sizes = igraph_malloc(sizeof(*res->sizes));
+  IGRAPH_CHECK_OOM(res->sizes, "");
+  IGRAPH_FINALLY(igraph_free, res->sizes);
+  IGRAPH_CHECK(igraph_vector_int_init(res->sizes, n_nodes));
+  IGRAPH_FINALLY(igraph_vector_int_destroy, res->sizes);
+
+  res->kin = igraph_malloc(sizeof(*res->kin));
+  IGRAPH_CHECK_OOM(res->kin, "");
+  IGRAPH_FINALLY(igraph_free, res->kin);
+  IGRAPH_CHECK(igraph_vector_init(res->kin, n_nodes));
+  IGRAPH_FINALLY(igraph_vector_destroy, res->kin);
+
+  if (weighted) {
+    res->weights = igraph_malloc(sizeof(*res->weights));
+    IGRAPH_CHECK_OOM(res->weights, "");
+    IGRAPH_FINALLY(igraph_free, res->weights);
+    IGRAPH_CHECK(igraph_vector_list_init(res->weights, n_nodes));
+    IGRAPH_FINALLY(igraph_vector_list_destroy, res->weights);
+  } else {
+    res->weights = NULL;
+  }
+
+  for (igraph_integer_t node_id = 0; node_id < n_nodes; node_id++) {
+    igraph_integer_t n_neighs = 0;
+    for (igraph_integer_t tid = 0; tid < state->n_threads; tid++) {
+      if (node_id < args[tid].n_counts) {
+        igraph_integer_t const count = args[tid].counts[node_id];
+        args[tid].counts[node_id] = n_neighs;
+        n_neighs += count;
+      }
+    }
+
+    VECTOR(*res->sizes)[node_id] = n_neighs;
+    IGRAPH_CHECK(se2_neighs_resize_row(res, node_id, n_neighs));
+  }
+
+  IGRAPH_FINALLY_CLEAN(weighted ? 8 : 6);
+
+  return IGRAPH_SUCCESS;
+}
+
+/* Number of threads to read size bytes of entries of a graph with n_nodes
+nodes (0 if not known yet) with. Each thread needs its own count for every
+node and the counts are summed over threads per node, so threads are limited
+to one per n_nodes counts worth of bytes. Below that, threads would spend more
+memory and time on counts than on entries. */
+static igraph_integer_t se2_read_n_threads(igraph_integer_t const size,
+  igraph_integer_t const n_nodes, igraph_integer_t const max_threads)
+{
+  igraph_integer_t n_threads = 1 + (size / SE2_READ_MIN_CHUNK);
+
+  if ((n_nodes > 0) &&
+      (n_threads > (size / (igraph_integer_t)sizeof(igraph_integer_t)) /
+                     n_nodes)) {
+    n_threads = (size / (igraph_integer_t)sizeof(igraph_integer_t)) / n_nodes;
+  }
+
+  if (n_threads > max_threads) {
+    n_threads = max_threads;
+  }
+
+  return n_threads < 1 ? 1 : n_threads;
+}
+
+/* Split the entries into one chunk of whole lines per thread, resetting the
+threads' parameters without freeing their counts. If bounded, each chunk only
+keeps as many counts as its bytes would hold. */
+static void se2_read_split(se2_read_state* state,
+  se2_read_header const* header, char const* end,
+  igraph_bool_t const bounded, se2_neighs* res)
+{
+  char const* chunk_start = header->data;
+
+  for (igraph_integer_t tid = 0; tid < state->n_threads; tid++) {
+    struct read_params* args = &state->args[tid];
+    char const* chunk_end = end;
+    if (tid < (state->n_threads - 1)) {
+      chunk_end =
+        header->data + ((tid + 1) * (end - header->data) / state->n_threads);
+      if (chunk_end < chunk_start) {
+        chunk_end = chunk_start;
+      } else {
+        chunk_end = se2_line_end(chunk_end, end);
+        chunk_end = chunk_end < end ? chunk_end + 1 : end;
+      }
+    }
+
+    memset(args, 0, sizeof(*args));
+    args->begin = chunk_start;
+    args->end = chunk_end;
+    args->header = header;
+    args->max_counts =
+      bounded && (state->n_threads > 1) ?
+        (chunk_end - chunk_start) / (igraph_integer_t)sizeof(*args->counts) :
+        IGRAPH_INTEGER_MAX;
+    args->max_id = -1;
+    args->res = res;
+    args->status = IGRAPH_SUCCESS;
+    chunk_start = chunk_end;
+  }
+}
+
+/* Read the graph in the edge list or Matrix Market file at path into res
+using up to max_threads threads.
+
+Edge lists have one "from to" or "from to weight" entry per line with node
+ids starting at 0. The graph has one more node than the largest id. If the
+first entry has a weight every entry must. Matrix Market files must hold a
+square coordinate matrix whose entry (i, j) is the edge from node i - 1 to
+node j - 1, pattern matrices are unweighted. In both formats, blank lines and
+lines starting with '#' or '%' are skipped.
+
+Undirected graphs, edge lists when directed is false and symmetric Matrix
+Market files, add each entry in both directions except self-loops which are
+added once. directed is ignored for Matrix Market files since their header
+says whether they are symmetric.
+
+Destroy res with se2_neighs_destroy when done. */
+igraph_error_t se2_neighs_read(char const* path,
+  se2_edges_format const format, igraph_bool_t const directed,
+  igraph_integer_t max_threads, se2_neighs* res)
+{
+  se2_mapped_file file;
+  se2_mapped_view mapping;
+  se2_read_header header;
+  se2_read_state state;
+
+  IGRAPH_CHECK(se2_mapped_file_open(&file, path));
+  IGRAPH_FINALLY(se2_mapped_file_close, &file);
+
+  if (file.size == 0) {
+    IGRAPH_ERRORF("\"%s\" is empty.", IGRAPH_PARSEERROR, path);
+  }
+
+  IGRAPH_CHECK(se2_mapped_view_init(
+    &mapping, &file, 0, file.size, /* sequential */ true));
+  IGRAPH_FINALLY(se2_mapped_view_destroy, &mapping);
+
+  char const* begin = mapping.data;
+  char const* end = begin + file.size;
+
+  if (format == SE2_MATRIX_MARKET) {
+    IGRAPH_CHECK(se2_read_mm_header(begin, end, path, &header));
+  } else {
+    IGRAPH_CHECK(
+      se2_read_edgelist_header(begin, end, path, directed, &header));
+  }
+
+#ifndef SE2PAR
+  max_threads = 1;
+#endif
+
+  state.n_threads = se2_read_n_threads(end - header.data,
+    header.n_nodes == -1 ? 0 : header.n_nodes, max_threads);
+
+  state.args = calloc(state.n_threads, sizeof(*state.args));
+  IGRAPH_CHECK_OOM(state.args, "Out of memory.");
+#ifdef SE2PAR
+  state.threads = malloc(sizeof(*state.threads) * state.n_threads);
+  if (!state.threads) {
+    free(state.args);
+    IGRAPH_ERROR("Out of memory.", IGRAPH_ENOMEM);
+  }
+#endif
+  IGRAPH_FINALLY(se2_read_state_destroy, &state);
+
+  // The number of nodes is only known up front for Matrix Market files.
+  se2_read_split(&state, &header, end, header.n_nodes == -1, res);
+  IGRAPH_CHECK(se2_read_pass(&state, /* fill */ false, path));
+
+  igraph_integer_t n_nodes = header.n_nodes == -1 ? 0 : header.n_nodes;
+  igraph_integer_t n_entries = 0;
+  igraph_bool_t over_budget = false;
+  for (igraph_integer_t tid = 0; tid < state.n_threads; tid++) {
+    n_entries += state.args[tid].n_entries;
+    over_budget |= state.args[tid].over_budget;
+    if (state.args[tid].max_id >= n_nodes) {
+      n_nodes = state.args[tid].max_id + 1;
+    }
+  }
+
+  /* Some chunk saw ids too large for its size so the edge list has many
+  nodes compared to its entries. Count again with the threads limited by the
+  number of nodes, which is now known. */
+  if (over_budget) {
+    for (igraph_integer_t tid = 0; tid < state.n_threads; tid++) {
+      free(state.args[tid].counts);
+    }
+    state.n_threads =
+      se2_read_n_threads(end - header.data, n_nodes, state.n_threads);
+    se2_read_split(&state, &header, end, false, res);
+    IGRAPH_CHECK(se2_read_pass(&state, /* fill */ false, path));
+  }
+
+  if ((header.n_entries != -1) && (n_entries != header.n_entries)) {
+    IGRAPH_ERRORF("\"%s\" has %" IGRAPH_PRId " entries but its size line "
+                  "says it has %" IGRAPH_PRId ".",
+      IGRAPH_PARSEERROR, path, n_entries, header.n_entries);
+  }
+
+  IGRAPH_CHECK(se2_read_alloc(&state, n_nodes, header.weighted, res));
+  // Parsing the same lines again cannot fail.
+  IGRAPH_CHECK(se2_read_pass(&state, /* fill */ true, path));
+
+  // Summed in node order so the total does not depend on the chunks.
+  if (header.weighted) {
+    for (igraph_integer_t node_id = 0; node_id < n_nodes; node_id++) {
+      res->total_weight += igraph_vector_sum(&WEIGHTS_IN(*res, node_id));
+    }
+  } else {
+    res->total_weight = igraph_vector_int_sum(res->sizes);
+  }
+
+  se2_read_state_destroy(&state);
+  se2_mapped_view_destroy(&mapping);
+  se2_mapped_file_close(&file);
+  IGRAPH_FINALLY_CLEAN(3);
+
+  return IGRAPH_SUCCESS;
+}
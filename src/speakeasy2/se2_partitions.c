@@ -56,6 +56,57 @@ static igraph_error_t se2_count_global_labels(se2_neighs const* graph,
   igraph_vector_null(global_labels_heard);
   igraph_real_t* global_labels = VECTOR(*global_labels_heard);
   igraph_integer_t const* labels_i = VECTOR(*labels);
+  if (ISVIEW(*graph)) {
+    for (igraph_integer_t node_id = 0; node_id < n_nodes; node_id++) {
+      for (igraph_integer_t j = 0; j < N_NEIGHBORS(*graph, node_id); j++) {
+        igraph_integer_t const neigh = NEIGHBOR(*graph, node_id, j);
+        if (neigh != -1) {
+          global_labels[labels_i[neigh]] += WEIGHT(*graph, node_id, j);
+        }
+      }
+    }
+
+    return IGRAPH_SUCCESS;
+  }
+
+  if (ISPACKED(*graph)) {
+    for (igraph_integer_t node_id = 0; node_id < n_nodes; node_id++) {
+      se2_packed_add_row(graph, node_id, labels_i, global_labels);
+    }
+
+    return IGRAPH_SUCCESS;
+  }
+
+  if (ISCOMPACT(*graph)) {
+    for (igraph_integer_t node_id = 0; node_id < n_nodes; node_id++) {
+      se2_compact_add_row(graph, node_id, labels_i, global_labels);
+    }
+
+    return IGRAPH_SUCCESS;
+  }
+
+  if (ISCOMPRESSED(*graph)) {
+    for (igraph_integer_t node_id = 0; node_id < n_nodes; node_id++) {
+      se2_compressed_add_row(graph, node_id, labels_i, global_labels);
+    }
+
+    return IGRAPH_SUCCESS;
+  }
+
+  if (ISLAZY(*graph)) {
+    // Dense, so the neighbor is j.
+    se2_lazy_weights const* lazy = graph->borrowed->lazy;
+    for (igraph_integer_t node_id = 0; node_id < n_nodes; node_id++) {
+      igraph_real_t const* weights = VECTOR(WEIGHTS_IN(*graph, node_id));
+      for (igraph_integer_t j = 0; j < n_nodes; j++) {
+        global_labels[labels_i[j]] +=
+          se2_lazy_weight(lazy, node_id, weights[j], j == node_id);
+      }
+    }
+
+    return IGRAPH_SUCCESS;
+  }
+
   for (igraph_integer_t node_id = 0; node_id < n_nodes; node_id++) {
     igraph_integer_t* neighbors =
       graph->neigh_list ? VECTOR(VECTOR(*graph->neigh_list)[node_id]) : NULL;
@@ -245,11 +296,20 @@ igraph_error_t se2_iterator_k_worst_fit_nodes_init(se2_iterator* iterator,
   for (igraph_integer_t node_id = 0; node_id < partition->n_nodes; node_id++) {
     igraph_integer_t label_id = LABEL(*partition)[node_id];
     igraph_real_t actual = 0;
-    for (igraph_integer_t i = 0; i < N_NEIGHBORS(*graph, node_id); i++) {
-      actual +=
-        LABEL(*partition)[NEIGHBOR(*graph, node_id, i)] == label_id ?
-          WEIGHT(*graph, node_id, i) :
-          0;
+    if (ISCOMPRESSED(*graph)) {
+      actual = se2_compressed_label_weight(
+        graph, node_id, LABEL(*partition), label_id);
+    } else {
+      for (igraph_integer_t i = 0; i < N_NEIGHBORS(*graph, node_id); i++) {
+        igraph_integer_t const neigh = NEIGHBOR(*graph, node_id, i);
+        if (neigh == -1) {
+          continue;
+        }
+
+        actual += LABEL(*partition)[neigh] == label_id ?
+                    WEIGHT(*graph, node_id, i) :
+                    0;
+      }
     }
     igraph_real_t expected = VECTOR(*partition->global_labels_heard)[label_id];
     igraph_real_t norm_factor =
@@ -18,227 +18,400 @@
 
 #include "se2_reweigh_graph.h"
 
+#include <stdlib.h>
+
 #include "se2_interface.h"
 #include "se2_neighborlist.h"
 
+#ifdef SE2PAR
+# include <pthread.h>
+#endif
+
 #define ABS(a) (a) > 0 ? (a) : -(a);
 
-static igraph_real_t skewness(se2_neighs const* graph)
+/* Reweighing divides every weight by the largest magnitude of a non-self-loop
+edge, sets the weight of each node's single self-loop, and, for skewed
+weights without negatives, adds the mean self-loop weight to every edge.
+
+The nodes are split into one contiguous range per thread and the graph is
+read in at most three passes. The first collects the statistics (skewness,
+largest magnitude, and whether any weight is negative) and makes sure every
+node has exactly one self-loop. The second rescales each row and sets its
+self-loop weight. Only when an offset is added does a third pass add it. Row
+totals are summed in node order and in-degrees are accumulated in row order
+so the results do not depend on the number of threads. */
+
+// Smallest number of edges worth a thread.
+#define SE2_REWEIGH_MIN_EDGES (1 << 16)
+
+typedef enum {
+  SE2_REWEIGH_STATS,
+  SE2_REWEIGH_ROWS,
+  SE2_REWEIGH_OFFSET
+} se2_reweigh_pass;
+
+typedef struct {
+  se2_neighs* graph;
+  se2_lazy_weights* lazy;
+  igraph_integer_t* diagonal_edges; // Position of each node's self-loop.
+  igraph_real_t* row_weights;       // Summed weights of each row.
+  igraph_integer_t n_given;         // Edges before self-loops are fixed.
+  igraph_real_t avg;                // Mean weight before reweighing.
+  igraph_real_t max_magnitude;
+  igraph_real_t offset;
+  igraph_bool_t is_skewed;
+  igraph_bool_t add_offset;
+  igraph_bool_t add_kin; // Accumulate in-degrees in the last pass.
+} se2_reweigh_shared;
+
+struct reweigh_params {
+  se2_reweigh_shared const* shared;
+  se2_reweigh_pass pass;
+  igraph_integer_t start;
+  igraph_integer_t end;
+  igraph_real_t numerator;
+  igraph_real_t denominator;
+  igraph_real_t max_magnitude;
+  igraph_bool_t has_negatives;
+  igraph_error_t status;
+};
+
+/* Where reweighing results go for graphs whose stored weights must not be
+modified, or NULL if the weights are reweighed in place. */
+static se2_lazy_weights* se2_lazy(se2_neighs* graph)
 {
-  if (!HASWEIGHTS(*graph)) {
-    return 0;
+  if (ISVIEW(*graph)) {
+    return &graph->view->lazy;
   }
 
-  igraph_integer_t const n_nodes = se2_vcount(graph);
-  igraph_integer_t const n_edges = se2_ecount(graph);
-  igraph_real_t const avg = se2_total_weight(graph) / n_edges;
-  igraph_real_t skew = 0;
+  return ISLAZY(*graph) ? graph->borrowed->lazy : NULL;
+}
 
-  igraph_real_t numerator = 0;
-  igraph_real_t denominator = 0;
-  for (igraph_integer_t i = 0; i < n_nodes; i++) {
-    for (igraph_integer_t j = 0; j < N_NEIGHBORS(*graph, i); j++) {
-      igraph_real_t value = WEIGHT(*graph, i, j) - avg;
-      igraph_real_t value_sq = value * value;
-      denominator += value_sq;
-      numerator += value * value_sq;
-    }
+/* Views and compact or compressed graphs have exactly one self-loop per node
+whose weight is stored in the lazy diagonal. */
+static inline igraph_bool_t se2_has_diagonal(se2_neighs const* graph)
+{
+  return ISVIEW(*graph) || ISCOMPACT(*graph) || ISCOMPRESSED(*graph);
+}
+
+/* Number of edges the graph was given, leaving out the self-loops it added,
+see se2_added_loop. */
+static inline igraph_integer_t se2_given_ecount(se2_neighs const* graph)
+{
+  if (ISCOMPACT(*graph)) {
+    return se2_ecount(graph) - graph->borrowed->compact->n_implicit;
   }
-  numerator /= n_edges;
-  denominator /= n_edges;
-  denominator = sqrt(denominator * denominator * denominator);
 
-  skew = numerator / denominator;
+  if (ISCOMPRESSED(*graph)) {
+    return se2_ecount(graph) - graph->borrowed->compressed->n_added;
+  }
 
-  return skew;
+  return se2_ecount(graph);
 }
 
-static igraph_error_t se2_mean_link_weight(
-  se2_neighs const* graph, igraph_vector_t* diagonal_weights)
+/* Record the position of node i's self-loop in diag, making sure there is
+exactly one. A single pass over the row keeps the first self-loop and shifts
+the edges after any extra ones down over them. Nodes without a self-loop get
+one appended, constructors leave room for it with se2_neighs_resize_row. */
+static igraph_error_t se2_collect_sparse_diagonal(
+  se2_neighs* graph, igraph_integer_t const i, igraph_integer_t* diag)
 {
-  igraph_integer_t const n_nodes = se2_vcount(graph);
+  igraph_vector_int_t* neighbors = &NEIGHBORS(*graph, i);
+  igraph_vector_t* w = HASWEIGHTS(*graph) ? &WEIGHTS_IN(*graph, i) : NULL;
+  igraph_integer_t const n_neighs = N_NEIGHBORS(*graph, i);
+  igraph_integer_t diag_pos = -1;
+  igraph_integer_t n_kept = 0;
+
+  for (igraph_integer_t j = 0; j < n_neighs; j++) {
+    igraph_integer_t const neigh = VECTOR(*neighbors)[j];
+    if (neigh == i) {
+      if (diag_pos != -1) { // Already found a diagonal.
+        continue;
+      }
 
-  for (igraph_integer_t i = 0; i < n_nodes; i++) {
-    igraph_integer_t signs = 0;
-    for (igraph_integer_t j = 0; j < N_NEIGHBORS(*graph, i); j++) {
-      VECTOR(*diagonal_weights)[i] += WEIGHT(*graph, i, j);
-      if (WEIGHT(*graph, i, j)) {
-        signs += WEIGHT(*graph, i, j) < 0 ? -1 : 1;
+      diag_pos = n_kept;
+    }
+
+    // Rows may be borrowed read-only so only write edges that move.
+    if (n_kept != j) {
+      VECTOR(*neighbors)[n_kept] = neigh;
+      if (w) {
+        VECTOR(*w)[n_kept] = VECTOR(*w)[j];
       }
     }
-    VECTOR(*diagonal_weights)[i] /= (signs == 0 ? 1 : signs);
+    n_kept++;
   }
 
+  if (n_kept < n_neighs) {
+    igraph_vector_int_remove_section(neighbors, n_kept, n_neighs);
+    if (w) {
+      igraph_vector_remove_section(w, n_kept, n_neighs);
+    }
+    VECTOR(*graph->sizes)[i] = n_kept;
+  }
+
+  if (diag_pos == -1) {
+    IGRAPH_CHECK(igraph_vector_int_push_back(neighbors, i));
+    if (w) {
+      IGRAPH_CHECK(igraph_vector_push_back(w, 0));
+    }
+    diag_pos = VECTOR(*graph->sizes)[i]++;
+  }
+
+  diag[i] = diag_pos;
+
   return IGRAPH_SUCCESS;
 }
 
-static igraph_error_t se2_collect_sparse_diagonal(
-  se2_neighs* graph, igraph_vector_int_t* diag)
+/* Accumulate the statistics of the weights as given and find every node's
+self-loop. */
+static void se2_reweigh_stats(struct reweigh_params* p)
 {
-  igraph_integer_t const n_nodes = se2_vcount(graph);
-  for (igraph_integer_t i = 0; i < n_nodes; i++) {
-    igraph_bool_t found_edge = false;
-    for (igraph_integer_t j = 0; j < N_NEIGHBORS(*graph, i); j++) {
-      if (NEIGHBOR(*graph, i, j) == i) {
-        if (found_edge) { // Already found a diagonal.
-          igraph_vector_int_remove(&NEIGHBORS(*graph, i), j);
-          VECTOR(*graph->sizes)[i]--;
-          if (HASWEIGHTS(*graph)) {
-            igraph_vector_remove(&WEIGHTS_IN(*graph, i), j);
-          }
-        } else {
-          found_edge = true;
-          VECTOR(*diag)[i] = j;
-          /* Importantly set to 0 so diagonal weights don't impact
-             calculation of mean link weight if skewed. Diagonal weights will
-             be written over anyway. */
-          if (HASWEIGHTS(*graph)) {
-            igraph_vector_t* w = &WEIGHTS_IN(*graph, i);
-            VECTOR(*w)[j] = 0;
-          }
+  se2_reweigh_shared const* shared = p->shared;
+  se2_neighs* graph = shared->graph;
+  igraph_bool_t const weighted = HASWEIGHTS(*graph);
+  igraph_bool_t const dense = !ISSPARSE(*graph) && !se2_has_diagonal(graph);
+
+  for (igraph_integer_t i = p->start; i < p->end; i++) {
+    igraph_real_t row_sum = 0;
+    igraph_integer_t signs = 0;
+    for (igraph_integer_t j = 0; weighted && (j < N_NEIGHBORS(*graph, i));
+         j++) {
+      igraph_integer_t const neigh = NEIGHBOR(*graph, i, j);
+      // As if appended after the statistics like se2_collect_sparse_diagonal.
+      if ((neigh == -1) || ((neigh == i) && se2_added_loop(graph, i, j))) {
+        continue;
+      }
+
+      igraph_real_t const weight = WEIGHT(*graph, i, j);
+      igraph_real_t const value = weight - shared->avg;
+      igraph_real_t const value_sq = value * value;
+      p->denominator += value_sq;
+      p->numerator += value * value_sq;
+
+      if (dense) {
+        row_sum += weight;
+        if (weight) {
+          signs += weight < 0 ? -1 : 1;
         }
       }
-    }
 
-    if (!found_edge) {
-      IGRAPH_CHECK(igraph_vector_int_push_back(&NEIGHBORS(*graph, i), i));
-      VECTOR(*diag)[i] = VECTOR(*graph->sizes)[i]++;
-      if (HASWEIGHTS(*graph)) {
-        igraph_vector_t* w = &WEIGHTS_IN(*graph, i);
-        IGRAPH_CHECK(igraph_vector_resize(w, N_NEIGHBORS(*graph, i)));
-        VECTOR(*w)[igraph_vector_size(w) - 1] = 0;
+      if (neigh == i) {
+        continue;
+      }
+
+      igraph_real_t const magnitude = ABS(weight);
+      if (magnitude > p->max_magnitude) {
+        p->max_magnitude = magnitude;
+      }
+
+      if (weight < 0) {
+        p->has_negatives = true;
       }
     }
-  }
 
-  return IGRAPH_SUCCESS;
-}
+    // Dense self-loops count towards the mean link weight se2_reweigh_rows
+    // gives them, which is negative if the row sum and the balance of signs
+    // disagree, even without negative links. Rescaling keeps both signs.
+    if (dense && (((row_sum < 0) && (signs >= 0)) ||
+                   ((row_sum > 0) && (signs < 0)))) {
+      p->has_negatives = true;
+    }
 
-static igraph_error_t se2_weigh_diagonal(
-  se2_neighs* graph, igraph_bool_t is_skewed, igraph_bool_t verbose)
-{
-  igraph_integer_t const n_nodes = se2_vcount(graph);
-  igraph_vector_int_t diagonal_edges;
+    if (shared->lazy || se2_has_diagonal(graph)) {
+      continue;
+    }
 
-  IGRAPH_CHECK(igraph_vector_int_init(&diagonal_edges, n_nodes));
-  IGRAPH_FINALLY(igraph_vector_int_destroy, &diagonal_edges);
+    if (!ISSPARSE(*graph)) {
+      shared->diagonal_edges[i] = i;
+      continue;
+    }
 
-  if (ISSPARSE(*graph)) {
-    IGRAPH_CHECK(se2_collect_sparse_diagonal(graph, &diagonal_edges));
-  } else {
-    for (igraph_integer_t i = 0; i < n_nodes; i++) {
-      VECTOR(diagonal_edges)[i] = i;
+    p->status = se2_collect_sparse_diagonal(graph, i, shared->diagonal_edges);
+    if (p->status != IGRAPH_SUCCESS) {
+      return;
     }
   }
+}
 
-  if (!HASWEIGHTS(*graph)) {
-    goto cleanup;
+static void se2_reweigh_add_kin(se2_neighs* graph, igraph_integer_t const i)
+{
+  for (igraph_integer_t j = 0; j < N_NEIGHBORS(*graph, i); j++) {
+    igraph_integer_t const neigh = NEIGHBOR(*graph, i, j);
+    if (neigh != -1) {
+      VECTOR(*graph->kin)[neigh] += WEIGHT(*graph, i, j);
+    }
   }
+}
 
-  igraph_vector_t diagonal_weights;
-  IGRAPH_CHECK(igraph_vector_init(&diagonal_weights, n_nodes));
-  IGRAPH_FINALLY(igraph_vector_destroy, &diagonal_weights);
+/* Sum row i once it holds its final weights. */
+static void se2_reweigh_finish_row(
+  se2_reweigh_shared const* shared, igraph_integer_t const i)
+{
+  se2_neighs* graph = shared->graph;
 
-  if (is_skewed) {
-    if (verbose) {
-      SE2_PUTS(
-        "High skew to edge weight distribution; reweighing main diagonal.");
+  if (shared->lazy) {
+    igraph_real_t row_weight = 0;
+    for (igraph_integer_t j = 0; j < N_NEIGHBORS(*graph, i); j++) {
+      if (NEIGHBOR(*graph, i, j) != -1) {
+        row_weight += WEIGHT(*graph, i, j);
+      }
     }
-    IGRAPH_CHECK(se2_mean_link_weight(graph, &diagonal_weights));
+    shared->row_weights[i] = row_weight;
   } else {
-    igraph_vector_fill(&diagonal_weights, 1);
+    shared->row_weights[i] = igraph_vector_sum(&WEIGHTS_IN(*graph, i));
   }
 
-  for (igraph_integer_t i = 0; i < n_nodes; i++) {
-    igraph_vector_t* w = &WEIGHTS_IN(*graph, i);
-    VECTOR(*w)[VECTOR(diagonal_edges)[i]] = VECTOR(diagonal_weights)[i];
+  if (shared->add_kin) {
+    se2_reweigh_add_kin(graph, i);
   }
-
-  igraph_vector_destroy(&diagonal_weights);
-  IGRAPH_FINALLY_CLEAN(1);
-
-cleanup:
-  igraph_vector_int_destroy(&diagonal_edges);
-  IGRAPH_FINALLY_CLEAN(1);
-
-  return IGRAPH_SUCCESS;
 }
 
-static void se2_reweigh_i(se2_neighs* graph)
+/* Rescale each row and set its self-loop weight. If the graph is skewed, the
+self-loop gets the mean weight of the node's other edges, otherwise 1. */
+static void se2_reweigh_rows(struct reweigh_params* p)
 {
-  if (!HASWEIGHTS(*graph)) {
-    return;
-  }
+  se2_reweigh_shared const* shared = p->shared;
+  se2_neighs* graph = shared->graph;
+  se2_lazy_weights* lazy = shared->lazy;
+  igraph_real_t const max_magnitude = shared->max_magnitude;
+
+  for (igraph_integer_t i = p->start; i < p->end; i++) {
+    igraph_vector_t* w = lazy ? NULL : &WEIGHTS_IN(*graph, i);
+
+    /* Importantly set the self-loop to 0 so its weight doesn't impact
+       calculation of mean link weight if skewed, except for dense graphs.
+       It is written over anyway. */
+    if (lazy) {
+      VECTOR(lazy->diagonal)[i] = se2_has_diagonal(graph) ?
+                                    0 :
+                                    VECTOR(lazy->diagonal)[i] / max_magnitude;
+    } else {
+      for (igraph_integer_t j = 0; j < N_NEIGHBORS(*graph, i); j++) {
+        VECTOR(*w)[j] /= max_magnitude;
+      }
 
-  igraph_real_t max_magnitude_weight = 0;
-  igraph_real_t current_magnitude = 0;
-  for (igraph_integer_t i = 0; i < se2_vcount(graph); i++) {
-    for (igraph_integer_t j = 0; j < N_NEIGHBORS(*graph, i); j++) {
-      if (NEIGHBOR(*graph, i, j) == i) {
-        continue;
+      if (ISSPARSE(*graph)) {
+        VECTOR(*w)[shared->diagonal_edges[i]] = 0;
       }
+    }
 
-      current_magnitude = ABS(WEIGHT(*graph, i, j));
-      if (current_magnitude > max_magnitude_weight) {
-        max_magnitude_weight = current_magnitude;
+    igraph_real_t diagonal_weight = 1;
+    if (shared->is_skewed) {
+      igraph_integer_t signs = 0;
+      diagonal_weight = 0;
+      for (igraph_integer_t j = 0; j < N_NEIGHBORS(*graph, i); j++) {
+        if (NEIGHBOR(*graph, i, j) == -1) {
+          continue;
+        }
+
+        igraph_real_t const weight = WEIGHT(*graph, i, j);
+        diagonal_weight += weight;
+        if (weight) {
+          signs += weight < 0 ? -1 : 1;
+        }
       }
+      diagonal_weight /= (signs == 0 ? 1 : signs);
     }
-  }
 
-  for (igraph_integer_t i = 0; i < se2_vcount(graph); i++) {
-    igraph_vector_t* weight = &WEIGHTS_IN(*graph, i);
-    for (igraph_integer_t j = 0; j < N_NEIGHBORS(*graph, i); j++) {
-      VECTOR(*weight)[j] /= max_magnitude_weight;
+    if (lazy) {
+      VECTOR(lazy->diagonal)[i] = diagonal_weight;
+    } else {
+      VECTOR(*w)[shared->diagonal_edges[i]] = diagonal_weight;
+    }
+
+    if (!shared->add_offset) {
+      se2_reweigh_finish_row(shared, i);
     }
   }
-  graph->total_weight /= max_magnitude_weight;
 }
 
-static igraph_error_t se2_add_offset(se2_neighs* graph, igraph_bool_t verbose)
+static void se2_reweigh_offset(struct reweigh_params* p)
 {
-  igraph_integer_t const n_nodes = se2_vcount(graph);
-  igraph_real_t offset = 0;
-
-  if (verbose) {
-    SE2_PUTS("adding very small offset to all edges");
-  }
-
-  for (igraph_integer_t i = 0; i < n_nodes; i++) {
-    for (igraph_integer_t j = 0; j < N_NEIGHBORS(*graph, i); j++) {
-      if (NEIGHBOR(*graph, i, j) == i) {
-        offset += WEIGHT(*graph, i, j);
-        break; // Already ensured there is only one self-loop per node.
+  se2_reweigh_shared const* shared = p->shared;
+  se2_neighs* graph = shared->graph;
+  se2_lazy_weights* lazy = shared->lazy;
+
+  for (igraph_integer_t i = p->start; i < p->end; i++) {
+    if (lazy) {
+      VECTOR(lazy->diagonal)[i] += shared->offset;
+    } else {
+      igraph_vector_t* w = &WEIGHTS_IN(*graph, i);
+      for (igraph_integer_t j = 0; j < N_NEIGHBORS(*graph, i); j++) {
+        VECTOR(*w)[j] += shared->offset;
       }
     }
+
+    se2_reweigh_finish_row(shared, i);
   }
-  offset /= n_nodes;
+}
 
-  for (igraph_integer_t i = 0; i < n_nodes; i++) {
-    igraph_vector_t* w = &WEIGHTS_IN(*graph, i);
-    for (igraph_integer_t j = 0; j < N_NEIGHBORS(*graph, i); j++) {
-      VECTOR(*w)[j] += offset;
-    }
+static void* se2_thread_reweigh(void* parameters)
+{
+  struct reweigh_params* p = (struct reweigh_params*)parameters;
+
+  switch (p->pass) {
+  case SE2_REWEIGH_STATS:
+    se2_reweigh_stats(p);
+    break;
+  case SE2_REWEIGH_ROWS:
+    se2_reweigh_rows(p);
+    break;
+  case SE2_REWEIGH_OFFSET:
+    se2_reweigh_offset(p);
+    break;
   }
 
-  return IGRAPH_SUCCESS;
+  return NULL;
 }
 
-static igraph_bool_t se2_vector_list_has_negatives(se2_neighs const* graph)
+/* Run one pass over all ranges and return the first range's error. */
+static igraph_error_t se2_reweigh_run(struct reweigh_params* args,
+  igraph_integer_t const n_threads, se2_reweigh_pass const pass)
 {
-  for (igraph_integer_t i = 0; i < se2_vcount(graph); i++) {
-    for (igraph_integer_t j = 0; j < N_NEIGHBORS(*graph, i); j++) {
-      if (WEIGHT(*graph, i, j) < 0) {
-        return true;
-      }
-    }
+#ifdef SE2PAR
+  pthread_t* threads = malloc(sizeof(*threads) * n_threads);
+  IGRAPH_CHECK_OOM(threads, "Out of memory.");
+#endif
+
+  for (igraph_integer_t tid = 0; tid < n_threads; tid++) {
+    args[tid].pass = pass;
+#ifdef SE2PAR
+    pthread_create(&threads[tid], NULL, se2_thread_reweigh, &args[tid]);
+#else
+    se2_thread_reweigh(&args[tid]);
+#endif
+  }
+
+#ifdef SE2PAR
+  for (igraph_integer_t tid = 0; tid < n_threads; tid++) {
+    pthread_join(threads[tid], NULL);
+  }
+  free(threads);
+#endif
+
+  for (igraph_integer_t tid = 0; tid < n_threads; tid++) {
+    IGRAPH_CHECK(args[tid].status);
   }
 
-  return false;
+  return IGRAPH_SUCCESS;
 }
 
+/* Recalculate the total weight and in-degrees of a graph from its edges. */
 void se2_recalc_degrees(se2_neighs* graph)
 {
-  if (HASWEIGHTS(*graph)) {
+  if ((ISVIEW(*graph) || ISLAZY(*graph)) && HASWEIGHTS(*graph)) {
+    graph->total_weight = 0;
+    for (igraph_integer_t i = 0; i < se2_vcount(graph); i++) {
+      igraph_real_t row_weight = 0;
+      for (igraph_integer_t j = 0; j < N_NEIGHBORS(*graph, i); j++) {
+        if (NEIGHBOR(*graph, i, j) != -1) {
+          row_weight += WEIGHT(*graph, i, j);
+        }
+      }
+      graph->total_weight += row_weight;
+    }
+  } else if (HASWEIGHTS(*graph)) {
     graph->total_weight = 0;
     for (igraph_integer_t i = 0; i < se2_vcount(graph); i++) {
       graph->total_weight += igraph_vector_sum(&WEIGHTS_IN(*graph, i));
@@ -247,29 +420,149 @@ void se2_recalc_degrees(se2_neighs* graph)
     graph->total_weight = se2_ecount(graph);
   }
 
+  igraph_vector_null(graph->kin);
   for (igraph_integer_t i = 0; i < graph->n_nodes; i++) {
-    VECTOR(*graph->kin)[i] = 0;
+    se2_reweigh_add_kin(graph, i);
   }
+}
 
-  for (igraph_integer_t i = 0; i < graph->n_nodes; i++) {
-    for (igraph_integer_t j = 0; j < N_NEIGHBORS(*graph, i); j++) {
-      VECTOR(*graph->kin)[NEIGHBOR(*graph, i, j)] += WEIGHT(*graph, i, j);
+/* Rescale the weights and set the self-loop weights once the first pass has
+collected the statistics. */
+static igraph_error_t se2_reweigh_weights(struct reweigh_params* args,
+  igraph_integer_t const n_threads, se2_reweigh_shared* shared,
+  igraph_bool_t const verbose)
+{
+  se2_neighs* graph = shared->graph;
+  se2_lazy_weights* lazy = shared->lazy;
+  igraph_integer_t const n_nodes = se2_vcount(graph);
+  igraph_real_t numerator = 0;
+  igraph_real_t denominator = 0;
+  igraph_bool_t has_negatives = false;
+
+  for (igraph_integer_t tid = 0; tid < n_threads; tid++) {
+    numerator += args[tid].numerator;
+    denominator += args[tid].denominator;
+    if (args[tid].max_magnitude > shared->max_magnitude) {
+      shared->max_magnitude = args[tid].max_magnitude;
+    }
+    has_negatives = has_negatives || args[tid].has_negatives;
+  }
+  numerator /= shared->n_given;
+  denominator /= shared->n_given;
+  denominator = sqrt(denominator * denominator * denominator);
+  shared->is_skewed = (numerator / denominator) >= 2;
+
+  if (shared->is_skewed && verbose) {
+    SE2_PUTS(
+      "High skew to edge weight distribution; reweighing main diagonal.");
+  }
+
+  /* A self-loop weight can only be negative if one of the node's other
+     weights is or, for dense graphs, its mean link weight is, both known
+     before rescaling. */
+  shared->add_offset = shared->is_skewed && !has_negatives;
+  shared->add_kin = n_threads == 1;
+  if (lazy) {
+    lazy->scale = shared->max_magnitude;
+  }
+
+  igraph_vector_null(graph->kin);
+  IGRAPH_CHECK(se2_reweigh_run(args, n_threads, SE2_REWEIGH_ROWS));
+
+  if (shared->add_offset) {
+    if (verbose) {
+      SE2_PUTS("adding very small offset to all edges");
+    }
+
+    for (igraph_integer_t i = 0; i < n_nodes; i++) {
+      shared->offset +=
+        lazy ? VECTOR(lazy->diagonal)[i] :
+               VECTOR(WEIGHTS_IN(*graph, i))[shared->diagonal_edges[i]];
+    }
+    shared->offset /= n_nodes;
+
+    if (lazy) {
+      lazy->offset = shared->offset;
+    }
+
+    IGRAPH_CHECK(se2_reweigh_run(args, n_threads, SE2_REWEIGH_OFFSET));
+  }
+
+  graph->total_weight = 0;
+  for (igraph_integer_t i = 0; i < n_nodes; i++) {
+    graph->total_weight += shared->row_weights[i];
+  }
+
+  if (!shared->add_kin) {
+    for (igraph_integer_t i = 0; i < n_nodes; i++) {
+      se2_reweigh_add_kin(graph, i);
     }
   }
+
+  return IGRAPH_SUCCESS;
 }
 
-igraph_error_t se2_reweigh(se2_neighs* graph, igraph_bool_t verbose)
+igraph_error_t se2_reweigh(
+  se2_neighs* graph, igraph_integer_t max_threads, igraph_bool_t verbose)
 {
-  igraph_bool_t is_skewed = skewness(graph) >= 2;
+  igraph_integer_t const n_nodes = se2_vcount(graph);
+  igraph_integer_t const n_edges = se2_ecount(graph);
+  // The statistics pass fixes the self-loops, so count the edges before it.
+  igraph_integer_t const n_given = se2_given_ecount(graph);
+  se2_reweigh_shared shared = {
+    .graph = graph,
+    .lazy = se2_lazy(graph),
+    .n_given = n_given,
+    .avg = HASWEIGHTS(*graph) ? se2_total_weight(graph) / n_given : 0,
+  };
+
+#ifndef SE2PAR
+  max_threads = 1;
+#endif
+
+  igraph_integer_t n_threads = 1 + (n_edges / SE2_REWEIGH_MIN_EDGES);
+  if (n_threads > max_threads) {
+    n_threads = max_threads;
+  }
 
-  se2_reweigh_i(graph);
-  IGRAPH_CHECK(se2_weigh_diagonal(graph, is_skewed, verbose));
+  if (n_threads < 1) {
+    n_threads = 1;
+  }
 
-  if ((is_skewed) && (!se2_vector_list_has_negatives(graph))) {
-    se2_add_offset(graph, verbose);
+  struct reweigh_params* args = calloc(n_threads, sizeof(*args));
+  IGRAPH_CHECK_OOM(args, "Out of memory.");
+  IGRAPH_FINALLY(free, args);
+
+  shared.diagonal_edges =
+    calloc(n_nodes > 0 ? n_nodes : 1, sizeof(*shared.diagonal_edges));
+  IGRAPH_CHECK_OOM(shared.diagonal_edges, "Out of memory.");
+  IGRAPH_FINALLY(free, shared.diagonal_edges);
+
+  shared.row_weights =
+    calloc(n_nodes > 0 ? n_nodes : 1, sizeof(*shared.row_weights));
+  IGRAPH_CHECK_OOM(shared.row_weights, "Out of memory.");
+  IGRAPH_FINALLY(free, shared.row_weights);
+
+  for (igraph_integer_t tid = 0; tid < n_threads; tid++) {
+    args[tid].shared = &shared;
+    args[tid].start = tid * n_nodes / n_threads;
+    args[tid].end = (tid + 1) * n_nodes / n_threads;
+    args[tid].status = IGRAPH_SUCCESS;
+  }
+
+  IGRAPH_CHECK(se2_reweigh_run(args, n_threads, SE2_REWEIGH_STATS));
+
+  if (HASWEIGHTS(*graph)) {
+    IGRAPH_CHECK(se2_reweigh_weights(args, n_threads, &shared, verbose));
+  } else {
+    se2_recalc_degrees(graph);
   }
+  graph->reweighed = true;
 
-  se2_recalc_degrees(graph);
+  free(shared.row_weights);
+  free(shared.diagonal_edges);
+  free(args);
+  IGRAPH_FINALLY_CLEAN(3);
 
   return IGRAPH_SUCCESS;
 }
@@ -21,6 +21,7 @@
 
 #include <speak_easy_2.h>
 
-igraph_error_t se2_reweigh(se2_neighs* graph, igraph_bool_t verbose);
+igraph_error_t se2_reweigh(
+  se2_neighs* graph, igraph_integer_t max_threads, igraph_bool_t verbose);
 
 #endif
@@ -53,7 +53,7 @@ igraph_error_t se2_seeding(se2_neighs const* graph, se2_options const* opts,
 
   for (igraph_integer_t i = 0; i < n_nodes; i++) {
     // If node's only incoming edge is a self-loop.
-    if (N_NEIGHBORS(*graph, i) == 1) {
+    if (se2_degree(graph, i) == 1) {
       VECTOR(*ic_store)[i] = ++biggest_label;
       n_unique_i++;
     }